@@ -0,0 +1,28 @@
+/**
+ * Scales the scene of a view to its viewport. The scene is drawn into the
+ * top left region of a target that may be larger than it, and that region
+ * may be smaller than the viewport when the resolution is scaled down.
+ */
+struct BlitUniforms {
+    // Texture coordinates of the scene per window pixel
+    uvScale: vec2f,
+    // Top left corner of the viewport in the window, in pixels
+    origin: vec2f,
+}
+
+@group(0) @binding(0) var sourceTexture: texture_2d<f32>;
+@group(0) @binding(1) var sourceSampler: sampler;
+@group(0) @binding(2) var<uniform> uBlit: BlitUniforms;
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+    // One triangle covering the viewport
+    let corner = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+    return vec4f(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+    // At full resolution, this lands on texel centers
+    return textureSample(sourceTexture, sourceSampler, (position.xy - uBlit.origin) * uBlit.uvScale);
+}
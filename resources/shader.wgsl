@@ -10,6 +10,7 @@ struct VertexOutput {
     @location(0) color: vec3f,
     @location(1) normal: vec3f,
     @location(2) uv: vec2f,
+    @location(3) @interpolate(flat) objectIndex: u32,
 };
 
 /**
@@ -18,9 +19,20 @@ struct VertexOutput {
 struct MyUniforms {
     projectionMatrix: mat4x4f,
     viewMatrix: mat4x4f,
+    time: f32,
+    // Lowered by the quality governor under load
+    lodBias: f32,
+    lightCount: u32,
+};
+
+/**
+ * The data of each object, indexed by the instance index of its draw
+ */
+struct ObjectData {
     modelMatrix: mat4x4f,
+    normalMatrix: mat4x4f,
     color: vec4f,
-    time: f32,
+    materialId: u32,
 };
 
 /**
@@ -31,18 +43,60 @@ struct LightingUniforms {
     colors: array<vec4f, 2>,
 }
 
+/**
+ * Where a material lives in the packed texture array
+ */
+struct MaterialEntry {
+    uvRect: vec4f,
+    layer: u32,
+    virtualTexture: u32,
+}
+
+// Set when the target encodes to sRGB itself
+override srgbTarget: bool = false;
+
+// Layer of a material drawn white, see ZTexturePacker::NoLayer
+const noLayer: u32 = 0xffffffffu;
+// Virtual texture of the packed materials, see
+// ZTexturePacker::NoVirtualTexture
+const noVirtualTexture: u32 = 0xffffffffu;
+
 @group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
-// @group(0) @binding(1) var baseColorTexture: texture_2d<f32>;
-// @group(0) @binding(2) var textureSampler: sampler;
 @group(0) @binding(1) var<uniform> uLighting: LightingUniforms;
+@group(0) @binding(2) var baseColorTextures: texture_2d_array<f32>;
+@group(0) @binding(3) var textureSampler: sampler;
+@group(0) @binding(4) var<storage, read> uMaterials: array<MaterialEntry>;
+@group(0) @binding(5) var<storage, read> uObjects: array<ObjectData>;
+
+fn sampleBaseColor(materialId: u32, uv: vec2f) -> vec3f {
+    // Gradients of the unwrapped UVs, so that the mip level does not jump at
+    // the seams of the wrap. Taken before any branch, where they are defined.
+    let uvDx = dpdx(uv);
+    let uvDy = dpdy(uv);
+    let material = uMaterials[materialId];
+    // The draw binds the parameters of the material's virtual texture
+    if (material.virtualTexture != noVirtualTexture) {
+        return sampleVirtualGrad(uv, uvDx, uvDy).rgb;
+    }
+    if (material.layer == noLayer) {
+        return vec3f(1.0);
+    }
+    // Wrap inside the material's rectangle, the sampler itself clamps
+    let packedUv = material.uvRect.xy + fract(uv) * material.uvRect.zw;
+    // The LOD bias scales the gradients, textureSampleGrad takes no bias
+    let scale = material.uvRect.zw * exp2(uMyUniforms.lodBias);
+    return textureSampleGrad(baseColorTextures, textureSampler, packedUv, material.layer, uvDx * scale, uvDy * scale).rgb;
+}
 
 @vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+fn vs_main(in: VertexInput, @builtin(instance_index) objectIndex: u32) -> VertexOutput {
+    let object = uObjects[objectIndex];
     var out: VertexOutput;
-    out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * uMyUniforms.modelMatrix * vec4f(in.position, 1.0);
-    out.normal = (uMyUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+    out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * object.modelMatrix * vec4f(in.position, 1.0);
+    out.normal = (object.normalMatrix * vec4f(in.normal, 0.0)).xyz;
     out.color = in.color;
     out.uv = in.uv;
+    out.objectIndex = objectIndex;
     return out;
 }
 
@@ -51,7 +105,8 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 // Compute shading
     let normal = normalize(in.normal);
     var shading = vec3f(0.0);
-    for (var i: i32 = 0; i < 2; i++) {
+    let lightCount = min(uMyUniforms.lightCount, 2u);
+    for (var i: u32 = 0u; i < lightCount; i++) {
         let direction = normalize(uLighting.directions[i].xyz);
         let color = uLighting.colors[i].rgb;
         shading += max(0.0, dot(direction, normal)) * color;
@@ -63,13 +118,17 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f {
     }
     
     // Sample texture
-    // let baseColor = textureSample(baseColorTexture, textureSampler, in.uv).rgb;
-    let baseColor = vec3f(1.0);
+    let object = uObjects[in.objectIndex];
+    let baseColor = sampleBaseColor(object.materialId, in.uv);
 
     // Combine texture and lighting
     let color = baseColor * shading;
 
-    // Gamma-correction
-    let corrected_color = pow(color, vec3f(2.2));
-    return vec4f(corrected_color, uMyUniforms.color.a);
+    // The base color was decoded to linear by the sampler, encode the result
+    // for the target
+    var corrected_color = color;
+    if (!srgbTarget) {
+        corrected_color = pow(color, vec3f(1.0 / 2.2));
+    }
+    return vec4f(corrected_color, object.color.a);
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+/**
+ * Declarations shared by the shaders that sample virtual textures or render
+ * their feedback. Prepended to those shaders when loading them.
+ */
+struct VtParams {
+    virtualSize: vec2u,
+    pageSize: u32,
+    paddedPageSize: u32,
+    border: u32,
+    mipCount: u32,
+    textureId: u32,
+    physicalSize: u32,
+    feedbackScale: f32,
+    mipBias: f32,
+};
+
+@group(1) @binding(0) var<uniform> uVt: VtParams;
+@group(1) @binding(1) var vtIndirection: texture_2d_array<u32>;
+@group(1) @binding(2) var vtPhysical: texture_2d<f32>;
+@group(1) @binding(3) var vtSampler: sampler;
+
+// Mip of the virtual texture needed at this pixel. `derivativeScale`
+// compensates for render targets smaller than the framebuffer.
+fn vtMipLevel(uv: vec2f, derivativeScale: f32) -> f32 {
+    return vtMipLevelGrad(dpdx(uv), dpdy(uv), derivativeScale);
+}
+
+// Same from the screen space derivatives of `uv`, for callers outside of
+// uniform control flow
+fn vtMipLevelGrad(uvDx: vec2f, uvDy: vec2f, derivativeScale: f32) -> f32 {
+    let size = vec2f(uVt.virtualSize);
+    let rho = max(length(uvDx * size), length(uvDy * size)) * derivativeScale;
+    return clamp(log2(max(rho, 1e-8)) + uVt.mipBias, 0.0, f32(uVt.mipCount - 1u));
+}
+
+// Virtual page covering `uv` at a given mip
+fn vtPageAt(uv: vec2f, mip: u32) -> vec2u {
+    let levelSize = max(uVt.virtualSize >> vec2u(mip), vec2u(1u));
+    let pageCount = (levelSize + vec2u(uVt.pageSize - 1u)) / uVt.pageSize;
+    return min(vec2u(fract(uv) * vec2f(levelSize)) / uVt.pageSize, pageCount - 1u);
+}
+
+fn sampleVirtual(uv: vec2f) -> vec4f {
+    return sampleVirtualGrad(uv, dpdx(uv), dpdy(uv));
+}
+
+// Same from the screen space derivatives of `uv`, for callers outside of
+// uniform control flow
+fn sampleVirtualGrad(uv: vec2f, uvDx: vec2f, uvDy: vec2f) -> vec4f {
+    let mip = u32(vtMipLevelGrad(uvDx, uvDy, 1.0));
+    let entry = textureLoad(vtIndirection, vtPageAt(uv, mip), uVt.textureId, mip);
+    // The resident page may be coarser than the requested one while the
+    // latter streams in
+    let residentMip = entry.b;
+    let levelSize = max(uVt.virtualSize >> vec2u(residentMip), vec2u(1u));
+    let texel = fract(uv) * vec2f(levelSize);
+    let pageSize = f32(uVt.pageSize);
+    let inPage = texel - floor(texel / pageSize) * pageSize;
+    let physical = vec2f(entry.rg * uVt.paddedPageSize + uVt.border) + inPage;
+    return textureSampleLevel(vtPhysical, vtSampler, physical / f32(uVt.physicalSize), 0.0);
+}
@@ -0,0 +1,49 @@
+// Feedback pass of the virtual textures, loaded after virtual_texture.wgsl
+
+// Only the attributes used by the feedback pass are fetched
+struct VertexInput {
+    @location(0) position: vec3f,
+    @location(3) uv: vec2f,
+};
+
+struct VertexOutput {
+    @builtin(position) position: vec4f,
+    @location(0) uv: vec2f,
+};
+
+/**
+ * The camera uniforms and object data of the scene, as in shader.wgsl
+ */
+struct MyUniforms {
+    projectionMatrix: mat4x4f,
+    viewMatrix: mat4x4f,
+    time: f32,
+};
+
+struct ObjectData {
+    modelMatrix: mat4x4f,
+    normalMatrix: mat4x4f,
+    color: vec4f,
+    materialId: u32,
+};
+
+@group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
+@group(0) @binding(5) var<storage, read> uObjects: array<ObjectData>;
+
+@vertex
+fn vs_main(in: VertexInput, @builtin(instance_index) objectIndex: u32) -> VertexOutput {
+    let object = uObjects[objectIndex];
+    var out: VertexOutput;
+    out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * object.modelMatrix * vec4f(in.position, 1.0);
+    out.uv = in.uv;
+    return out;
+}
+
+// Write the ID of the page needed by this pixel, see
+// ZVirtualTexture::packPageId
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) u32 {
+    let mip = u32(vtMipLevel(in.uv, uVt.feedbackScale));
+    let page = vtPageAt(in.uv, mip);
+    return (uVt.textureId << 26u) | (mip << 22u) | (page.y << 11u) | page.x;
+}
@@ -25,6 +25,7 @@
  */
 
 #include "Application.hpp"
+#include "ImageWriter.hpp"
 #include "Mesh.hpp"
 #include "ResourceManager.hpp"
 #include "src/attributes/Mesh.hpp"
@@ -41,17 +42,74 @@
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 
 using namespace wgpu;
 
+static const char *presentModeName(PresentMode mode) {
+  switch (mode) {
+  case PresentMode::Fifo:
+    return "Fifo";
+  case PresentMode::FifoRelaxed:
+    return "Fifo relaxed";
+  case PresentMode::Immediate:
+    return "Immediate";
+  case PresentMode::Mailbox:
+    return "Mailbox";
+  default:
+    return "Unknown";
+  }
+}
+
+// Whether present paces the frames itself
+static bool waitsForVblank(PresentMode mode) {
+  return mode == PresentMode::Fifo || mode == PresentMode::FifoRelaxed;
+}
+
+// Albedo pages, decoded by the sampler like the packed albedo
+static ZVirtualTexture::Settings virtualTextureSettings() {
+  ZVirtualTexture::Settings settings;
+  settings.format = TextureFormat::RGBA8UnormSrgb;
+  return settings;
+}
+
+// Cook `imagePath` into `containerPath`, unless the container is newer
+static int cookIfStale(const std::filesystem::path &imagePath,
+                       const std::filesystem::path &containerPath) {
+  std::error_code error;
+  auto containerTime = std::filesystem::last_write_time(containerPath, error);
+  if (!error) {
+    auto imageTime = std::filesystem::last_write_time(imagePath, error);
+    if (!error && imageTime <= containerTime) {
+      return 0;
+    }
+  }
+  std::filesystem::create_directories(containerPath.parent_path(), error);
+  ZVirtualTexture::Settings settings = virtualTextureSettings();
+  return ZPageContainer::cook(imagePath, containerPath, settings.pageSize,
+                              settings.border, settings.format);
+}
+
 constexpr float PI = 3.14159265358979323846f;
 
+const std::filesystem::path VirtualTexturePath =
+    COOKED_DIR "/fourareen2K_albedo.pages";
+
+// Frames drawn after an invalidation, ImGui needs a second frame to settle
+// hover and focus changes
+constexpr int DirtyFrameCount = 2;
+// Longest idle wait, so that the device still processes its callbacks
+constexpr double IdleTimeoutSeconds = 0.25;
+
 namespace ImGui {
 bool DragDirection(const char *label, glm::vec4 &direction) {
   glm::vec2 angles = glm::degrees(glm::polar(glm::vec3(direction)));
@@ -64,66 +122,738 @@ bool DragDirection(const char *label, glm::vec4 &direction) {
 ///////////////////////////////////////////////////////////////////////////////
 // Public methods
 
-bool Application::onInit() {
-  if (!initWindowAndDevice())
-    return false;
-  if (!initSwapChain())
-    return false;
-  if (!initDepthBuffer())
-    return false;
-  if (!initBindGroupLayout())
+bool Application::onInit(const Options &options) {
+  m_options = options;
+  // Startup is a small dependency graph. Reading and decoding the assets
+  // only needs the CPU, so it starts first on the job system, while this
+  // thread opens the window, requests the adapter and the device, and
+  // creates the pipelines and buffers. The uploads join both at the end.
+  m_jobSystem = std::make_unique<ZJobSystem>();
+  m_tasks = std::make_unique<ZTaskExecutor>(*m_jobSystem, [this]() {
+    if (m_device) {
+      m_device.tick();
+    }
+    if (m_instance) {
+      m_instance.processEvents();
+    }
+  });
+  startAssetLoading();
+  bool initialized = initDeviceResources() && initScene();
+  // The jobs reference the application, even if the startup failed
+  waitAssetLoading();
+  if (!initialized)
     return false;
-  if (!initRenderPipeline())
+  std::cout << "Startup phases:" << std::endl;
+  m_startupTimer.report(std::cout);
+
+  if (m_options.headless) {
+    // Frames are rendered by runHeadless, on this thread
+    updateProjectionMatrix();
+    return true;
+  }
+
+  // From here on, WebGPU is only used by the render thread
+  invalidate();
+  m_renderThread = std::thread(&Application::renderLoop, this);
+  return true;
+}
+
+bool Application::initDeviceResources() {
+  initViews();
+  if (!initWindowAndDevice())
     return false;
-  // if (!initTexture())
-  //   return false;
+  m_frameCapture = std::make_unique<ZFrameCapture>(m_device, *m_jobSystem);
+  m_qualityGovernor = std::make_unique<ZQualityGovernor>(m_device, m_queue,
+                                                         *m_tasks);
+  if (m_options.headless) {
+    m_windows[0].width = m_options.width;
+    m_windows[0].height = m_options.height;
+    if (!initOffscreenTarget())
+      return false;
+  } else {
+    for (Window &rWindow : m_windows) {
+      int width, height;
+      glfwGetFramebufferSize(rWindow.pGlfwWindow, &width, &height);
+      rWindow.width = static_cast<uint32_t>(width);
+      rWindow.height = static_cast<uint32_t>(height);
+      if (!initSwapChain(rWindow))
+        return false;
+    }
+  }
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Pipelines");
+    if (!initBindGroupLayout())
+      return false;
+    // Joins the cooking of the virtual textures
+    if (!initVirtualTexture())
+      return false;
+    // Compiled by the device while this thread goes on
+    m_tasks->spawn(initRenderPipeline());
+    m_tasks->spawn(initBlitPipeline());
+  }
   // if (!initGeometry())
   //   return false;
-  if (!initUniforms())
-    return false;
-  if (!initLightingUniforms())
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Buffers");
+    if (!initBufferAllocator())
+      return false;
+    if (!initUniforms())
+      return false;
+    if (!initLightingUniforms())
+      return false;
+    if (!initObjectBuffer())
+      return false;
+  }
+  // Joins the texture decoding
+  if (!initTexture())
     return false;
   if (!initBindGroup())
     return false;
-  if (!initGui())
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Wait for pipelines");
+    // Also waits for the meshes, which initScene needs next anyway
+    m_tasks->drain();
+  }
+  std::cout << "Render pipeline: " << m_pipeline << std::endl;
+  if (!m_pipeline || !m_blitPipeline)
     return false;
+  if (!m_options.headless) {
+    ZPhaseTimer::Scope phase(m_startupTimer, "GUI");
+    if (!initGui())
+      return false;
+  }
+
+  return true;
+}
+
+void Application::startAssetLoading() {
+  // The textures are decoded in parallel by a single job, that registers
+  // them in order
+  // Albedo is authored in sRGB, the sampler decodes it and the mips are
+  // averaged in linear space
+  m_texturePacker = std::make_unique<ZTexturePacker>(
+      m_device, m_queue, TextureFormat::RGBA8UnormSrgb);
+  m_jobSystem->run(
+      [this]() {
+        ZPhaseTimer::Scope phase(m_startupTimer, "Decode textures");
+        m_materialIds = m_texturePacker->add(
+            {RESOURCE_DIR "/fourareen2K_albedo.jpg"}, *m_jobSystem);
+      },
+      &m_texturesDecoded);
+  // The albedo of the first object is streamed by the virtual texture from
+  // a container cooked into the build tree, again when the image changes
+  m_jobSystem->run(
+      [this]() {
+        ZPhaseTimer::Scope phase(m_startupTimer, "Cook virtual textures");
+        m_cookResult = cookIfStale(RESOURCE_DIR "/fourareen2K_albedo.jpg",
+                                   VirtualTexturePath);
+      },
+      &m_virtualTexturesCooked);
+
+  std::vector<std::filesystem::path> scenes = m_options.scenes;
+  if (scenes.empty()) {
+    scenes = {RESOURCE_DIR "/pyramid.obj", RESOURCE_DIR "/mammoth.obj"};
+  }
+  m_loadedScenes.resize(scenes.size());
+  for (size_t i = 0; i < scenes.size(); ++i) {
+    m_loadedScenes[i].path = scenes[i];
+    m_tasks->spawn(loadMesh(m_loadedScenes[i]));
+  }
+}
 
-  ZMesh *pMesh = new ZMesh(m_device, m_queue);
-  pMesh->init(RESOURCE_DIR "/pyramid.obj");
-  _meshes.push_back(pMesh);
+void Application::waitAssetLoading() {
+  m_jobSystem->wait(m_texturesDecoded);
+  m_jobSystem->wait(m_virtualTexturesCooked);
+  m_tasks->drain();
+}
+
+ZTask<> Application::loadMesh(LoadedScene &rScene) {
+  co_await m_tasks->resumeOnWorker();
+  ZPhaseTimer::Scope phase(m_startupTimer,
+                           "Parse " + rScene.path.filename().string());
+  rScene.result = ZMesh::parse(rScene.path, rScene.vertices);
+}
 
-  pMesh = new ZMesh(m_device, m_queue);
-  pMesh->init(RESOURCE_DIR "/mammoth.obj");
-  _meshes.push_back(pMesh);
+bool Application::initScene() {
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Wait for meshes");
+    // Only the mesh loading is spawned during startup
+    m_tasks->drain();
+  }
 
+  ZPhaseTimer::Scope phase(m_startupTimer, "Queue mesh uploads");
+  for (uint32_t i = 0; i < m_loadedScenes.size(); ++i) {
+    LoadedScene &rScene = m_loadedScenes[i];
+    if (rScene.result != 0) {
+      std::cerr << "Could not load " << rScene.path << std::endl;
+      return false;
+    }
+    ZMesh *pMesh = new ZMesh(m_device, m_queue, *m_bufferAllocator);
+    _meshes.push_back(pMesh);
+    // Geometry goes before the texture layers queued by initTexture
+    pMesh->init(std::move(rScene.vertices), m_uploadScheduler.get(), 1);
+    // The first object samples the virtual texture
+    uint32_t materialId =
+        i == 0 ? m_virtualMaterialId : ZTexturePacker::DefaultMaterial;
+    _sceneObjects.push_back(
+        {pMesh,
+         m_objectBuffer->add(mat4x4(1.0), {0.0f, 1.0f, 0.4f, 1.0f},
+                             materialId),
+         i, i == 0 ? m_virtualTextureId : -1});
+  }
+  m_loadedScenes.clear();
   return true;
 }
 
 void Application::onFrame() {
+  receiveRenderStats();
+  if (m_eventDriven && !isDirty()) {
+    // Nothing changed since the last frame, sleep until something does
+    glfwWaitEventsTimeout(IdleTimeoutSeconds);
+    receiveRenderStats();
+    if (!isDirty()) {
+      // The render thread still runs the device callbacks
+      FramePacket packet;
+      packet.kind = FramePacket::Kind::Tick;
+      m_framePackets.tryPush(std::move(packet));
+      ++m_idleWakeups;
+      return;
+    }
+  }
+
+  // Hold the frame before polling, so that it consumes the latest input
+  m_framePacer.getSettings().targetFps =
+      m_frameLimiterEnabled && !waitsForVblank(m_presentMode)
+          ? m_frameLimiterFps
+          : 0.0;
+  m_framePacer.beginFrame();
   updateLightingUniforms();
   glfwPollEvents();
 
   updateDragInertia();
 
-  // Update uniform buffer
-  m_uniforms.time = static_cast<float>(glfwGetTime());
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, time),
-                      &m_uniforms.time, sizeof(MyUniforms::time));
+  // Minimized windows are skipped, there is nothing to present to
+  std::vector<glm::uvec2> windowSizes(m_windows.size());
+  bool visible = false;
+  for (size_t i = 0; i < m_windows.size(); ++i) {
+    int width, height;
+    glfwGetFramebufferSize(m_windows[i].pGlfwWindow, &width, &height);
+    windowSizes[i] = {(uint32_t)width, (uint32_t)height};
+    visible = visible || (width > 0 && height > 0);
+  }
+  if (!visible) {
+    return;
+  }
+  if (m_resizePending) {
+    m_resizePending = false;
+    updateProjectionMatrix();
+  }
+
+  FramePacket packet;
+  packet.kind = FramePacket::Kind::Frame;
+  packet.windowSizes = std::move(windowSizes);
+  packet.presentMode = m_presentMode;
+  // Update uniform buffers
+  float time = static_cast<float>(glfwGetTime());
+  for (const std::unique_ptr<View> &pView : m_views) {
+    pView->uniforms.time = time;
+    packet.viewUniforms.push_back(pView->uniforms);
+  }
+  packet.lightingUniforms = m_lightingUniforms;
+  packet.objectChanges = std::move(m_objectChanges);
+  m_objectChanges.clear();
+  packet.hasInput = m_framePacer.takeInput(packet.inputTime);
+  packet.capture = m_captureEnabled;
+  packet.captureFormat =
+      m_captureRaw ? ZImageWriter::Format::Raw : ZImageWriter::Format::Png;
+  packet.dynamicResolution = m_dynamicResolution;
+  packet.frameBudgetMs = m_frameBudgetMs;
+
+  // The GUI of the frame, in the slot no packet in flight refers to
+  ImDrawData &guiDrawData = m_guiFrames[m_guiFrameIndex++ % GuiFrameCount];
+  updateGui(guiDrawData);
+  packet.pGuiDrawData = &guiDrawData;
+
+  // Waits while the render thread is a frame behind
+  m_framePackets.push(std::move(packet));
+
+  ++m_renderedFrames;
+  if (m_dirtyFrames > 0) {
+    --m_dirtyFrames;
+  }
+}
 
-  TextureView nextTexture = m_swapChain.getCurrentTextureView();
-  if (!nextTexture) {
-    std::cerr << "Cannot acquire next swap chain texture" << std::endl;
+int Application::runHeadless() {
+  // Everything is uploaded before the first pose, so that no frame misses
+  // part of its scene
+  while (m_uploadScheduler->hasPending()) {
+    m_uploadScheduler->beginFrame();
+    m_uploadScheduler->update();
+    m_device.tick();
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(m_options.outputDirectory, error);
+  if (error) {
+    std::cerr << "Could not create " << m_options.outputDirectory << ": "
+              << error.message() << std::endl;
+    return 1;
+  }
+
+  std::vector<CameraPose> poses = m_options.poses;
+  if (poses.empty()) {
+    poses.push_back(CameraPose{});
+  }
+
+  int result = 0;
+  for (size_t scene = 0; scene < _sceneObjects.size(); ++scene) {
+    for (size_t i = 0; i < _sceneObjects.size(); ++i) {
+      _sceneObjects[i].visible = i == scene;
+    }
+    // One object per scene file
+    std::string stem = m_options.scenes.empty()
+                           ? "scene" + std::to_string(scene)
+                           : m_options.scenes[scene].stem().string();
+    for (size_t pose = 0; pose < poses.size(); ++pose) {
+      View &rView = *m_views[0];
+      rView.cameraState.angles = {poses[pose].yaw, poses[pose].pitch};
+      rView.cameraState.zoom = poses[pose].zoom;
+      updateViewMatrix(rView);
+
+      FramePacket packet;
+      packet.kind = FramePacket::Kind::Frame;
+      packet.windowSizes = {{m_windows[0].width, m_windows[0].height}};
+      packet.viewUniforms = {rView.uniforms};
+      packet.viewUniforms[0].time = 0.0f;
+      packet.lightingUniforms = m_lightingUniforms;
+      renderFrame(packet);
+
+      std::ostringstream name;
+      name << stem << "_" << std::setw(3) << std::setfill('0') << pose
+           << ".png";
+      std::filesystem::path path = m_options.outputDirectory / name.str();
+      if (m_tasks->run(saveOffscreenTarget(path)) != 0) {
+        result = 1;
+      } else {
+        std::cout << "Saved " << path.string() << std::endl;
+      }
+    }
+  }
+  return result;
+}
+
+void Application::renderLoop() {
+  FramePacket packet;
+  while (true) {
+    m_framePackets.pop(packet);
+    if (packet.kind == FramePacket::Kind::Quit) {
+      break;
+    }
+    if (packet.kind == FramePacket::Kind::Frame) {
+      renderFrame(packet);
+    }
+    // Check for pending error and map callbacks, and resume the coroutines
+    // they complete
+    m_tasks->poll();
+    m_frameCapture->update();
+  }
+}
+
+void Application::renderFrame(const FramePacket &packet) {
+  // The previous frame was presented, the swap chains can be replaced
+  for (size_t i = 0; i < m_windows.size() && !m_options.headless; ++i) {
+    Window &rWindow = m_windows[i];
+    glm::uvec2 size = packet.windowSizes[i];
+    if (size.x == 0 || size.y == 0) {
+      continue;
+    }
+    PresentMode presentMode = packet.presentMode;
+    if (std::find(rWindow.presentModes.begin(), rWindow.presentModes.end(),
+                  presentMode) == rWindow.presentModes.end()) {
+      presentMode = PresentMode::Fifo;
+    }
+    // A window without a swap chain tries again every frame
+    if (size.x != rWindow.width || size.y != rWindow.height ||
+        presentMode != rWindow.presentMode || !rWindow.swapChain) {
+      rWindow.width = size.x;
+      rWindow.height = size.y;
+      rWindow.presentMode = presentMode;
+      terminateSwapChain(rWindow);
+      if (!initSwapChain(rWindow)) {
+        std::cerr << "Could not create the swap chain of window " << i
+                  << ", skipping it" << std::endl;
+      }
+    }
+  }
+
+  // Streams in the pages requested by the feedback read back so far
+  m_virtualTexture->update();
+
+  m_qualityGovernor->getSettings().targetMs = packet.frameBudgetMs;
+  m_qualityGovernor->setEnabled(packet.dynamicResolution);
+  const ZQualityGovernor::Quality &quality = m_qualityGovernor->getQuality();
+  // Only the members that changed are uploaded
+  for (size_t i = 0; i < m_views.size(); ++i) {
+    const MyUniforms &uniforms = packet.viewUniforms[i];
+    MyUniforms &rGpuUniforms = m_views[i]->gpuUniforms;
+    ZUniformStaging<MyUniforms> &rStaging = m_views[i]->uniformStaging;
+    if (uniforms.projectionMatrix != rGpuUniforms.projectionMatrix) {
+      rGpuUniforms.projectionMatrix = uniforms.projectionMatrix;
+      rStaging.markDirty(rGpuUniforms.projectionMatrix);
+    }
+    if (uniforms.viewMatrix != rGpuUniforms.viewMatrix) {
+      rGpuUniforms.viewMatrix = uniforms.viewMatrix;
+      rStaging.markDirty(rGpuUniforms.viewMatrix);
+    }
+    if (uniforms.time != rGpuUniforms.time) {
+      rGpuUniforms.time = uniforms.time;
+      rStaging.markDirty(rGpuUniforms.time);
+    }
+    if (quality.lodBias != rGpuUniforms.lodBias) {
+      rGpuUniforms.lodBias = quality.lodBias;
+      rStaging.markDirty(rGpuUniforms.lodBias);
+    }
+    if (quality.lightCount != rGpuUniforms.lightCount) {
+      rGpuUniforms.lightCount = quality.lightCount;
+      rStaging.markDirty(rGpuUniforms.lightCount);
+    }
+  }
+  if (std::memcmp(&packet.lightingUniforms, &m_gpuLightingUniforms,
+                  sizeof(LightingUniforms)) != 0) {
+    m_gpuLightingUniforms = packet.lightingUniforms;
+    m_lightingUniformStaging.markAllDirty();
+  }
+  for (const ObjectChange &change : packet.objectChanges) {
+    m_objectBuffer->setModelMatrix(change.objectId, change.modelMatrix);
+  }
+
+  m_uploadScheduler->beginFrame();
+
+  if (packet.capture != m_captureRequested) {
+    m_captureRequested = packet.capture;
+    if (!m_captureRequested) {
+      m_frameCapture->stop();
+    } else if (m_frameCapture->start(m_options.outputDirectory / "capture",
+                                     packet.captureFormat) == 0) {
+      std::cout << "Recording to " << m_options.outputDirectory / "capture"
+                << std::endl;
+    }
+  }
+
+  bool hasTarget = false;
+  for (size_t i = 0; i < m_windows.size(); ++i) {
+    Window &rWindow = m_windows[i];
+    if (m_options.headless) {
+      rWindow.target = m_offscreenView;
+    } else if (packet.windowSizes[i].x > 0 && packet.windowSizes[i].y > 0 &&
+               rWindow.swapChain) {
+      rWindow.target = rWindow.swapChain.getCurrentTextureView();
+      if (!rWindow.target) {
+        std::cerr << "Cannot acquire next swap chain texture" << std::endl;
+      }
+    }
+    hasTarget = hasTarget || rWindow.target;
+  }
+  if (!hasTarget) {
     return;
   }
 
+  // Queue writes must land before compaction moves their destination
+  m_uploadScheduler->update();
+
   CommandEncoderDescriptor commandEncoderDesc;
   commandEncoderDesc.label = "Command Encoder";
   CommandEncoder encoder = m_device.createCommandEncoder(commandEncoderDesc);
 
+  m_stagingRing->beginFrame();
+  m_bufferAllocator->compact(encoder);
+
+  // The passes of the frame, with the textures they use. The scene of each
+  // view is drawn into pooled targets that may be larger than its viewport,
+  // so that resizing the window does not reallocate them every frame, then
+  // scaled to its viewport under the GUI. All the views of all the windows
+  // go into the same command buffer. Recording keeps the full resolution,
+  // so that all the frames have the same size.
+  float scale = m_frameCapture->isActive() ? 1.0f : quality.resolutionScale;
+  RenderStats stats;
+  for (const std::unique_ptr<View> &pView : m_views) {
+    View &rView = *pView;
+    const Window &rWindow = m_windows[rView.window];
+    rView.visible = rWindow.target != nullptr;
+    if (!rView.visible) {
+      continue;
+    }
+    uint32_t right = (uint32_t)std::lround(rView.right * rWindow.width);
+    rView.x = (uint32_t)std::lround(rView.left * rWindow.width);
+    rView.width = std::max(1u, right - std::min(right, rView.x));
+    rView.height = rWindow.height;
+    rView.sceneWidth =
+        std::max(1u, (uint32_t)std::lround(rView.width * scale));
+    rView.sceneHeight =
+        std::max(1u, (uint32_t)std::lround(rView.height * scale));
+    rView.sceneColor = m_frameGraph.createTexture(
+        "Scene color",
+        {rView.sceneWidth, rView.sceneHeight, m_swapChainFormat,
+         WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding |
+             WGPUTextureUsage_CopySrc});
+    ZFrameGraph::Resource depth = m_frameGraph.createTexture(
+        "Depth", {rView.sceneWidth, rView.sceneHeight, m_depthTextureFormat,
+                  WGPUTextureUsage_RenderAttachment});
+
+    ZFrameGraph::Pass scenePass = m_frameGraph.addPass(
+        "Scene", [this, &rView, depth, &stats](CommandEncoder &rEncoder) {
+          encodeScenePass(rEncoder, rView,
+                          m_frameGraph.getTextureView(rView.sceneColor),
+                          m_frameGraph.getTextureView(depth), stats);
+        });
+    m_frameGraph.write(scenePass, rView.sceneColor);
+    m_frameGraph.write(scenePass, depth);
+  }
+
+  // The pages needed by the first view, read back a few frames later
+  const View &rMainView = *m_views[0];
+  if (rMainView.visible) {
+    glm::uvec2 feedbackSize = {rMainView.width, rMainView.height};
+    if (feedbackSize != m_feedbackSize) {
+      m_feedbackSize = feedbackSize;
+      m_virtualTexture->onResize(feedbackSize.x, feedbackSize.y);
+    }
+    m_feedbackDraws.clear();
+    for (const SceneObject &object : _sceneObjects) {
+      if (object.virtualTexture >= 0 && object.visible &&
+          object.pMesh->isUploaded()) {
+        m_feedbackDraws.push_back(
+            {(uint32_t)object.virtualTexture, object.pMesh, object.objectId});
+      }
+    }
+    ZFrameGraph::Pass feedbackPass = m_frameGraph.addPass(
+        "Virtual texture feedback",
+        [this, &rMainView](CommandEncoder &rEncoder) {
+          m_virtualTexture->recordFeedback(rEncoder, rMainView.bindGroup,
+                                           m_feedbackDraws);
+        });
+    m_frameGraph.setSideEffect(feedbackPass);
+  }
+
+  for (size_t i = 0; i < m_windows.size(); ++i) {
+    const Window &rWindow = m_windows[i];
+    if (!rWindow.target) {
+      continue;
+    }
+    ZFrameGraph::Resource backbuffer = m_frameGraph.importTexture(
+        m_options.headless ? "Offscreen target" : "Swap chain",
+        rWindow.target);
+    ZFrameGraph::Pass presentPass = m_frameGraph.addPass(
+        "Present", [this, i, backbuffer, &packet](CommandEncoder &rEncoder) {
+          encodePresentPass(rEncoder, i,
+                            m_frameGraph.getTextureView(backbuffer), packet);
+        });
+    for (const std::unique_ptr<View> &pView : m_views) {
+      if (pView->window == i) {
+        m_frameGraph.read(presentPass, pView->sceneColor);
+      }
+    }
+    m_frameGraph.write(presentPass, backbuffer);
+
+    if (m_options.headless) {
+      // Nobody reads the buffer within the frame
+      ZFrameGraph::Pass readbackPass = m_frameGraph.addPass(
+          "Readback", [this, &rWindow](CommandEncoder &rEncoder) {
+            ImageCopyTexture source;
+            source.texture = m_offscreenTexture;
+            source.mipLevel = 0;
+            source.origin = {0, 0, 0};
+            source.aspect = TextureAspect::All;
+            ImageCopyBuffer destination;
+            destination.buffer = m_readbackBuffer;
+            destination.layout.offset = 0;
+            destination.layout.bytesPerRow = m_readbackBytesPerRow;
+            destination.layout.rowsPerImage = rWindow.height;
+            rEncoder.copyTextureToBuffer(source, destination,
+                                         {rWindow.width, rWindow.height, 1});
+          });
+      m_frameGraph.read(readbackPass, backbuffer);
+      m_frameGraph.setSideEffect(readbackPass);
+    }
+  }
+
+  if (m_frameCapture->isActive() && rMainView.visible) {
+    // The scene of the first view without the GUI, dropped when the
+    // encoders fall behind
+    ZFrameGraph::Pass capturePass =
+        m_frameGraph.addPass("Capture", [&](CommandEncoder &rEncoder) {
+          m_frameCapture->capture(
+              rEncoder, m_frameGraph.getTexture(rMainView.sceneColor),
+              rMainView.width, rMainView.height,
+              (WGPUTextureFormat)m_swapChainFormat ==
+                  WGPUTextureFormat_BGRA8Unorm);
+        });
+    m_frameGraph.read(capturePass, rMainView.sceneColor);
+    m_frameGraph.setSideEffect(capturePass);
+  }
+  m_frameGraph.compile();
+
+  // The pooled targets are known once the graph is compiled, each view
+  // scales its region of them to its viewport
+  for (const std::unique_ptr<View> &pView : m_views) {
+    View &rView = *pView;
+    if (!rView.visible) {
+      continue;
+    }
+    Texture sceneTexture = m_frameGraph.getTexture(rView.sceneColor);
+    vec4 blitUniforms = {
+        rView.sceneWidth / ((float)rView.width * sceneTexture.getWidth()),
+        rView.sceneHeight / ((float)rView.height * sceneTexture.getHeight()),
+        (float)rView.x, 0.0f};
+    if (blitUniforms != rView.blitUniforms) {
+      rView.blitUniforms = blitUniforms;
+      rView.blitUniformStaging.markAllDirty();
+    }
+  }
+
+  // Upload the uniforms changed by this frame in as few copies as possible,
+  // ahead of the passes that read them
+  for (const std::unique_ptr<View> &pView : m_views) {
+    pView->uniformStaging.flush(encoder, *m_stagingRing);
+    pView->blitUniformStaging.flush(encoder, *m_stagingRing);
+  }
+  m_lightingUniformStaging.flush(encoder, *m_stagingRing);
+  m_objectBuffer->flush(encoder, *m_stagingRing);
+
+  m_frameGraph.execute(encoder);
+  m_qualityGovernor->resolveTimestamps(encoder);
+
+  CommandBufferDescriptor cmdBufferDescriptor{};
+  cmdBufferDescriptor.label = "Command buffer";
+  CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+  encoder.release();
+  m_stagingRing->endFrame();
+  // One submit for every view of every window
+  m_queue.submit(command);
+  m_stagingRing->onSubmitted();
+  m_frameCapture->onSubmitted();
+  m_qualityGovernor->onSubmitted();
+  m_virtualTexture->onSubmitted();
+  command.release();
+
+  for (Window &rWindow : m_windows) {
+    if (rWindow.target && !m_options.headless) {
+      rWindow.target.release();
+      rWindow.swapChain.present();
+    }
+    rWindow.target = nullptr;
+  }
+
+  if (packet.hasInput) {
+    stats.latencyMs = ZFramePacer::msSince(packet.inputTime);
+  }
+  for (const std::unique_ptr<View> &pView : m_views) {
+    const ZUniformStaging<MyUniforms>::Stats &uniformStats =
+        pView->uniformStaging.getStats();
+    stats.uniforms.marks += uniformStats.marks;
+    stats.uniforms.writes += uniformStats.writes;
+  }
+  stats.lightingUniforms = m_lightingUniformStaging.getStats();
+  stats.stagingRing = m_stagingRing->getStats();
+  stats.uploads = m_uploadScheduler->getStats();
+  stats.uploadsPending = m_uploadScheduler->hasPending();
+  stats.bundleCache = m_bundleCache.getStats();
+  stats.frameGraph = m_frameGraph.getStats();
+  for (ZBufferUsage usage :
+       {ZBufferUsage::Vertex, ZBufferUsage::Uniform, ZBufferUsage::Storage}) {
+    stats.allocator[(size_t)usage] = m_bufferAllocator->getStats(usage);
+  }
+  stats.capture = m_frameCapture->getStats();
+  stats.governor = m_qualityGovernor->getStats();
+  stats.quality = m_qualityGovernor->getQuality();
+  stats.quality.resolutionScale = scale;
+  stats.virtualTexture = m_virtualTexture->getStats();
+  bool uploaded = stats.uploads.frameBytes > 0;
+  // Dropped if the main thread is that far behind, the next ones will do
+  m_renderStatsQueue.tryPush(std::move(stats));
+  if (uploaded && !m_options.headless) {
+    // Wake the main thread if it is idle, to draw what just arrived
+    glfwPostEmptyEvent();
+  }
+
+  // Objects that are no longer referenced are released a few frames later
+  m_samplerCache.endFrame();
+  m_bindGroupCache.endFrame();
+  m_bundleCache.endFrame();
+  m_bufferAllocator->endFrame();
+}
+
+void Application::onFinish() {
+  if (m_options.headless) {
+    terminateOffscreenTarget();
+  } else {
+    FramePacket packet;
+    packet.kind = FramePacket::Kind::Quit;
+    m_framePackets.push(std::move(packet));
+    m_renderThread.join();
+
+    terminateGui();
+  }
+  // Writes the frames still in flight
+  m_frameCapture.reset();
+  m_qualityGovernor.reset();
+  m_virtualTexture.reset();
+  // Runs the tasks still pending, while the device exists
+  m_tasks.reset();
+  terminateBindGroup();
+  terminateObjectBuffer();
+  terminateLightingUniforms();
+  terminateUniforms();
+  terminateBufferAllocator();
+  // terminateGeometry();
+  terminateTexture();
+  terminateBlitPipeline();
+  terminateRenderPipeline();
+  terminateBindGroupLayout();
+  for (Window &rWindow : m_windows) {
+    terminateSwapChain(rWindow);
+  }
+  m_frameGraph.clear();
+  m_bundleCache.clear();
+  m_bindGroupCache.clear();
+  m_samplerCache.clear();
+  terminateWindowAndDevice();
+  m_jobSystem.reset();
+}
+
+bool Application::isRunning() {
+  // Closing any of the windows quits
+  for (const Window &rWindow : m_windows) {
+    if (glfwWindowShouldClose(rWindow.pGlfwWindow)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Application::invalidate() {
+  m_dirtyFrames = std::max(m_dirtyFrames, DirtyFrameCount);
+}
+
+bool Application::isDirty() const {
+  // Recording needs every frame
+  return m_dirtyFrames > 0 || m_renderStats.uploadsPending ||
+         m_captureEnabled;
+}
+
+void Application::setObjectTransform(size_t sceneObject,
+                                     const mat4x4 &modelMatrix) {
+  m_objectChanges.push_back({_sceneObjects[sceneObject].objectId, modelMatrix});
+  invalidate();
+}
+
+void Application::encodeScenePass(CommandEncoder &rEncoder, const View &rView,
+                                  TextureView colorView, TextureView depthView,
+                                  RenderStats &rStats) {
   RenderPassDescriptor renderPassDesc{};
 
   RenderPassColorAttachment renderPassColorAttachment{};
-  renderPassColorAttachment.view = nextTexture;
+  renderPassColorAttachment.view = colorView;
   renderPassColorAttachment.resolveTarget = nullptr;
   renderPassColorAttachment.loadOp = LoadOp::Clear;
   renderPassColorAttachment.storeOp = StoreOp::Store;
@@ -133,7 +863,7 @@ void Application::onFrame() {
   renderPassDesc.colorAttachments = &renderPassColorAttachment;
 
   RenderPassDepthStencilAttachment depthStencilAttachment;
-  depthStencilAttachment.view = m_depthTextureView;
+  depthStencilAttachment.view = depthView;
   depthStencilAttachment.depthClearValue = 1.0f;
   depthStencilAttachment.depthLoadOp = LoadOp::Clear;
   depthStencilAttachment.depthStoreOp = StoreOp::Store;
@@ -150,123 +880,367 @@ void Application::onFrame() {
 
   renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
 
-  // renderPassDesc.timestampWriteCount = 0;
-  renderPassDesc.timestampWrites = nullptr;
-  RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-  renderPass.setPipeline(m_pipeline);
+  // Timed by the quality governor, when the device has timestamp queries
+  RenderPassTimestampWrites timestampWrites;
+  renderPassDesc.timestampWrites =
+      m_qualityGovernor->getTimestampWrites(timestampWrites)
+          ? &timestampWrites
+          : nullptr;
+  RenderPassEncoder renderPass = rEncoder.beginRenderPass(renderPassDesc);
+  // The targets may be larger than the scene
+  renderPass.setViewport(0.0f, 0.0f, (float)rView.sceneWidth,
+                         (float)rView.sceneHeight, 0.0f, 1.0f);
+  renderPass.setScissorRect(0, 0, rView.sceneWidth, rView.sceneHeight);
 
   // renderPass.setVertexBuffer(0, m_vertexBuffer, 0,
   //                            m_vertexCount *
   //                            sizeof(ZMesh::VertexAttributes));
   // renderPass.draw(m_vertexCount, 1, 0, 0);
 
-  // Set binding group
-  renderPass.setBindGroup(0, m_bindGroup, 0, nullptr);
-
-  for (ZMesh *pMesh : _meshes) {
-    pMesh->render(renderPass);
-  }
-
-  // We add the GUI drawing commands to the render pass
-  updateGui(renderPass);
+  drawScene(renderPass, rView, rStats);
 
   renderPass.end();
   renderPass.release();
+}
 
-  nextTexture.release();
+void Application::encodePresentPass(CommandEncoder &rEncoder, size_t window,
+                                    TextureView colorView,
+                                    const FramePacket &packet) {
+  RenderPassColorAttachment colorAttachment{};
+  colorAttachment.view = colorView;
+  colorAttachment.resolveTarget = nullptr;
+  colorAttachment.loadOp = LoadOp::Clear;
+  colorAttachment.storeOp = StoreOp::Store;
+  colorAttachment.clearValue = Color{0.05, 0.05, 0.05, 1.0};
+  colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
 
-  CommandBufferDescriptor cmdBufferDescriptor{};
-  cmdBufferDescriptor.label = "Command buffer";
-  CommandBuffer command = encoder.finish(cmdBufferDescriptor);
-  encoder.release();
-  m_queue.submit(command);
-  command.release();
+  RenderPassDescriptor renderPassDesc{};
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+  renderPassDesc.depthStencilAttachment = nullptr;
+  renderPassDesc.timestampWrites = nullptr;
+  RenderPassEncoder renderPass = rEncoder.beginRenderPass(renderPassDesc);
+  renderPass.setPipeline(m_blitPipeline);
+
+  for (const std::unique_ptr<View> &pView : m_views) {
+    View &rView = *pView;
+    if (rView.window != window) {
+      continue;
+    }
+    std::array<BindGroupEntry, 3> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].textureView = m_frameGraph.getTextureView(rView.sceneColor);
+    bindings[1].binding = 1;
+    bindings[1].sampler = m_blitSampler;
+    bindings[2].binding = 2;
+    bindings[2].buffer = rView.blitUniformBinding.buffer;
+    bindings[2].offset = rView.blitUniformBinding.offset;
+    bindings[2].size = sizeof(vec4);
+    BindGroupDescriptor bindGroupDesc{};
+    bindGroupDesc.layout = m_blitBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries = bindings.data();
+    // Kept by the cache while the scene target and the uniforms do not move
+    BindGroup bindGroup = m_bindGroupCache.acquire(bindGroupDesc);
+
+    renderPass.setViewport((float)rView.x, 0.0f, (float)rView.width,
+                           (float)rView.height, 0.0f, 1.0f);
+    renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+    renderPass.draw(3, 1, 0, 0);
+    m_bindGroupCache.release(bindGroup);
+  }
 
-  m_swapChain.present();
+  // The GUI built by the main thread goes on top of the first window, at
+  // full resolution
+  if (window == 0 && packet.pGuiDrawData) {
+    ImGui_ImplWGPU_RenderDrawData(
+        const_cast<ImDrawData *>(packet.pGuiDrawData), renderPass);
+  }
 
-  // Check for pending error callbacks
-  m_device.tick();
+  renderPass.end();
+  renderPass.release();
 }
 
-void Application::onFinish() {
-  terminateGui();
-  terminateBindGroup();
-  terminateUniforms();
-  // terminateGeometry();
-  // terminateTexture();
-  terminateRenderPipeline();
-  terminateBindGroupLayout();
-  terminateDepthBuffer();
-  terminateSwapChain();
-  terminateWindowAndDevice();
+void Application::drawScene(RenderPassEncoder &rRenderPass,
+                            const View &rView, RenderStats &rStats) {
+  // Sorted by state only, the draws are replayed from cached bundles and a
+  // depth order would change whenever the camera orbits. The shader reads
+  // the model matrices from the object buffer, so moving an object or the
+  // camera does not change the draws: bundles are re-recorded when objects
+  // are added, finish uploading or when their vertices move.
+  m_drawList.clear();
+  for (const SceneObject &object : _sceneObjects) {
+    if (!object.visible || !object.pMesh->isUploaded()) {
+      continue;
+    }
+    const ZObjectBuffer::ObjectData &data =
+        m_objectBuffer->get(object.objectId);
+    ZBufferAllocator::Binding binding = object.pMesh->getVertexBinding();
+    // The pipeline has a group 1 for every draw, those without a virtual
+    // texture bind the first one and do not sample it
+    uint32_t materialOffset = m_virtualTexture->getParamsOffset(
+        (uint32_t)std::max(object.virtualTexture, 0));
+    m_drawList.add(ZDrawList::Pass::Opaque, 0, data.materialId,
+                   object.meshIndex,
+                   {m_pipeline, rView.bindGroup,
+                    m_virtualTexture->getBindGroup(), materialOffset,
+                    binding.buffer, binding.offset, binding.size,
+                    object.pMesh->getVertexCount(), object.objectId});
+  }
+  m_drawList.sort();
+  const ZDrawList::Stats &drawStats = m_drawList.getStats();
+  rStats.drawList.draws += drawStats.draws;
+  rStats.drawList.stateChanges += drawStats.stateChanges;
+  rStats.drawList.stateChangesSkipped += drawStats.stateChangesSkipped;
+  rStats.drawList.sortPasses += drawStats.sortPasses;
+
+  size_t bundleCount = (m_drawList.size() + DrawsPerBundle - 1) /
+                       DrawsPerBundle;
+  m_sceneBundleKeys.resize(bundleCount);
+  for (size_t i = 0; i < bundleCount; ++i) {
+    ZRenderBundleKey &key = m_sceneBundleKeys[i];
+    key.colorFormat = m_swapChainFormat;
+    key.depthStencilFormat = m_depthTextureFormat;
+    // Same as the main pass
+    key.stencilReadOnly = true;
+    size_t begin = i * DrawsPerBundle;
+    size_t end = std::min(m_drawList.size(), begin + DrawsPerBundle);
+    key.draws.assign(m_drawList.data() + begin, m_drawList.data() + end);
+  }
+
+  rStats.bundlesRecorded += m_bundleCache.acquire(
+      m_sceneBundleKeys, m_sceneBundles,
+      m_parallelRecording ? m_jobSystem.get() : nullptr);
+  rRenderPass.executeBundles(m_sceneBundles.size(), m_sceneBundles.data());
+  // Kept by the cache while the next frames use them
+  for (RenderBundle &bundle : m_sceneBundles) {
+    m_bundleCache.release(bundle);
+  }
+  rStats.bundles += (uint32_t)m_sceneBundles.size();
 }
 
-bool Application::isRunning() { return !glfwWindowShouldClose(m_window); }
+void Application::receiveRenderStats() {
+  RenderStats stats;
+  while (m_renderStatsQueue.tryPop(stats)) {
+    if (stats.latencyMs >= 0.0) {
+      m_framePacer.addLatencySample(stats.latencyMs);
+    }
+    if (stats.uploads.frameBytes > 0) {
+      // Draw what just arrived
+      invalidate();
+    }
+    m_renderStats = stats;
+  }
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // Private methods
 
-bool Application::initWindowAndDevice() {
-  m_instance = createInstance(InstanceDescriptor{});
-  if (!m_instance) {
-    std::cerr << "Could not initialize WebGPU!" << std::endl;
-    return false;
+void Application::initViews() {
+  uint32_t windowCount =
+      m_options.headless ? 1 : std::max(1u, m_options.windowCount);
+  uint32_t viewportCount =
+      m_options.headless ? 1 : std::max(1u, m_options.viewportCount);
+  m_windows.resize(windowCount);
+  for (uint32_t window = 0; window < windowCount; ++window) {
+    for (uint32_t viewport = 0; viewport < viewportCount; ++viewport) {
+      std::unique_ptr<View> pView = std::make_unique<View>();
+      pView->window = window;
+      pView->left = viewport / (float)viewportCount;
+      pView->right = (viewport + 1) / (float)viewportCount;
+      // Spread the cameras around the scene
+      pView->cameraState.angles.x +=
+          2.0f * PI * m_views.size() / (windowCount * viewportCount);
+      m_views.push_back(std::move(pView));
+    }
   }
+}
 
+bool Application::initWindow() {
   if (!glfwInit()) {
     std::cerr << "Could not initialize GLFW!" << std::endl;
     return false;
   }
 
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-  m_window = glfwCreateWindow(640, 480, "Learn WebGPU", NULL, NULL);
-  if (!m_window) {
-    std::cerr << "Could not open window!" << std::endl;
+  int monitorCount = 0;
+  GLFWmonitor **ppMonitors = glfwGetMonitors(&monitorCount);
+  for (size_t i = 0; i < m_windows.size(); ++i) {
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    std::string title = "Learn WebGPU";
+    if (i > 0) {
+      title += " (" + std::to_string(i + 1) + ")";
+    }
+    GLFWwindow *pWindow =
+        glfwCreateWindow(640, 480, title.c_str(), NULL, NULL);
+    if (!pWindow) {
+      std::cerr << "Could not open window!" << std::endl;
+      return false;
+    }
+    m_windows[i].pGlfwWindow = pWindow;
+    m_windows[i].surface = glfwGetWGPUSurface(m_instance, pWindow);
+    if (i > 0 && (int)i < monitorCount) {
+      // The other windows go to the other monitors, when there are some
+      int x, y, width, height;
+      glfwGetMonitorWorkarea(ppMonitors[i], &x, &y, &width, &height);
+      glfwSetWindowPos(pWindow, x + 50, y + 50);
+    }
+
+    // Set the user pointer to be "this"
+    glfwSetWindowUserPointer(pWindow, this);
+    // Use a non-capturing lambda as resize callback
+    glfwSetFramebufferSizeCallback(pWindow, [](GLFWwindow *window, int, int) {
+      auto that =
+          reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
+      if (that != nullptr)
+        that->onResize();
+    });
+    glfwSetCursorPosCallback(
+        pWindow, [](GLFWwindow *window, double xpos, double ypos) {
+          auto that = reinterpret_cast<Application *>(
+              glfwGetWindowUserPointer(window));
+          if (that != nullptr)
+            that->onMouseMove(window, xpos, ypos);
+        });
+    glfwSetMouseButtonCallback(
+        pWindow, [](GLFWwindow *window, int button, int action, int mods) {
+          auto that = reinterpret_cast<Application *>(
+              glfwGetWindowUserPointer(window));
+          if (that != nullptr)
+            that->onMouseButton(window, button, action, mods);
+        });
+    // Events that only change ImGui, or what is on screen
+    glfwSetKeyCallback(pWindow, [](GLFWwindow *window, int, int, int, int) {
+      auto that =
+          reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
+      if (that != nullptr)
+        that->invalidate();
+    });
+    glfwSetCharCallback(pWindow, [](GLFWwindow *window, unsigned int) {
+      auto that =
+          reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
+      if (that != nullptr)
+        that->invalidate();
+    });
+    glfwSetWindowFocusCallback(pWindow, [](GLFWwindow *window, int) {
+      auto that =
+          reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
+      if (that != nullptr)
+        that->invalidate();
+    });
+    glfwSetWindowRefreshCallback(pWindow, [](GLFWwindow *window) {
+      auto that =
+          reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
+      if (that != nullptr)
+        that->invalidate();
+    });
+    glfwSetScrollCallback(
+        pWindow, [](GLFWwindow *window, double xoffset, double yoffset) {
+          auto that = reinterpret_cast<Application *>(
+              glfwGetWindowUserPointer(window));
+          if (that != nullptr)
+            that->onScroll(window, xoffset, yoffset);
+        });
+  }
+
+  return true;
+}
+
+bool Application::initWindowAndDevice() {
+  m_instance = createInstance(InstanceDescriptor{});
+  if (!m_instance) {
+    std::cerr << "Could not initialize WebGPU!" << std::endl;
     return false;
   }
 
+  // Without a window, there is no surface for the adapter to support
+  if (!m_options.headless) {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Window");
+    if (!initWindow())
+      return false;
+  }
+
+  ZPhaseTimer::Phase adapterPhase = m_startupTimer.begin("Adapter");
   std::cout << "Requesting adapter..." << std::endl;
-  m_surface = glfwGetWGPUSurface(m_instance, m_window);
   RequestAdapterOptions adapterOpts{};
-  adapterOpts.compatibleSurface = m_surface;
-  Adapter adapter = m_instance.requestAdapter(adapterOpts);
+  // The other windows are on the same adapter, and most likely connected to
+  // the same GPU
+  adapterOpts.compatibleSurface = m_windows[0].surface;
+  adapterOpts.forceFallbackAdapter = m_options.forceFallbackAdapter;
+  adapterOpts.backendType = m_options.backendType;
+  // The callbacks run from processEvents, on this thread. Asset decoding
+  // goes on in the job system meanwhile.
+  Adapter adapter = m_tasks->run(
+      ZGpuTasks::requestAdapter(*m_tasks, m_instance, adapterOpts));
+  m_startupTimer.end(adapterPhase);
   std::cout << "Got adapter: " << adapter << std::endl;
+  if (!adapter) {
+    std::cerr << "Could not find a matching adapter!" << std::endl;
+    return false;
+  }
 
   SupportedLimits supportedLimits;
   adapter.getLimits(&supportedLimits);
 
+  ZPhaseTimer::Phase devicePhase = m_startupTimer.begin("Device");
   std::cout << "Requesting device..." << std::endl;
   RequiredLimits requiredLimits = Default;
   requiredLimits.limits.maxVertexAttributes = 4;
   requiredLimits.limits.maxVertexBuffers = 1;
-  requiredLimits.limits.maxBufferSize =
-      150000 * sizeof(ZMesh::VertexAttributes);
+  // Enough for 150000 vertices, and for the staging buffer of a batch of
+  // texture uploads
+  requiredLimits.limits.maxBufferSize = std::max<uint64_t>(
+      150000 * sizeof(ZMesh::VertexAttributes), 64 * 1024 * 1024);
   requiredLimits.limits.maxVertexBufferArrayStride =
       sizeof(ZMesh::VertexAttributes);
   requiredLimits.limits.minStorageBufferOffsetAlignment =
       supportedLimits.limits.minStorageBufferOffsetAlignment;
   requiredLimits.limits.minUniformBufferOffsetAlignment =
       supportedLimits.limits.minUniformBufferOffsetAlignment;
-  requiredLimits.limits.maxInterStageShaderComponents = 8;
+  // Color, normal, UV and object index
+  requiredLimits.limits.maxInterStageShaderComponents = 9;
+  // Group 1 holds the virtual textures sampled by the main shader, which add
+  // one uniform buffer, two textures and a sampler
   requiredLimits.limits.maxBindGroups = 2;
-  requiredLimits.limits.maxUniformBuffersPerShaderStage = 2;
+  requiredLimits.limits.maxUniformBuffersPerShaderStage = 3;
   requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
   // Allow textures up to 2K
   requiredLimits.limits.maxTextureDimension1D = 2048;
   requiredLimits.limits.maxTextureDimension2D = 2048;
-  requiredLimits.limits.maxTextureArrayLayers = 1;
-  requiredLimits.limits.maxSampledTexturesPerShaderStage = 1;
-  requiredLimits.limits.maxSamplersPerShaderStage = 1;
+  requiredLimits.limits.maxTextureArrayLayers = 64;
+  requiredLimits.limits.maxSampledTexturesPerShaderStage = 3;
+  requiredLimits.limits.maxSamplersPerShaderStage = 2;
+  // The material table of the texture packer and the object buffer
+  requiredLimits.limits.maxStorageBuffersPerShaderStage = 2;
+  requiredLimits.limits.maxStorageBufferBindingSize =
+      std::max<uint64_t>(4096 * sizeof(ZTexturePacker::MaterialEntry),
+                         1024 * sizeof(ZObjectBuffer::ObjectData));
+
+  std::vector<WGPUFeatureName> requiredFeatures;
+  if (adapter.hasFeature(FeatureName::ImplicitDeviceSynchronization)) {
+    requiredFeatures.push_back(FeatureName::ImplicitDeviceSynchronization);
+  }
+  // Lets the quality governor time the scene passes on the GPU
+  if (adapter.hasFeature(FeatureName::TimestampQuery)) {
+    requiredFeatures.push_back(FeatureName::TimestampQuery);
+  }
 
   DeviceDescriptor deviceDesc;
   deviceDesc.label = "My Device";
-  deviceDesc.requiredFeatureCount = 0;
+  deviceDesc.requiredFeatureCount = requiredFeatures.size();
+  deviceDesc.requiredFeatures = requiredFeatures.data();
   deviceDesc.requiredLimits = &requiredLimits;
   deviceDesc.defaultQueue.label = "The default queue";
-  m_device = adapter.requestDevice(deviceDesc);
+  m_device =
+      m_tasks->run(ZGpuTasks::requestDevice(*m_tasks, adapter, deviceDesc));
+  m_startupTimer.end(devicePhase);
   std::cout << "Got device: " << m_device << std::endl;
+  if (!m_device) {
+    adapter.release();
+    return false;
+  }
+  m_parallelRecording =
+      m_device.hasFeature(FeatureName::ImplicitDeviceSynchronization);
 
   // Add an error callback for more debug info
   m_errorCallbackHandle = m_device.setUncapturedErrorCallback(
@@ -280,43 +1254,39 @@ bool Application::initWindowAndDevice() {
   m_queue = m_device.getQueue();
 
 #ifdef WEBGPU_BACKEND_WGPU
-  m_swapChainFormat = m_surface.getPreferredFormat(adapter);
+  m_swapChainFormat = m_windows[0].surface
+                         ? m_windows[0].surface.getPreferredFormat(adapter)
+                         : TextureFormat::BGRA8Unorm;
 #else
   m_swapChainFormat = TextureFormat::BGRA8Unorm;
 #endif
 
-  adapter.release();
+  // Fifo is always supported, the others depend on the platform and may
+  // differ between the surfaces, e.g. on different monitors
+  m_presentModes = {PresentMode::Fifo};
+  for (Window &rWindow : m_windows) {
+    rWindow.presentModes = {PresentMode::Fifo};
+    SurfaceCapabilities capabilities;
+    if (!rWindow.surface ||
+        rWindow.surface.getCapabilities(adapter, &capabilities) !=
+            Status::Success) {
+      continue;
+    }
+    for (size_t i = 0; i < capabilities.presentModeCount; ++i) {
+      PresentMode mode = capabilities.presentModes[i];
+      if (mode == PresentMode::Fifo) {
+        continue;
+      }
+      rWindow.presentModes.push_back(mode);
+      if (std::find(m_presentModes.begin(), m_presentModes.end(), mode) ==
+          m_presentModes.end()) {
+        m_presentModes.push_back(mode);
+      }
+    }
+    capabilities.freeMembers();
+  }
 
-  // Set the user pointer to be "this"
-  glfwSetWindowUserPointer(m_window, this);
-  // Use a non-capturing lambda as resize callback
-  glfwSetFramebufferSizeCallback(m_window, [](GLFWwindow *window, int, int) {
-    auto that =
-        reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
-    if (that != nullptr)
-      that->onResize();
-  });
-  glfwSetCursorPosCallback(
-      m_window, [](GLFWwindow *window, double xpos, double ypos) {
-        auto that =
-            reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
-        if (that != nullptr)
-          that->onMouseMove(xpos, ypos);
-      });
-  glfwSetMouseButtonCallback(
-      m_window, [](GLFWwindow *window, int button, int action, int mods) {
-        auto that =
-            reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
-        if (that != nullptr)
-          that->onMouseButton(button, action, mods);
-      });
-  glfwSetScrollCallback(
-      m_window, [](GLFWwindow *window, double xoffset, double yoffset) {
-        auto that =
-            reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
-        if (that != nullptr)
-          that->onScroll(xoffset, yoffset);
-      });
+  adapter.release();
 
   return m_device != nullptr;
 }
@@ -324,76 +1294,126 @@ bool Application::initWindowAndDevice() {
 void Application::terminateWindowAndDevice() {
   m_queue.release();
   m_device.release();
-  m_surface.release();
+  for (Window &rWindow : m_windows) {
+    if (rWindow.surface) {
+      rWindow.surface.release();
+    }
+  }
   m_instance.release();
 
-  glfwDestroyWindow(m_window);
-  glfwTerminate();
+  if (!m_options.headless) {
+    for (Window &rWindow : m_windows) {
+      if (rWindow.pGlfwWindow) {
+        glfwDestroyWindow(rWindow.pGlfwWindow);
+      }
+    }
+    glfwTerminate();
+  }
 }
 
-bool Application::initSwapChain() {
-  // Get the current size of the window's framebuffer:
-  int width, height;
-  glfwGetFramebufferSize(m_window, &width, &height);
+bool Application::initOffscreenTarget() {
+  TextureDescriptor textureDesc;
+  textureDesc.label = "Offscreen target";
+  textureDesc.dimension = TextureDimension::_2D;
+  textureDesc.format = m_swapChainFormat;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.size = {m_windows[0].width, m_windows[0].height, 1};
+  textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  m_offscreenTexture = m_device.createTexture(textureDesc);
+  if (!m_offscreenTexture) {
+    std::cerr << "Could not create the offscreen target!" << std::endl;
+    return false;
+  }
+
+  TextureViewDescriptor viewDesc;
+  viewDesc.aspect = TextureAspect::All;
+  viewDesc.baseArrayLayer = 0;
+  viewDesc.arrayLayerCount = 1;
+  viewDesc.baseMipLevel = 0;
+  viewDesc.mipLevelCount = 1;
+  viewDesc.dimension = TextureViewDimension::_2D;
+  viewDesc.format = m_swapChainFormat;
+  m_offscreenView = m_offscreenTexture.createView(viewDesc);
+
+  // Texture to buffer copies need rows aligned to 256 bytes
+  m_readbackBytesPerRow = (4 * m_windows[0].width + 255) & ~255u;
+  BufferDescriptor bufferDesc;
+  bufferDesc.label = "Offscreen readback";
+  bufferDesc.size = (uint64_t)m_readbackBytesPerRow * m_windows[0].height;
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+  bufferDesc.mappedAtCreation = false;
+  m_readbackBuffer = m_device.createBuffer(bufferDesc);
+  return m_readbackBuffer != nullptr;
+}
 
+void Application::terminateOffscreenTarget() {
+  if (m_readbackBuffer) {
+    m_readbackBuffer.destroy();
+    m_readbackBuffer.release();
+  }
+  if (m_offscreenView) {
+    m_offscreenView.release();
+  }
+  if (m_offscreenTexture) {
+    m_offscreenTexture.destroy();
+    m_offscreenTexture.release();
+  }
+}
+
+ZTask<int> Application::saveOffscreenTarget(std::filesystem::path path) {
+  const Window &rWindow = m_windows[0];
+  size_t size = (size_t)m_readbackBytesPerRow * rWindow.height;
+  BufferMapAsyncStatus status = co_await ZGpuTasks::mapAsync(
+      *m_tasks, m_readbackBuffer, MapMode::Read, 0, size);
+  if (status != BufferMapAsyncStatus::Success) {
+    std::cerr << "Could not map the readback buffer" << std::endl;
+    co_return 1;
+  }
+
+  const unsigned char *pPixels = static_cast<const unsigned char *>(
+      m_readbackBuffer.getConstMappedRange(0, size));
+  bool bgra = (WGPUTextureFormat)m_swapChainFormat ==
+              WGPUTextureFormat_BGRA8Unorm;
+  // Encoded on a worker, the buffer stays mapped until it is done
+  co_await m_tasks->resumeOnWorker();
+  int result = ZImageWriter::writePng(path, pPixels, rWindow.width,
+                                      rWindow.height, m_readbackBytesPerRow,
+                                      bgra);
+  co_await m_tasks->resumeOnOwner();
+  m_readbackBuffer.unmap();
+  co_return result;
+}
+
+bool Application::initSwapChain(Window &rWindow) {
   std::cout << "Creating swapchain..." << std::endl;
   SwapChainDescriptor swapChainDesc;
-  swapChainDesc.width = static_cast<uint32_t>(width);
-  swapChainDesc.height = static_cast<uint32_t>(height);
+  swapChainDesc.width = rWindow.width;
+  swapChainDesc.height = rWindow.height;
   swapChainDesc.usage = TextureUsage::RenderAttachment;
   swapChainDesc.format = m_swapChainFormat;
-  swapChainDesc.presentMode = PresentMode::Fifo;
-  m_swapChain = m_device.createSwapChain(m_surface, swapChainDesc);
-  std::cout << "Swapchain: " << m_swapChain << std::endl;
-  return m_swapChain != nullptr;
+  swapChainDesc.presentMode = rWindow.presentMode;
+  rWindow.swapChain = m_device.createSwapChain(rWindow.surface, swapChainDesc);
+  std::cout << "Swapchain: " << rWindow.swapChain << " ("
+            << presentModeName(rWindow.presentMode) << ")" << std::endl;
+  return rWindow.swapChain != nullptr;
+}
+
+void Application::terminateSwapChain(Window &rWindow) {
+  if (rWindow.swapChain) {
+    rWindow.swapChain.release();
+  }
 }
 
-void Application::terminateSwapChain() { m_swapChain.release(); }
 
-bool Application::initDepthBuffer() {
-  // Get the current size of the window's framebuffer:
-  int width, height;
-  glfwGetFramebufferSize(m_window, &width, &height);
-
-  // Create the depth texture
-  TextureDescriptor depthTextureDesc;
-  depthTextureDesc.dimension = TextureDimension::_2D;
-  depthTextureDesc.format = m_depthTextureFormat;
-  depthTextureDesc.mipLevelCount = 1;
-  depthTextureDesc.sampleCount = 1;
-  depthTextureDesc.size = {static_cast<uint32_t>(width),
-                           static_cast<uint32_t>(height), 1};
-  depthTextureDesc.usage = TextureUsage::RenderAttachment;
-  depthTextureDesc.viewFormatCount = 1;
-  depthTextureDesc.viewFormats = (WGPUTextureFormat *)&m_depthTextureFormat;
-  m_depthTexture = m_device.createTexture(depthTextureDesc);
-  std::cout << "Depth texture: " << m_depthTexture << std::endl;
-
-  // Create the view of the depth texture manipulated by the rasterizer
-  TextureViewDescriptor depthTextureViewDesc;
-  depthTextureViewDesc.aspect = TextureAspect::DepthOnly;
-  depthTextureViewDesc.baseArrayLayer = 0;
-  depthTextureViewDesc.arrayLayerCount = 1;
-  depthTextureViewDesc.baseMipLevel = 0;
-  depthTextureViewDesc.mipLevelCount = 1;
-  depthTextureViewDesc.dimension = TextureViewDimension::_2D;
-  depthTextureViewDesc.format = m_depthTextureFormat;
-  m_depthTextureView = m_depthTexture.createView(depthTextureViewDesc);
-  std::cout << "Depth texture view: " << m_depthTextureView << std::endl;
-
-  return m_depthTextureView != nullptr;
-}
-
-void Application::terminateDepthBuffer() {
-  m_depthTextureView.release();
-  m_depthTexture.destroy();
-  m_depthTexture.release();
-}
-
-bool Application::initRenderPipeline() {
+ZTask<> Application::initRenderPipeline() {
   std::cout << "Creating shader module..." << std::endl;
-  m_shaderModule =
-      ResourceManager::loadShaderModule(RESOURCE_DIR "/shader.wgsl", m_device);
+  // The main shader samples the virtual textures
+  std::vector<ResourceManager::path> shaderPaths = {
+      RESOURCE_DIR "/virtual_texture.wgsl", RESOURCE_DIR "/shader.wgsl"};
+  m_shaderModule = ResourceManager::loadShaderModule(shaderPaths, m_device);
   std::cout << "Shader module: " << m_shaderModule << std::endl;
 
   std::cout << "Creating render pipeline..." << std::endl;
@@ -445,8 +1465,16 @@ bool Application::initRenderPipeline() {
   pipelineDesc.fragment = &fragmentState;
   fragmentState.module = m_shaderModule;
   fragmentState.entryPoint = "fs_main";
-  fragmentState.constantCount = 0;
-  fragmentState.constants = nullptr;
+  // The shader encodes its output to sRGB, unless the target does it
+  ConstantEntry srgbTarget;
+  srgbTarget.key = "srgbTarget";
+  srgbTarget.value =
+      m_swapChainFormat == TextureFormat::BGRA8UnormSrgb ||
+              m_swapChainFormat == TextureFormat::RGBA8UnormSrgb
+          ? 1.0
+          : 0.0;
+  fragmentState.constantCount = 1;
+  fragmentState.constants = &srgbTarget;
 
   BlendState blendState;
   blendState.color.srcFactor = BlendFactor::SrcAlpha;
@@ -478,16 +1506,18 @@ bool Application::initRenderPipeline() {
   pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
   // Create the pipeline layout
+  std::array<WGPUBindGroupLayout, 2> bindGroupLayouts = {
+      m_bindGroupLayout, m_virtualTexture->getBindGroupLayout()};
   PipelineLayoutDescriptor layoutDesc{};
-  layoutDesc.bindGroupLayoutCount = 1;
-  layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&m_bindGroupLayout;
+  layoutDesc.bindGroupLayoutCount = (uint32_t)bindGroupLayouts.size();
+  layoutDesc.bindGroupLayouts = bindGroupLayouts.data();
   PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
   pipelineDesc.layout = layout;
 
-  m_pipeline = m_device.createRenderPipeline(pipelineDesc);
-  std::cout << "Render pipeline: " << m_pipeline << std::endl;
-
-  return m_pipeline != nullptr;
+  // The descriptor lives in this frame until the pipeline is created
+  m_pipeline = co_await ZGpuTasks::createRenderPipelineAsync(
+      *m_tasks, m_device, pipelineDesc);
+  layout.release();
 }
 
 void Application::terminateRenderPipeline() {
@@ -495,40 +1525,168 @@ void Application::terminateRenderPipeline() {
   m_shaderModule.release();
 }
 
-// bool Application::initTexture() {
-//   // Create a sampler
-//   SamplerDescriptor samplerDesc;
-//   samplerDesc.addressModeU = AddressMode::Repeat;
-//   samplerDesc.addressModeV = AddressMode::Repeat;
-//   samplerDesc.addressModeW = AddressMode::Repeat;
-//   samplerDesc.magFilter = FilterMode::Linear;
-//   samplerDesc.minFilter = FilterMode::Linear;
-//   samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
-//   samplerDesc.lodMinClamp = 0.0f;
-//   samplerDesc.lodMaxClamp = 8.0f;
-//   samplerDesc.compare = CompareFunction::Undefined;
-//   samplerDesc.maxAnisotropy = 1;
-//   m_sampler = m_device.createSampler(samplerDesc);
-
-//   // Create a texture
-//   m_texture = ResourceManager::loadTexture(
-//       RESOURCE_DIR "/fourareen2K_albedo.jpg", m_device, &m_textureView);
-//   if (!m_texture) {
-//     std::cerr << "Could not load texture!" << std::endl;
-//     return false;
-//   }
-//   std::cout << "Texture: " << m_texture << std::endl;
-//   std::cout << "Texture view: " << m_textureView << std::endl;
+ZTask<> Application::initBlitPipeline() {
+  m_blitShaderModule =
+      ResourceManager::loadShaderModule(RESOURCE_DIR "/blit.wgsl", m_device);
 
-//   return m_textureView != nullptr;
-// }
+  // The scene, the sampler that scales it, and its scale
+  std::array<BindGroupLayoutEntry, 3> bindingLayouts;
+  for (BindGroupLayoutEntry &bindingLayout : bindingLayouts) {
+    bindingLayout = Default;
+    bindingLayout.visibility = ShaderStage::Fragment;
+  }
+  bindingLayouts[0].binding = 0;
+  bindingLayouts[0].texture.sampleType = TextureSampleType::Float;
+  bindingLayouts[0].texture.viewDimension = TextureViewDimension::_2D;
+  bindingLayouts[1].binding = 1;
+  bindingLayouts[1].sampler.type = SamplerBindingType::Filtering;
+  bindingLayouts[2].binding = 2;
+  bindingLayouts[2].buffer.type = BufferBindingType::Uniform;
+  bindingLayouts[2].buffer.minBindingSize = sizeof(vec4);
+  BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayouts.size();
+  bindGroupLayoutDesc.entries = bindingLayouts.data();
+  m_blitBindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+  SamplerDescriptor samplerDesc;
+  samplerDesc.addressModeU = AddressMode::ClampToEdge;
+  samplerDesc.addressModeV = AddressMode::ClampToEdge;
+  samplerDesc.addressModeW = AddressMode::ClampToEdge;
+  samplerDesc.magFilter = FilterMode::Linear;
+  samplerDesc.minFilter = FilterMode::Linear;
+  samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+  samplerDesc.lodMinClamp = 0.0f;
+  samplerDesc.lodMaxClamp = 1.0f;
+  samplerDesc.compare = CompareFunction::Undefined;
+  samplerDesc.maxAnisotropy = 1;
+  m_blitSampler = m_samplerCache.acquire(samplerDesc);
 
-// void Application::terminateTexture() {
-//   m_textureView.release();
-//   m_texture.destroy();
-//   m_texture.release();
-//   m_sampler.release();
-// }
+  PipelineLayoutDescriptor layoutDesc{};
+  layoutDesc.bindGroupLayoutCount = 1;
+  layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&m_blitBindGroupLayout;
+  PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
+
+  RenderPipelineDescriptor pipelineDesc;
+  pipelineDesc.layout = layout;
+  pipelineDesc.vertex.module = m_blitShaderModule;
+  pipelineDesc.vertex.entryPoint = "vs_main";
+  pipelineDesc.vertex.bufferCount = 0;
+  pipelineDesc.vertex.buffers = nullptr;
+  pipelineDesc.vertex.constantCount = 0;
+  pipelineDesc.vertex.constants = nullptr;
+
+  pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+  pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+  pipelineDesc.primitive.frontFace = FrontFace::CCW;
+  pipelineDesc.primitive.cullMode = CullMode::None;
+
+  ColorTargetState colorTarget;
+  colorTarget.format = m_swapChainFormat;
+  colorTarget.blend = nullptr;
+  colorTarget.writeMask = ColorWriteMask::All;
+
+  FragmentState fragmentState;
+  fragmentState.module = m_blitShaderModule;
+  fragmentState.entryPoint = "fs_main";
+  fragmentState.constantCount = 0;
+  fragmentState.constants = nullptr;
+  fragmentState.targetCount = 1;
+  fragmentState.targets = &colorTarget;
+  pipelineDesc.fragment = &fragmentState;
+
+  pipelineDesc.depthStencil = nullptr;
+  pipelineDesc.multisample.count = 1;
+  pipelineDesc.multisample.mask = ~0u;
+  pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+  m_blitPipeline = co_await ZGpuTasks::createRenderPipelineAsync(
+      *m_tasks, m_device, pipelineDesc);
+  layout.release();
+}
+
+void Application::terminateBlitPipeline() {
+  m_samplerCache.release(m_blitSampler);
+  m_blitPipeline.release();
+  m_blitBindGroupLayout.release();
+  m_blitShaderModule.release();
+}
+
+bool Application::initTexture() {
+  // Create a sampler. Materials are sub-rectangles of the packed layers, so
+  // the shader wraps UVs itself and the sampler must clamp.
+  SamplerDescriptor samplerDesc;
+  samplerDesc.addressModeU = AddressMode::ClampToEdge;
+  samplerDesc.addressModeV = AddressMode::ClampToEdge;
+  samplerDesc.addressModeW = AddressMode::ClampToEdge;
+  samplerDesc.magFilter = FilterMode::Linear;
+  samplerDesc.minFilter = FilterMode::Linear;
+  samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
+  samplerDesc.lodMinClamp = 0.0f;
+  samplerDesc.lodMaxClamp = 8.0f;
+  samplerDesc.compare = CompareFunction::Undefined;
+  samplerDesc.maxAnisotropy = 1;
+  m_sampler = m_samplerCache.acquire(samplerDesc);
+
+  // Pack all material textures into one texture array, once
+  // startAssetLoading decoded them
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Wait for textures");
+    m_jobSystem->wait(m_texturesDecoded);
+  }
+  for (int materialId : m_materialIds) {
+    if (materialId < 0) {
+      std::cerr << "Could not load texture!" << std::endl;
+      return false;
+    }
+  }
+  m_virtualMaterialId = m_texturePacker->addVirtual(m_virtualTextureId);
+  ZPhaseTimer::Scope phase(m_startupTimer, "Pack textures");
+  // The layers are uploaded over the first frames, those of each frame
+  // through one staging buffer and one command buffer
+  m_textureUploader = std::make_unique<ZTextureUploader>(m_device, m_queue);
+  m_uploadScheduler =
+      std::make_unique<ZUploadScheduler>(m_queue, *m_textureUploader);
+  if (m_texturePacker->build(*m_uploadScheduler, 0, m_jobSystem.get()) != 0) {
+    std::cerr << "Could not pack textures!" << std::endl;
+    return false;
+  }
+  std::cout << "Packed " << m_texturePacker->getMaterialCount()
+            << " materials into " << m_texturePacker->getLayerCount()
+            << " texture layers" << std::endl;
+
+  return m_sampler != nullptr;
+}
+
+bool Application::initVirtualTexture() {
+  {
+    ZPhaseTimer::Scope phase(m_startupTimer, "Wait for virtual textures");
+    m_jobSystem->wait(m_virtualTexturesCooked);
+  }
+  if (m_cookResult != 0) {
+    std::cerr << "Could not cook " << VirtualTexturePath << std::endl;
+    return false;
+  }
+  ZPhaseTimer::Scope phase(m_startupTimer, "Virtual texture");
+  m_virtualTexture = std::make_unique<ZVirtualTexture>(
+      m_device, m_queue, virtualTextureSettings());
+  m_virtualTextureId = m_virtualTexture->addTexture(VirtualTexturePath);
+  if (m_virtualTextureId < 0) {
+    return false;
+  }
+  // Resized to the first view by the first frame
+  const Window &rWindow = m_windows[0];
+  m_feedbackSize = {rWindow.width, rWindow.height};
+  return m_virtualTexture->init(m_bindGroupLayout, m_feedbackSize.x,
+                                m_feedbackSize.y) == 0;
+}
+
+void Application::terminateTexture() {
+  // Pending uploads point into the packer's layers
+  m_uploadScheduler.reset();
+  m_textureUploader.reset();
+  m_texturePacker.reset();
+  m_samplerCache.release(m_sampler);
+}
 
 // bool Application::initGeometry() {
 //   // Load mesh data from OBJ file
@@ -560,34 +1718,89 @@ void Application::terminateRenderPipeline() {
 // }
 
 bool Application::initUniforms() {
-  // Create uniform buffer
-  BufferDescriptor bufferDesc;
-  bufferDesc.size = sizeof(MyUniforms);
-  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-  bufferDesc.mappedAtCreation = false;
-  m_uniformBuffer = m_device.createBuffer(bufferDesc);
-
-  // Upload the initial value of the uniforms
-  m_uniforms.modelMatrix = mat4x4(1.0);
-  m_uniforms.viewMatrix =
-      glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
-  m_uniforms.projectionMatrix =
-      glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
-  m_uniforms.time = 1.0f;
-  m_uniforms.color = {0.0f, 1.0f, 0.4f, 1.0f};
-  m_queue.writeBuffer(m_uniformBuffer, 0, &m_uniforms, sizeof(MyUniforms));
+  m_stagingRing = std::make_unique<ZStagingRing>(m_device, m_queue);
+  if (m_stagingRing->init() != 0) {
+    std::cerr << "Could not create the staging ring" << std::endl;
+    return false;
+  }
 
-  updateViewMatrix();
-  return m_uniformBuffer != nullptr;
+  for (const std::unique_ptr<View> &pView : m_views) {
+    View &rView = *pView;
+    // Allocate the uniform buffer of the view
+    rView.uniformAllocation = m_bufferAllocator->allocate(
+        ZBufferUsage::Uniform, sizeof(MyUniforms),
+        [this]() { updateUniformBindings(); });
+    if (rView.uniformAllocation == ZBufferAllocator::InvalidHandle) {
+      return false;
+    }
+    rView.uniformBinding = m_bufferAllocator->get(rView.uniformAllocation);
+
+    // Upload the initial value of the uniforms
+    rView.uniforms.viewMatrix =
+        glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
+    rView.uniforms.projectionMatrix =
+        glm::perspective(45 * PI / 180, 640.0f / 480.0f, NearPlane, FarPlane);
+    rView.uniforms.time = 1.0f;
+    rView.uniforms.lodBias = 0.0f;
+    rView.uniforms.lightCount =
+        (uint32_t)m_lightingUniforms.directions.size();
+    rView.gpuUniforms = rView.uniforms;
+    rView.uniformStaging.markAllDirty();
+
+    updateViewMatrix(rView);
+
+    // Set by each frame, once the size of the scene targets is known
+    rView.blitUniformAllocation = m_bufferAllocator->allocate(
+        ZBufferUsage::Uniform, sizeof(vec4),
+        [this]() { updateUniformBindings(); });
+    if (rView.blitUniformAllocation == ZBufferAllocator::InvalidHandle) {
+      return false;
+    }
+    rView.blitUniformBinding =
+        m_bufferAllocator->get(rView.blitUniformAllocation);
+    rView.blitUniformStaging.markAllDirty();
+  }
+  // The viewports do not have the aspect ratio of their window
+  updateProjectionMatrix();
+  return true;
 }
 
 void Application::terminateUniforms() {
-  m_uniformBuffer.destroy();
-  m_uniformBuffer.release();
+  m_stagingRing.reset();
+  for (const std::unique_ptr<View> &pView : m_views) {
+    m_bufferAllocator->free(pView->uniformAllocation);
+    pView->uniformAllocation = ZBufferAllocator::InvalidHandle;
+    m_bufferAllocator->free(pView->blitUniformAllocation);
+    pView->blitUniformAllocation = ZBufferAllocator::InvalidHandle;
+  }
+}
+
+bool Application::initBufferAllocator() {
+  m_bufferAllocator = std::make_unique<ZBufferAllocator>(m_device);
+  return true;
+}
+
+void Application::terminateBufferAllocator() { m_bufferAllocator.reset(); }
+
+void Application::updateUniformBindings() {
+  for (const std::unique_ptr<View> &pView : m_views) {
+    pView->uniformBinding = m_bufferAllocator->get(pView->uniformAllocation);
+    // The blit bind groups are cached by buffer and offset, the next frame
+    // gets one for the new location
+    pView->blitUniformBinding =
+        m_bufferAllocator->get(pView->blitUniformAllocation);
+  }
+  m_lightingUniformBinding =
+      m_bufferAllocator->get(m_lightingUniformAllocation);
+  // The bind groups reference the previous location
+  if (m_views[0]->bindGroup) {
+    terminateBindGroup();
+    initBindGroup();
+  }
 }
 
 bool Application::initBindGroupLayout() {
-  std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+  std::vector<BindGroupLayoutEntry> bindingLayoutEntries(6, Default);
 
   // The uniform buffer binding that we already had
   BindGroupLayoutEntry &bindingLayout = bindingLayoutEntries[0];
@@ -596,19 +1809,6 @@ bool Application::initBindGroupLayout() {
   bindingLayout.buffer.type = BufferBindingType::Uniform;
   bindingLayout.buffer.minBindingSize = sizeof(MyUniforms);
 
-  // // The texture binding
-  // BindGroupLayoutEntry &textureBindingLayout = bindingLayoutEntries[1];
-  // textureBindingLayout.binding = 1;
-  // textureBindingLayout.visibility = ShaderStage::Fragment;
-  // textureBindingLayout.texture.sampleType = TextureSampleType::Float;
-  // textureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
-
-  // // The texture sampler binding
-  // BindGroupLayoutEntry &samplerBindingLayout = bindingLayoutEntries[2];
-  // samplerBindingLayout.binding = 2;
-  // samplerBindingLayout.visibility = ShaderStage::Fragment;
-  // samplerBindingLayout.sampler.type = SamplerBindingType::Filtering;
-
   // The lighting uniform buffer binding
   BindGroupLayoutEntry &lightingUniformLayout = bindingLayoutEntries[1];
   lightingUniformLayout.binding = 1;
@@ -616,6 +1816,35 @@ bool Application::initBindGroupLayout() {
   lightingUniformLayout.buffer.type = BufferBindingType::Uniform;
   lightingUniformLayout.buffer.minBindingSize = sizeof(LightingUniforms);
 
+  // The packed material textures binding
+  BindGroupLayoutEntry &textureBindingLayout = bindingLayoutEntries[2];
+  textureBindingLayout.binding = 2;
+  textureBindingLayout.visibility = ShaderStage::Fragment;
+  textureBindingLayout.texture.sampleType = TextureSampleType::Float;
+  textureBindingLayout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+  // The texture sampler binding
+  BindGroupLayoutEntry &samplerBindingLayout = bindingLayoutEntries[3];
+  samplerBindingLayout.binding = 3;
+  samplerBindingLayout.visibility = ShaderStage::Fragment;
+  samplerBindingLayout.sampler.type = SamplerBindingType::Filtering;
+
+  // The material table binding, giving the layer and UV rect of each material
+  BindGroupLayoutEntry &materialBindingLayout = bindingLayoutEntries[4];
+  materialBindingLayout.binding = 4;
+  materialBindingLayout.visibility = ShaderStage::Fragment;
+  materialBindingLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+  materialBindingLayout.buffer.minBindingSize =
+      sizeof(ZTexturePacker::MaterialEntry);
+
+  // The object buffer binding, holding the transform and material of each
+  // object
+  BindGroupLayoutEntry &objectBindingLayout = bindingLayoutEntries[5];
+  objectBindingLayout.binding = 5;
+  objectBindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+  objectBindingLayout.buffer.type = BufferBindingType::ReadOnlyStorage;
+  objectBindingLayout.buffer.minBindingSize = sizeof(ZObjectBuffer::ObjectData);
+
   // Create a bind group layout
   BindGroupLayoutDescriptor bindGroupLayoutDesc{};
   bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
@@ -628,79 +1857,135 @@ bool Application::initBindGroupLayout() {
 void Application::terminateBindGroupLayout() { m_bindGroupLayout.release(); }
 
 bool Application::initBindGroup() {
-  // Create a binding
-  std::vector<BindGroupEntry> bindings(2);
+  // Create a binding, the views only differ by their uniforms
+  std::vector<BindGroupEntry> bindings(6);
 
   bindings[0].binding = 0;
-  bindings[0].buffer = m_uniformBuffer;
-  bindings[0].offset = 0;
   bindings[0].size = sizeof(MyUniforms);
 
-  // bindings[1].binding = 1;
-  // bindings[1].textureView = m_textureView;
-
-  // bindings[2].binding = 2;
-  // bindings[2].sampler = m_sampler;
-
   bindings[1].binding = 1;
-  bindings[1].buffer = m_lightingUniformBuffer;
-  bindings[1].offset = 0;
+  bindings[1].buffer = m_lightingUniformBinding.buffer;
+  bindings[1].offset = m_lightingUniformBinding.offset;
   bindings[1].size = sizeof(LightingUniforms);
 
+  bindings[2].binding = 2;
+  bindings[2].textureView = m_texturePacker->getTextureView();
+
+  bindings[3].binding = 3;
+  bindings[3].sampler = m_sampler;
+
+  bindings[4].binding = 4;
+  bindings[4].buffer = m_texturePacker->getMaterialBuffer();
+  bindings[4].offset = 0;
+  bindings[4].size = m_texturePacker->getMaterialCount() *
+                     sizeof(ZTexturePacker::MaterialEntry);
+
+  bindings[5].binding = 5;
+  bindings[5].buffer = m_objectBuffer->getBuffer();
+  bindings[5].offset = 0;
+  bindings[5].size = m_objectBuffer->getBufferSize();
+
   BindGroupDescriptor bindGroupDesc;
   bindGroupDesc.layout = m_bindGroupLayout;
   bindGroupDesc.entryCount = (uint32_t)bindings.size();
   bindGroupDesc.entries = bindings.data();
-  m_bindGroup = m_device.createBindGroup(bindGroupDesc);
+  for (const std::unique_ptr<View> &pView : m_views) {
+    bindings[0].buffer = pView->uniformBinding.buffer;
+    bindings[0].offset = pView->uniformBinding.offset;
+    pView->bindGroup = m_bindGroupCache.acquire(bindGroupDesc);
+    if (!pView->bindGroup) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  return m_bindGroup != nullptr;
+bool Application::initObjectBuffer() {
+  m_objectBuffer = std::make_unique<ZObjectBuffer>(m_device);
+  return m_objectBuffer->init() == 0;
 }
 
-void Application::terminateBindGroup() { m_bindGroup.release(); }
+void Application::terminateObjectBuffer() { m_objectBuffer.reset(); }
+
+void Application::terminateBindGroup() {
+  for (const std::unique_ptr<View> &pView : m_views) {
+    if (pView->bindGroup) {
+      m_bindGroupCache.release(pView->bindGroup);
+      pView->bindGroup = nullptr;
+    }
+  }
+}
 
 void Application::updateProjectionMatrix() {
-  int width, height;
-  glfwGetFramebufferSize(m_window, &width, &height);
-  float ratio = width / (float)height;
-  m_uniforms.projectionMatrix =
-      glm::perspective(45 * PI / 180, ratio, 0.01f, 100.0f);
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, projectionMatrix),
-                      &m_uniforms.projectionMatrix,
-                      sizeof(MyUniforms::projectionMatrix));
+  for (const std::unique_ptr<View> &pView : m_views) {
+    const Window &rWindow = m_windows[pView->window];
+    int width = 0, height = 0;
+    if (rWindow.pGlfwWindow) {
+      glfwGetFramebufferSize(rWindow.pGlfwWindow, &width, &height);
+    } else {
+      width = (int)rWindow.width;
+      height = (int)rWindow.height;
+    }
+    if (width == 0 || height == 0) {
+      // Minimized, updated once the window comes back
+      continue;
+    }
+    float ratio = (pView->right - pView->left) * width / (float)height;
+    pView->uniforms.projectionMatrix =
+        glm::perspective(45 * PI / 180, ratio, NearPlane, FarPlane);
+  }
+  invalidate();
 }
 
 void Application::onResize() {
-  // Terminate in reverse order
-  terminateDepthBuffer();
-  terminateSwapChain();
-
-  // Re-init
-  initSwapChain();
-  initDepthBuffer();
+  // A resize drag fires many events per frame, the next frame handles them
+  // at once. The render thread then recreates the swap chain when the size
+  // in the frame packets changes.
+  m_resizePending = true;
+  invalidate();
+}
 
-  updateProjectionMatrix();
+void Application::updateViewMatrix(View &rView) {
+  const CameraState &cameraState = rView.cameraState;
+  float cx = cos(cameraState.angles.x);
+  float sx = sin(cameraState.angles.x);
+  float cy = cos(cameraState.angles.y);
+  float sy = sin(cameraState.angles.y);
+  vec3 position = vec3(cx * cy, sx * cy, sy) * std::exp(-cameraState.zoom);
+  rView.uniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 0, 1));
+  invalidate();
 }
 
-void Application::updateViewMatrix() {
-  float cx = cos(m_cameraState.angles.x);
-  float sx = sin(m_cameraState.angles.x);
-  float cy = cos(m_cameraState.angles.y);
-  float sy = sin(m_cameraState.angles.y);
-  vec3 position = vec3(cx * cy, sx * cy, sy) * std::exp(-m_cameraState.zoom);
-  m_uniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 0, 1));
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, viewMatrix),
-                      &m_uniforms.viewMatrix, sizeof(MyUniforms::viewMatrix));
+size_t Application::viewAt(GLFWwindow *pWindow, double xpos) const {
+  int width, height;
+  glfwGetWindowSize(pWindow, &width, &height);
+  float x = width > 0 ? (float)(xpos / width) : 0.0f;
+  // The views of a window are stored from left to right
+  size_t view = 0;
+  for (size_t i = 0; i < m_views.size(); ++i) {
+    if (m_windows[m_views[i]->window].pGlfwWindow != pWindow) {
+      continue;
+    }
+    view = i;
+    if (x < m_views[i]->right) {
+      break;
+    }
+  }
+  return view;
 }
 
-void Application::onMouseMove(double xpos, double ypos) {
-  if (m_drag.active) {
+void Application::onMouseMove(GLFWwindow *pWindow, double xpos, double ypos) {
+  m_framePacer.onInput();
+  invalidate();
+  View &rView = *m_views[m_drag.view];
+  if (m_drag.active && m_windows[rView.window].pGlfwWindow == pWindow) {
     vec2 currentMouse = vec2(-(float)xpos, (float)ypos);
     vec2 delta = (currentMouse - m_drag.startMouse) * m_drag.sensitivity;
-    m_cameraState.angles = m_drag.startCameraState.angles + delta;
+    rView.cameraState.angles = m_drag.startCameraState.angles + delta;
     // Clamp to avoid going too far when orbitting up/down
-    m_cameraState.angles.y =
-        glm::clamp(m_cameraState.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
-    updateViewMatrix();
+    rView.cameraState.angles.y = glm::clamp(rView.cameraState.angles.y,
+                                            -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
+    updateViewMatrix(rView);
 
     // Inertia
     m_drag.velocity = delta - m_drag.previousDelta;
@@ -708,23 +1993,33 @@ void Application::onMouseMove(double xpos, double ypos) {
   }
 }
 
-void Application::onMouseButton(int button, int action, int /* modifiers */) {
+void Application::onMouseButton(GLFWwindow *pWindow, int button, int action,
+                                int /* modifiers */) {
+  m_framePacer.onInput();
+  invalidate();
   ImGuiIO &io = ImGui::GetIO();
-  if (io.WantCaptureMouse) {
+  if (pWindow == m_windows[0].pGlfwWindow && io.WantCaptureMouse) {
     // Don't rotate the camera if the mouse is already captured by an ImGui
-    // interaction at this frame.
+    // interaction at this frame. The GUI is only in the first window.
     return;
   }
 
   if (button == GLFW_MOUSE_BUTTON_LEFT) {
     switch (action) {
-    case GLFW_PRESS:
-      m_drag.active = true;
+    case GLFW_PRESS: {
       double xpos, ypos;
-      glfwGetCursorPos(m_window, &xpos, &ypos);
+      glfwGetCursorPos(pWindow, &xpos, &ypos);
+      size_t view = viewAt(pWindow, xpos);
+      if (view != m_drag.view) {
+        // The previous view stops coasting
+        m_drag.view = view;
+        m_drag.velocity = {0.0f, 0.0f};
+      }
+      m_drag.active = true;
       m_drag.startMouse = vec2(-(float)xpos, (float)ypos);
-      m_drag.startCameraState = m_cameraState;
+      m_drag.startCameraState = m_views[view]->cameraState;
       break;
+    }
     case GLFW_RELEASE:
       m_drag.active = false;
       break;
@@ -732,10 +2027,17 @@ void Application::onMouseButton(int button, int action, int /* modifiers */) {
   }
 }
 
-void Application::onScroll(double /* xoffset */, double yoffset) {
-  m_cameraState.zoom += m_drag.scrollSensitivity * static_cast<float>(yoffset);
-  m_cameraState.zoom = glm::clamp(m_cameraState.zoom, -2.0f, 2.0f);
-  updateViewMatrix();
+void Application::onScroll(GLFWwindow *pWindow, double /* xoffset */,
+                           double yoffset) {
+  m_framePacer.onInput();
+  invalidate();
+  double xpos, ypos;
+  glfwGetCursorPos(pWindow, &xpos, &ypos);
+  View &rView = *m_views[viewAt(pWindow, xpos)];
+  rView.cameraState.zoom +=
+      m_drag.scrollSensitivity * static_cast<float>(yoffset);
+  rView.cameraState.zoom = glm::clamp(rView.cameraState.zoom, -2.0f, 2.0f);
+  updateViewMatrix(rView);
 }
 
 void Application::updateDragInertia() {
@@ -747,13 +2049,14 @@ void Application::updateDragInertia() {
         std::abs(m_drag.velocity.y) < eps) {
       return;
     }
-    m_cameraState.angles += m_drag.velocity;
-    m_cameraState.angles.y =
-        glm::clamp(m_cameraState.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
+    View &rView = *m_views[m_drag.view];
+    rView.cameraState.angles += m_drag.velocity;
+    rView.cameraState.angles.y = glm::clamp(rView.cameraState.angles.y,
+                                            -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
     // Dampen the velocity so that it decreases exponentially and stops
     // after a few frames.
     m_drag.velocity *= m_drag.inertia;
-    updateViewMatrix();
+    updateViewMatrix(rView);
   }
 }
 
@@ -764,19 +2067,30 @@ bool Application::initGui() {
   ImGui::GetIO();
 
   // Setup Platform/Renderer backends
-  ImGui_ImplGlfw_InitForOther(m_window, true);
-  ImGui_ImplWGPU_Init(m_device, 3, m_swapChainFormat, m_depthTextureFormat);
-  return true;
+  // On the first window, the others only show the scene
+  ImGui_ImplGlfw_InitForOther(m_windows[0].pGlfwWindow, true);
+  // Drawn in the present pass, which has no depth attachment
+  ImGui_ImplWGPU_Init(m_device, 3, m_swapChainFormat,
+                      WGPUTextureFormat_Undefined);
+  // Created now rather than lazily by the first frame, which is built on
+  // the main thread
+  return ImGui_ImplWGPU_CreateDeviceObjects();
 }
 
 void Application::terminateGui() {
+  for (ImDrawData &drawData : m_guiFrames) {
+    for (ImDrawList *pList : drawData.CmdLists) {
+      IM_DELETE(pList);
+    }
+    drawData.Clear();
+  }
   ImGui_ImplGlfw_Shutdown();
   ImGui_ImplWGPU_Shutdown();
 }
 
-void Application::updateGui(RenderPassEncoder renderPass) {
-  // Start the Dear ImGui frame
-  ImGui_ImplWGPU_NewFrame();
+void Application::updateGui(ImDrawData &rDrawData) {
+  // Start the Dear ImGui frame. The WebGPU backend has nothing to do, its
+  // device objects were created by initGui.
   ImGui_ImplGlfw_NewFrame();
   ImGui::NewFrame();
 
@@ -798,42 +2112,193 @@ void Application::updateGui(RenderPassEncoder renderPass) {
   ImGui::End();
   m_lightingUniformsChanged = changed;
 
+  ImGui::Begin("Presentation");
+  if (ImGui::BeginCombo("Present mode", presentModeName(m_presentMode))) {
+    for (PresentMode mode : m_presentModes) {
+      if (ImGui::Selectable(presentModeName(mode), mode == m_presentMode) &&
+          mode != m_presentMode) {
+        m_presentMode = mode;
+        m_framePacer.resetLatency();
+        invalidate();
+      }
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::Text("Windows: %zu, views: %zu, one submit per frame",
+              m_windows.size(), m_views.size());
+  ImGui::Checkbox("Event-driven rendering", &m_eventDriven);
+  ImGui::Text("Rendered frames: %llu, idle wakeups: %llu",
+              (unsigned long long)m_renderedFrames,
+              (unsigned long long)m_idleWakeups);
+  ImGui::BeginDisabled(waitsForVblank(m_presentMode));
+  ImGui::Checkbox("Frame limiter", &m_frameLimiterEnabled);
+  ImGui::SliderFloat("Target FPS", &m_frameLimiterFps, 30.0f, 500.0f, "%.0f");
+  ImGui::EndDisabled();
+  const ZFramePacer::Stats &pacerStats = m_framePacer.getStats();
+  ImGui::Text("Frame: %.2f ms (limiter wait %.2f ms)", pacerStats.frameMs,
+              pacerStats.waitMs);
+  ImGui::Text("Input to present: %.2f ms (average %.2f, max %.2f)",
+              pacerStats.lastLatencyMs, pacerStats.averageLatencyMs,
+              pacerStats.maxLatencyMs);
+  ImGui::Checkbox("Dynamic resolution", &m_dynamicResolution);
+  ImGui::SliderFloat("Frame budget (ms)", &m_frameBudgetMs, 4.0f, 50.0f,
+                     "%.1f");
+  const ZQualityGovernor::Stats &governorStats = m_renderStats.governor;
+  const ZQualityGovernor::Quality &quality = m_renderStats.quality;
+  ImGui::Text("GPU %s: %.2f ms (average %.2f), scale %.0f%%",
+              governorStats.gpuTimestamps ? "scene" : "frame",
+              governorStats.frameMs, governorStats.averageMs,
+              quality.resolutionScale * 100.0f);
+  ImGui::Text("Quality level %u of %u: LOD bias %.1f, %u lights",
+              governorStats.level, governorStats.levelCount, quality.lodBias,
+              quality.lightCount);
+  ImGui::Checkbox("Record frames", &m_captureEnabled);
+  ImGui::SameLine();
+  ImGui::BeginDisabled(m_captureEnabled);
+  ImGui::Checkbox("Raw", &m_captureRaw);
+  ImGui::EndDisabled();
+  const ZFrameCapture::Stats &captureStats = m_renderStats.capture;
+  ImGui::Text("Recorded: %llu written, %llu dropped, %llu failed, %u / %u "
+              "in flight",
+              (unsigned long long)captureStats.written,
+              (unsigned long long)captureStats.dropped,
+              (unsigned long long)captureStats.failed,
+              captureStats.buffersInFlight, captureStats.bufferCount);
+  ImGui::End();
+
+  // As of the last frame the render thread reported
+  ImGui::Begin("Statistics");
+  const auto &uniformStats = m_renderStats.uniforms;
+  const auto &lightingStats = m_renderStats.lightingUniforms;
+  ImGui::Text("Uniform writes: %llu issued, %llu saved",
+              (unsigned long long)uniformStats.writes,
+              (unsigned long long)uniformStats.savedWrites());
+  ImGui::Text("Lighting writes: %llu issued, %llu saved",
+              (unsigned long long)lightingStats.writes,
+              (unsigned long long)lightingStats.savedWrites());
+  const ZStagingRing::Stats &ringStats = m_renderStats.stagingRing;
+  ImGui::Text("Staging ring: %llu / %llu bytes, peak %llu",
+              (unsigned long long)ringStats.frameBytes,
+              (unsigned long long)ringStats.capacity,
+              (unsigned long long)ringStats.peakFrameBytes);
+  ImGui::Text("Staging buffers in flight: %u / %u", ringStats.buffersInFlight,
+              ringStats.bufferCount);
+  ImGui::Text("Staging stalls: %llu (%.2f ms), overflows: %llu",
+              (unsigned long long)ringStats.stalls, ringStats.stallMs,
+              (unsigned long long)ringStats.overflows);
+  const ZUploadScheduler::Stats &uploadStats = m_renderStats.uploads;
+  ImGui::Text("Uploads: %u queued (%llu KiB), %llu KiB this frame",
+              uploadStats.queueDepth,
+              (unsigned long long)uploadStats.queuedBytes / 1024,
+              (unsigned long long)uploadStats.frameBytes / 1024);
+  ImGui::Text("Upload latency: %.1f ms average, %.1f ms max",
+              uploadStats.averageLatencyMs, uploadStats.maxLatencyMs);
+  for (auto [name, usage] : {std::pair{"Vertex", ZBufferUsage::Vertex},
+                             std::pair{"Uniform", ZBufferUsage::Uniform},
+                             std::pair{"Storage", ZBufferUsage::Storage}}) {
+    const ZBufferAllocator::Stats &allocatorStats =
+        m_renderStats.allocator[(size_t)usage];
+    ImGui::Text("%s buffers: %u allocations, %llu / %llu KiB in %u pools, "
+                "%llu moves",
+                name, allocatorStats.allocationCount,
+                (unsigned long long)allocatorStats.used / 1024,
+                (unsigned long long)allocatorStats.capacity / 1024,
+                allocatorStats.poolCount,
+                (unsigned long long)allocatorStats.moves);
+  }
+  const ZDrawList::Stats &drawStats = m_renderStats.drawList;
+  ImGui::Text("Draws: %u, %u state changes (%u skipped), %u sort passes",
+              drawStats.draws, drawStats.stateChanges,
+              drawStats.stateChangesSkipped, drawStats.sortPasses);
+  ImGui::Text("Bundles: %u, %u recorded this frame%s", m_renderStats.bundles,
+              m_renderStats.bundlesRecorded,
+              m_parallelRecording ? "" : " (serially)");
+  const auto &bundleStats = m_renderStats.bundleCache;
+  ImGui::Text("Bundle cache: %zu bundles, %llu replays, %llu recordings",
+              bundleStats.objectCount, (unsigned long long)bundleStats.hits,
+              (unsigned long long)bundleStats.misses);
+  const ZFrameGraph::Stats &graphStats = m_renderStats.frameGraph;
+  ImGui::Text("Frame graph: %u passes (%u culled), %u transient textures on "
+              "%u, %u pooled",
+              graphStats.passes, graphStats.culledPasses,
+              graphStats.transientTextures, graphStats.physicalTextures,
+              graphStats.pooledTextures);
+  const ZVirtualTexture::Stats &vtStats = m_renderStats.virtualTexture;
+  ImGui::Text("Virtual texture: %u pages resident, %u requested, %u pending",
+              vtStats.residentPages, vtStats.requestedPages,
+              vtStats.pendingPages);
+  ImGui::Text("Page loads: %llu (%llu failed), %llu evictions, %.2f ms",
+              (unsigned long long)vtStats.pageLoads,
+              (unsigned long long)vtStats.failedLoads,
+              (unsigned long long)vtStats.evictions, vtStats.lastUpdateMs);
+  const ZJobSystem::Stats jobStats = m_jobSystem->getStats();
+  ImGui::Text("Jobs: %llu run, %llu stolen, %u workers",
+              (unsigned long long)jobStats.jobs,
+              (unsigned long long)jobStats.steals,
+              m_jobSystem->getWorkerCount());
+  ImGui::End();
+
+  // Keep drawing while a widget is dragged or edited
+  if (ImGui::IsAnyItemActive() || ImGui::GetIO().WantTextInput) {
+    invalidate();
+  }
+
   // Draw the UI
   ImGui::EndFrame();
   // Convert the UI defined above into low-level drawing commands
   ImGui::Render();
-  // Execute the low-level drawing commands on the WebGPU backend
-  ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+
+  // ImGui reuses its draw lists next frame, the render thread gets a copy
+  for (ImDrawList *pList : rDrawData.CmdLists) {
+    IM_DELETE(pList);
+  }
+  rDrawData.Clear();
+  const ImDrawData *pDrawData = ImGui::GetDrawData();
+  for (ImDrawList *pList : pDrawData->CmdLists) {
+    rDrawData.CmdLists.push_back(pList->CloneOutput());
+  }
+  rDrawData.Valid = true;
+  rDrawData.CmdListsCount = pDrawData->CmdListsCount;
+  rDrawData.TotalVtxCount = pDrawData->TotalVtxCount;
+  rDrawData.TotalIdxCount = pDrawData->TotalIdxCount;
+  rDrawData.DisplayPos = pDrawData->DisplayPos;
+  rDrawData.DisplaySize = pDrawData->DisplaySize;
+  rDrawData.FramebufferScale = pDrawData->FramebufferScale;
 }
 
 bool Application::initLightingUniforms() {
-  // Create uniform buffer
-  BufferDescriptor bufferDesc;
-  bufferDesc.size = sizeof(LightingUniforms);
-  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-  bufferDesc.mappedAtCreation = false;
-  m_lightingUniformBuffer = m_device.createBuffer(bufferDesc);
+  // Allocate the uniform buffer
+  m_lightingUniformAllocation = m_bufferAllocator->allocate(
+      ZBufferUsage::Uniform, sizeof(LightingUniforms),
+      [this]() { updateUniformBindings(); });
+  if (m_lightingUniformAllocation == ZBufferAllocator::InvalidHandle) {
+    return false;
+  }
+  m_lightingUniformBinding =
+      m_bufferAllocator->get(m_lightingUniformAllocation);
 
   // Initial values
   m_lightingUniforms.directions[0] = {0.5f, -0.9f, 0.1f, 0.0f};
   m_lightingUniforms.directions[1] = {0.2f, 0.4f, 0.3f, 0.0f};
   m_lightingUniforms.colors[0] = {1.0f, 0.9f, 0.6f, 1.0f};
   m_lightingUniforms.colors[1] = {0.6f, 0.9f, 1.0f, 1.0f};
+  m_gpuLightingUniforms = m_lightingUniforms;
+  m_lightingUniformStaging.markAllDirty();
 
   m_lightingUniformsChanged = true;
   updateLightingUniforms();
 
-  return m_lightingUniformBuffer != nullptr;
+  return true;
 }
 
 void Application::terminateLightingUniforms() {
-  m_lightingUniformBuffer.destroy();
-  m_lightingUniformBuffer.release();
+  m_bufferAllocator->free(m_lightingUniformAllocation);
+  m_lightingUniformAllocation = ZBufferAllocator::InvalidHandle;
 }
 
 void Application::updateLightingUniforms() {
+  // The render thread uploads them when they differ from the last frame
   if (m_lightingUniformsChanged) {
-    m_queue.writeBuffer(m_lightingUniformBuffer, 0, &m_lightingUniforms,
-                        sizeof(LightingUniforms));
+    invalidate();
   }
 }
\ No newline at end of file
@@ -27,8 +27,31 @@
 #pragma once
 
 #include "Mesh.hpp"
+#include "BufferAllocator.hpp"
+#include "DrawList.hpp"
+#include "FrameCapture.hpp"
+#include "FrameGraph.hpp"
+#include "FramePacer.hpp"
+#include "GpuTasks.hpp"
+#include "JobSystem.hpp"
+#include "ObjectBuffer.hpp"
+#include "ObjectCache.hpp"
+#include "PhaseTimer.hpp"
+#include "QualityGovernor.hpp"
+#include "SpscQueue.hpp"
+#include "Task.hpp"
+#include "StagingRing.hpp"
+#include "TexturePacker.hpp"
+#include "TextureUploader.hpp"
+#include "UniformStaging.hpp"
+#include "UploadScheduler.hpp"
+#include "VirtualTexture.hpp"
+#include <array>
+#include <filesystem>
 #include <glm/glm.hpp>
+#include <imgui.h>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <webgpu/webgpu.hpp>
 
@@ -36,9 +59,43 @@
 struct GLFWwindow;
 
 class Application {
+public:
+  // Orbit of the camera around the origin, as driven by the mouse
+  struct CameraPose {
+    float yaw = 0.8f;
+    float pitch = 0.5f;
+    float zoom = -1.2f;
+  };
+
+  struct Options {
+    // Render into an offscreen texture without opening a window, and save
+    // each scene seen from each pose to a PNG file
+    bool headless = false;
+    // Ask for the software adapter (SwiftShader with Dawn)
+    bool forceFallbackAdapter = false;
+    wgpu::BackendType backendType = wgpu::BackendType::Undefined;
+    // Size of the offscreen target
+    uint32_t width = 640;
+    uint32_t height = 480;
+    // OBJ files, the default scene when empty
+    std::vector<std::filesystem::path> scenes;
+    // The default pose when empty
+    std::vector<CameraPose> poses;
+    std::filesystem::path outputDirectory = ".";
+    // Windows opened on the same device, e.g. one per monitor, each split
+    // into side by side viewports. Every viewport has its own camera. The
+    // headless mode has a single view.
+    uint32_t windowCount = 1;
+    uint32_t viewportCount = 1;
+  };
+
 public:
   // A function called only once at the beginning. Returns false is init failed.
-  bool onInit();
+  bool onInit(const Options &options);
+
+  // Render every pose of every scene and save them, in headless mode.
+  // Returns 0 on success.
+  int runHeadless();
 
   // A function called at each frame, guaranteed never to be called before
   // `onInit`.
@@ -50,50 +107,107 @@ public:
   // A function that tells if the application is still running.
   bool isRunning();
 
+  // Request a redraw, for the event-driven mode
+  void invalidate();
+
+  // Move an object of the scene, from the next frame on
+  void setObjectTransform(size_t sceneObject, const glm::mat4x4 &modelMatrix);
+
   // A function called when the window is resized.
   void onResize();
 
 private:
+  // Start reading and decoding the assets on the job system, before the
+  // device exists
+  void startAssetLoading();
+  void waitAssetLoading();
+  struct LoadedScene;
+  // Parse the mesh of `rScene` on a worker
+  ZTask<> loadMesh(LoadedScene &rScene);
+  // Everything onInit creates on the device, in dependency order
+  bool initDeviceResources();
+  // Create the meshes of the parsed scenes and queue their uploads
+  bool initScene();
+
+  // Lay the views out in the windows, before anything is created for them
+  void initViews();
+
   bool initWindowAndDevice();
   void terminateWindowAndDevice();
-
-  bool initSwapChain();
-  void terminateSwapChain();
-
-  bool initDepthBuffer();
-  void terminateDepthBuffer();
-
-  bool initRenderPipeline();
+  // Windows, surfaces and input callbacks, skipped in headless mode
+  bool initWindow();
+
+  // Render target and readback buffer of the headless mode
+  bool initOffscreenTarget();
+  void terminateOffscreenTarget();
+  // Save the last frame copied to the readback buffer. Returns 0 on
+  // success.
+  ZTask<int> saveOffscreenTarget(std::filesystem::path path);
+
+  struct Window;
+  bool initSwapChain(Window &rWindow);
+  void terminateSwapChain(Window &rWindow);
+
+  // The pipelines are created asynchronously by tasks spawned during
+  // startup, which set m_pipeline and m_blitPipeline once the device
+  // compiled them, or leave them null on failure
+  ZTask<> initRenderPipeline();
   void terminateRenderPipeline();
 
+  // Copies the scene target to the swap chain
+  ZTask<> initBlitPipeline();
+  void terminateBlitPipeline();
+
   bool initBindGroupLayout();
   void terminateBindGroupLayout();
 
   bool initTexture();
   void terminateTexture();
 
+  // Streams the textures too large to keep resident, sampled by the main
+  // pipeline at group 1
+  bool initVirtualTexture();
+
   bool initGeometry();
   void terminateGeometry();
 
+  bool initBufferAllocator();
+  void terminateBufferAllocator();
+
   bool initUniforms();
   void terminateUniforms();
+  // Refresh the uniform bindings after the allocator moved them
+  void updateUniformBindings();
+
+  bool initObjectBuffer();
+  void terminateObjectBuffer();
 
   bool initBindGroup();
   void terminateBindGroup();
 
+  // Of every view, from the size of its window
   void updateProjectionMatrix();
 
-  // Mouse events
-  void onMouseMove(double xpos, double ypos);
-  void onMouseButton(int button, int action, int mods);
-  void onScroll(double xoffset, double yoffset);
+  // Mouse events, the view under the cursor gets them
+  void onMouseMove(GLFWwindow *pWindow, double xpos, double ypos);
+  void onMouseButton(GLFWwindow *pWindow, int button, int action, int mods);
+  void onScroll(GLFWwindow *pWindow, double xoffset, double yoffset);
+  // Index of the view of `pWindow` at `xpos`, in screen coordinates
+  size_t viewAt(GLFWwindow *pWindow, double xpos) const;
 
-  void updateViewMatrix();
+  struct View;
+  void updateViewMatrix(View &rView);
   void updateDragInertia();
 
+  // Whether the next frame differs from the last one
+  bool isDirty() const;
+
+  // Drain the stats sent back by the render thread
+  void receiveRenderStats();
+
   bool initGui();                                     // called in onInit
   void terminateGui();                                // called in onFinish
-  void updateGui(wgpu::RenderPassEncoder renderPass); // called in onFrame
+  void updateGui(ImDrawData &rDrawData);              // called in onFrame
 
   bool initLightingUniforms();      // called in onInit()
   void terminateLightingUniforms(); // called in onFinish()
@@ -110,13 +224,14 @@ private:
    * The same structure as in the shader, replicated in C++
    */
   struct MyUniforms {
-    // We add transform matrices
+    // We add transform matrices, the model matrix is per object
     mat4x4 projectionMatrix;
     mat4x4 viewMatrix;
-    mat4x4 modelMatrix;
-    vec4 color;
     float time;
-    float _pad[3];
+    // Set by the quality governor
+    float lodBias;
+    uint32_t lightCount;
+    float _pad[1];
   };
   // Have the compiler check byte alignment
   static_assert(sizeof(MyUniforms) % 16 == 0);
@@ -128,6 +243,108 @@ private:
   };
   static_assert(sizeof(LightingUniforms) % 16 == 0);
 
+  // A mesh drawn with one record of the object buffer
+  struct SceneObject {
+    ZMesh *pMesh;
+    uint32_t objectId;
+    // Index of the mesh in _meshes, to group the draws sharing its vertices
+    uint32_t meshIndex;
+    // ID in m_virtualTexture of the texture the material samples, or -1
+    int virtualTexture = -1;
+    // Headless mode draws one scene at a time
+    bool visible = true;
+  };
+
+  struct ObjectChange {
+    uint32_t objectId;
+    mat4x4 modelMatrix;
+  };
+
+  // Everything the render thread needs to draw a frame, built by the main
+  // thread
+  struct FramePacket {
+    enum class Kind {
+      Frame,
+      // Nothing to draw, only run the device callbacks
+      Tick,
+      Quit,
+    };
+    Kind kind = Kind::Tick;
+
+    // Framebuffer size of each window, 0 while minimized
+    std::vector<glm::uvec2> windowSizes;
+    wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+    // Camera of each view
+    std::vector<MyUniforms> viewUniforms;
+    LightingUniforms lightingUniforms;
+    std::vector<ObjectChange> objectChanges;
+    // Owned by the main thread, which does not reuse it while the frame is
+    // in flight
+    const ImDrawData *pGuiDrawData = nullptr;
+    // Record the scene to the capture directory
+    bool capture = false;
+    ZImageWriter::Format captureFormat = ZImageWriter::Format::Png;
+    // Scale the resolution and quality to hold a GPU frame time
+    bool dynamicResolution = false;
+    double frameBudgetMs = 16.0;
+
+    // Oldest input event the frame consumed
+    bool hasInput = false;
+    ZFramePacer::TimePoint inputTime;
+  };
+
+  // Sent back by the render thread after each frame, for the GUI
+  struct RenderStats {
+    ZUniformStaging<MyUniforms>::Stats uniforms;
+    ZUniformStaging<LightingUniforms>::Stats lightingUniforms;
+    ZStagingRing::Stats stagingRing;
+    ZUploadScheduler::Stats uploads;
+    bool uploadsPending = false;
+    std::array<ZBufferAllocator::Stats, 3> allocator;
+    ZDrawList::Stats drawList;
+    // Render bundles the draws were replayed from, and how many of them had
+    // to be recorded this frame
+    uint32_t bundles = 0;
+    uint32_t bundlesRecorded = 0;
+    ZRenderBundleCache::Stats bundleCache;
+    ZFrameGraph::Stats frameGraph;
+    ZFrameCapture::Stats capture;
+    ZQualityGovernor::Stats governor;
+    ZQualityGovernor::Quality quality;
+    ZVirtualTexture::Stats virtualTexture;
+    // Negative when the frame consumed no input
+    double latencyMs = -1.0;
+  };
+
+  // The packet in the queue, the one being drawn and the one being built
+  static constexpr size_t GuiFrameCount = 3;
+
+  // Draws per scene bundle. A change only re-records the bundle it falls in.
+  static constexpr size_t DrawsPerBundle = 256;
+
+  // Depth range of the projection
+  static constexpr float NearPlane = 0.01f;
+  static constexpr float FarPlane = 100.0f;
+
+  // Render thread
+  void renderLoop();
+  void renderFrame(const FramePacket &packet);
+  // Draw the scene objects seen from `rView` from cached render bundles.
+  // Long draw lists are split into several bundles, recorded in parallel on
+  // the job system when they change, and executed in order.
+  void drawScene(wgpu::RenderPassEncoder &rRenderPass, const View &rView,
+                 RenderStats &rStats);
+  // Draw the scene seen from `rView` into the top left region of its
+  // pooled targets
+  void encodeScenePass(wgpu::CommandEncoder &rEncoder, const View &rView,
+                       wgpu::TextureView colorView,
+                       wgpu::TextureView depthView, RenderStats &rStats);
+  // Scale the scene of each view of `window` to its viewport, then draw the
+  // GUI on top of the first window
+  void encodePresentPass(wgpu::CommandEncoder &rEncoder, size_t window,
+                         wgpu::TextureView colorView,
+                         const FramePacket &packet);
+
   struct CameraState {
     // angles.x is the rotation of the camera around the global vertical axis,
     // affected by mouse.x angles.y is the rotation of the camera around its
@@ -146,6 +363,8 @@ private:
     vec2 startMouse;
     // The camera state at the beginning of the drag action
     CameraState startCameraState;
+    // The view being dragged, then coasting
+    size_t view = 0;
 
     // Constant settings
     float sensitivity = 0.01f;
@@ -157,52 +376,219 @@ private:
     float inertia = 0.9f;
   };
 
-  // Window and Device
-  GLFWwindow *m_window = nullptr;
+  // A window and its swap chain. The main thread owns the GLFW window, the
+  // render thread the swap chain. In headless mode, the only window has
+  // neither and renders to the offscreen target.
+  struct Window {
+    GLFWwindow *pGlfwWindow = nullptr;
+    wgpu::Surface surface = nullptr;
+    wgpu::SwapChain swapChain = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+    // Present modes its surface supports, Fifo first
+    std::vector<wgpu::PresentMode> presentModes = {wgpu::PresentMode::Fifo};
+    // Acquired for the current frame, null when the window is minimized or
+    // has no swap chain
+    wgpu::TextureView target = nullptr;
+  };
+
+  // A camera and the part of a window it is shown in. Every view has its
+  // own uniforms and bind group, everything else is shared. Views are not
+  // moved once created, their uniform staging refers to their members.
+  struct View {
+    size_t window = 0;
+    // Horizontal span in the window, as fractions of its width
+    float left = 0.0f;
+    float right = 1.0f;
+
+    // Main thread
+    CameraState cameraState;
+    MyUniforms uniforms;
+
+    // Render thread
+    ZBufferAllocator::Handle uniformAllocation =
+        ZBufferAllocator::InvalidHandle;
+    ZBufferAllocator::Binding uniformBinding;
+    MyUniforms gpuUniforms;
+    ZUniformStaging<MyUniforms> uniformStaging{uniformBinding, gpuUniforms};
+    wgpu::BindGroup bindGroup = nullptr;
+    // Texture coordinates of the scene per window pixel, and the top left
+    // corner of the viewport
+    ZBufferAllocator::Handle blitUniformAllocation =
+        ZBufferAllocator::InvalidHandle;
+    ZBufferAllocator::Binding blitUniformBinding;
+    vec4 blitUniforms = {0.0f, 0.0f, 0.0f, 0.0f};
+    ZUniformStaging<vec4> blitUniformStaging{blitUniformBinding,
+                                             blitUniforms};
+
+    // Render thread, for the current frame
+    bool visible = false;
+    // Viewport in the window, in pixels
+    uint32_t x = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Region of the pooled targets the scene is drawn to
+    uint32_t sceneWidth = 0;
+    uint32_t sceneHeight = 0;
+    ZFrameGraph::Resource sceneColor = ZFrameGraph::InvalidResource;
+  };
+
+  Options m_options;
+
+  // Windows, all presented by the same device and queue
+  std::vector<Window> m_windows;
+  std::vector<std::unique_ptr<View>> m_views;
+
+  // Device
   wgpu::Instance m_instance = nullptr;
-  wgpu::Surface m_surface = nullptr;
   wgpu::Device m_device = nullptr;
   wgpu::Queue m_queue = nullptr;
   wgpu::TextureFormat m_swapChainFormat = wgpu::TextureFormat::Undefined;
+  // Dawn devices can only be used from several threads with implicit
+  // synchronization, bundles are recorded serially without it
+  bool m_parallelRecording = false;
   // Keep the error callback alive
   std::unique_ptr<wgpu::ErrorCallback> m_errorCallbackHandle;
 
-  // Swap Chain
-  wgpu::SwapChain m_swapChain = nullptr;
+  // Samplers and bind groups are shared between identical descriptors
+  ZSamplerCache m_samplerCache{m_device};
+  ZBindGroupCache m_bindGroupCache{m_device};
+  // Scene bundles, replayed while their draws do not change
+  ZRenderBundleCache m_bundleCache{m_device};
+  // Passes of each frame, and the pool of their transient textures
+  ZFrameGraph m_frameGraph{m_device};
+  ZDrawList m_drawList;
+  std::vector<ZRenderBundleKey> m_sceneBundleKeys;
+  std::vector<wgpu::RenderBundle> m_sceneBundles;
+
+  // Present modes supported by the surface of any window, Fifo first. The
+  // windows whose surface lacks the requested mode use Fifo.
+  std::vector<wgpu::PresentMode> m_presentModes;
+  // Requested from the GUI, applied by the render thread
+  wgpu::PresentMode m_presentMode = wgpu::PresentMode::Fifo;
+
+  // Frame recording. The main thread requests it, the render thread owns
+  // the capture.
+  std::unique_ptr<ZFrameCapture> m_frameCapture;
+  bool m_captureRequested = false;
+  bool m_captureEnabled = false;
+  bool m_captureRaw = false;
+
+  // Dynamic resolution, run by the render thread and set from the GUI
+  std::unique_ptr<ZQualityGovernor> m_qualityGovernor;
+  bool m_dynamicResolution = false;
+  float m_frameBudgetMs = 16.0f;
+
+  // Frame limiter, for the present modes that do not wait for vblank
+  ZFramePacer m_framePacer;
+  bool m_frameLimiterEnabled = false;
+  float m_frameLimiterFps = 144.0f;
+
+  // Headless mode renders here instead of the swap chain, then copies each
+  // frame to the readback buffer, with rows aligned to 256 bytes
+  wgpu::Texture m_offscreenTexture = nullptr;
+  wgpu::TextureView m_offscreenView = nullptr;
+  wgpu::Buffer m_readbackBuffer = nullptr;
+  uint32_t m_readbackBytesPerRow = 0;
 
   // Depth Buffer
   wgpu::TextureFormat m_depthTextureFormat = wgpu::TextureFormat::Depth24Plus;
-  wgpu::Texture m_depthTexture = nullptr;
-  wgpu::TextureView m_depthTextureView = nullptr;
 
   // Render Pipeline
   wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
   wgpu::ShaderModule m_shaderModule = nullptr;
   wgpu::RenderPipeline m_pipeline = nullptr;
 
+  // Blit to the swap chain
+  wgpu::BindGroupLayout m_blitBindGroupLayout = nullptr;
+  wgpu::Sampler m_blitSampler = nullptr;
+  wgpu::ShaderModule m_blitShaderModule = nullptr;
+  wgpu::RenderPipeline m_blitPipeline = nullptr;
+
+  // Runs asset loading in parallel. Outlives everything that submits to it.
+  std::unique_ptr<ZJobSystem> m_jobSystem;
+  // Resumes the coroutines awaiting WebGPU, polled by the thread using the
+  // device: this one during startup, then the render thread
+  std::unique_ptr<ZTaskExecutor> m_tasks;
+
   // Texture
-  // wgpu::Sampler m_sampler = nullptr;
-  // wgpu::Texture m_texture = nullptr;
-  // wgpu::TextureView m_textureView = nullptr;
+  wgpu::Sampler m_sampler = nullptr;
+  std::unique_ptr<ZTexturePacker> m_texturePacker;
+  std::unique_ptr<ZTextureUploader> m_textureUploader;
+  // Spreads texture and mesh uploads over frames
+  std::unique_ptr<ZUploadScheduler> m_uploadScheduler;
+  std::unique_ptr<ZVirtualTexture> m_virtualTexture;
+  int m_virtualTextureId = -1;
+  // Material sampling m_virtualTextureId
+  uint32_t m_virtualMaterialId = ZTexturePacker::DefaultMaterial;
+  // Size of the first view when the feedback targets were created
+  glm::uvec2 m_feedbackSize = {0, 0};
+  std::vector<ZVirtualTexture::FeedbackDraw> m_feedbackDraws;
 
   // Geometry
   // wgpu::Buffer m_vertexBuffer = nullptr;
   // int m_vertexCount = 0;
 
-  // Uniforms
-  wgpu::Buffer m_uniformBuffer = nullptr;
-  MyUniforms m_uniforms;
+  // Vertex and uniform buffers are suballocated from shared buffers
+  std::unique_ptr<ZBufferAllocator> m_bufferAllocator;
 
-  wgpu::Buffer m_lightingUniformBuffer = nullptr;
-  LightingUniforms m_lightingUniforms;
+  // Uniforms. The main thread updates the uniforms of the views and
+  // m_lightingUniforms, the render thread copies them to the gpu* mirrors
+  // of the buffers.
+  ZBufferAllocator::Handle m_lightingUniformAllocation =
+      ZBufferAllocator::InvalidHandle;
+  ZBufferAllocator::Binding m_lightingUniformBinding;
+  LightingUniforms m_lightingUniforms{};
+  LightingUniforms m_gpuLightingUniforms{};
 
-  // Bind Group
-  wgpu::BindGroup m_bindGroup = nullptr;
+  // Uniform changes are uploaded once per frame through the staging ring
+  std::unique_ptr<ZStagingRing> m_stagingRing;
+  ZUniformStaging<LightingUniforms> m_lightingUniformStaging{
+      m_lightingUniformBinding, m_gpuLightingUniforms};
+
+  // Per-object data, indexed by the instance index of each draw
+  std::unique_ptr<ZObjectBuffer> m_objectBuffer;
 
-  CameraState m_cameraState;
   DragState m_drag;
 
   bool m_lightingUniformsChanged = true;
+  // Set by the resize events, handled once by the next frame
+  bool m_resizePending = false;
+
+  // Event-driven mode: frames are only drawn while something is dirty,
+  // otherwise onFrame waits for events
+  bool m_eventDriven = false;
+  int m_dirtyFrames = 0;
+  uint64_t m_renderedFrames = 0;
+  uint64_t m_idleWakeups = 0;
+
+  // Once onInit returned, the main thread owns GLFW, input and ImGui, and
+  // the render thread everything WebGPU. With one queued packet, the main
+  // thread is at most one frame ahead.
+  std::thread m_renderThread;
+  ZSpscQueue<FramePacket, 1> m_framePackets;
+  ZSpscQueue<RenderStats, 4> m_renderStatsQueue;
+  RenderStats m_renderStats;
+  std::array<ImDrawData, GuiFrameCount> m_guiFrames;
+  uint64_t m_guiFrameIndex = 0;
+  // Object changes for the next packet
+  std::vector<ObjectChange> m_objectChanges;
+
+  // Startup, timed by phase. The assets are decoded on the job system while
+  // the device is created.
+  struct LoadedScene {
+    std::filesystem::path path;
+    std::vector<ZMesh::VertexAttributes> vertices;
+    int result = 0;
+  };
+  ZPhaseTimer m_startupTimer;
+  ZJobSystem::Counter m_texturesDecoded;
+  ZJobSystem::Counter m_virtualTexturesCooked;
+  int m_cookResult = 0;
+  std::vector<int> m_materialIds;
+  std::vector<LoadedScene> m_loadedScenes;
 
   std::vector<ZMesh *> _meshes;
+  std::vector<SceneObject> _sceneObjects;
 };
\ No newline at end of file
@@ -25,26 +25,38 @@
  */
 
 #include "ResourceManager.hpp"
+#include "TextureUploader.hpp"
 
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <iostream>
 
 using namespace wgpu;
 
 ShaderModule ResourceManager::loadShaderModule(const path &path,
                                                Device device) {
-  std::ifstream file(path);
-  if (!file.is_open()) {
-    return nullptr;
+  return loadShaderModule(std::vector<ResourceManager::path>{path}, device);
+}
+
+ShaderModule ResourceManager::loadShaderModule(const std::vector<path> &paths,
+                                               Device device) {
+  std::string shaderSource;
+  for (const path &path : paths) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      return nullptr;
+    }
+    file.seekg(0, std::ios::end);
+    size_t size = file.tellg();
+    size_t offset = shaderSource.size();
+    shaderSource.resize(offset + size + 1, '\n');
+    file.seekg(0);
+    file.read(shaderSource.data() + offset, size);
   }
-  file.seekg(0, std::ios::end);
-  size_t size = file.tellg();
-  std::string shaderSource(size, ' ');
-  file.seekg(0);
-  file.read(shaderSource.data(), size);
 
   ShaderModuleWGSLDescriptor shaderCodeDesc;
   shaderCodeDesc.chain.next = nullptr;
@@ -120,81 +132,6 @@ ShaderModule ResourceManager::loadShaderModule(const path &path,
 //   return true;
 // }
 
-// Auxiliary function for loadTexture
-static void writeMipMaps(Device device, Texture texture, Extent3D textureSize,
-                         uint32_t mipLevelCount,
-                         const unsigned char *pixelData) {
-  Queue queue = device.getQueue();
-
-  // Arguments telling which part of the texture we upload to
-  ImageCopyTexture destination;
-  destination.texture = texture;
-  destination.origin = {0, 0, 0};
-  destination.aspect = TextureAspect::All;
-
-  // Arguments telling how the C++ side pixel memory is laid out
-  TextureDataLayout source;
-  source.offset = 0;
-
-  // Create image data
-  Extent3D mipLevelSize = textureSize;
-  std::vector<unsigned char> previousLevelPixels;
-  Extent3D previousMipLevelSize;
-  for (uint32_t level = 0; level < mipLevelCount; ++level) {
-    // Pixel data for the current level
-    std::vector<unsigned char> pixels(4 * mipLevelSize.width *
-                                      mipLevelSize.height);
-    if (level == 0) {
-      // We cannot really avoid this copy since we need this
-      // in previousLevelPixels at the next iteration
-      memcpy(pixels.data(), pixelData, pixels.size());
-    } else {
-      // Create mip level data
-      for (uint32_t i = 0; i < mipLevelSize.width; ++i) {
-        for (uint32_t j = 0; j < mipLevelSize.height; ++j) {
-          unsigned char *p = &pixels[4 * (j * mipLevelSize.width + i)];
-          // Get the corresponding 4 pixels from the previous level
-          unsigned char *p00 =
-              &previousLevelPixels[4 *
-                                   ((2 * j + 0) * previousMipLevelSize.width +
-                                    (2 * i + 0))];
-          unsigned char *p01 =
-              &previousLevelPixels[4 *
-                                   ((2 * j + 0) * previousMipLevelSize.width +
-                                    (2 * i + 1))];
-          unsigned char *p10 =
-              &previousLevelPixels[4 *
-                                   ((2 * j + 1) * previousMipLevelSize.width +
-                                    (2 * i + 0))];
-          unsigned char *p11 =
-              &previousLevelPixels[4 *
-                                   ((2 * j + 1) * previousMipLevelSize.width +
-                                    (2 * i + 1))];
-          // Average
-          p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-          p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-          p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-          p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-        }
-      }
-    }
-
-    // Upload data to the GPU texture
-    destination.mipLevel = level;
-    source.bytesPerRow = 4 * mipLevelSize.width;
-    source.rowsPerImage = mipLevelSize.height;
-    queue.writeTexture(destination, pixels.data(), pixels.size(), source,
-                       mipLevelSize);
-
-    previousLevelPixels = std::move(pixels);
-    previousMipLevelSize = mipLevelSize;
-    mipLevelSize.width /= 2;
-    mipLevelSize.height /= 2;
-  }
-
-  queue.release();
-}
-
 // Equivalent of std::bit_width that is available from C++20 onward
 static uint32_t bit_width(uint32_t m) {
   if (m == 0)
@@ -207,22 +144,17 @@ static uint32_t bit_width(uint32_t m) {
   }
 }
 
-Texture ResourceManager::loadTexture(const path &path, Device device,
-                                     TextureView *pTextureView) {
-  int width, height, channels;
-  unsigned char *pixelData = stbi_load(path.string().c_str(), &width, &height,
-                                       &channels, 4 /* force 4 channels */);
-  // If data is null, loading failed.
-  if (nullptr == pixelData)
-    return nullptr;
-
-  // Use the width, height, channels and data variables here
+// Auxiliary function for loadTexture and loadPackedTexture. Takes ownership
+// of `pixelData`, which is tightly packed in `format`.
+static Texture createTexture(Device device, uint32_t width, uint32_t height,
+                             TextureFormat format, unsigned char *pixelData,
+                             void (*freePixelData)(void *),
+                             TextureView *pTextureView,
+                             ZTextureUploader *pUploader) {
   TextureDescriptor textureDesc;
   textureDesc.dimension = TextureDimension::_2D;
-  textureDesc.format =
-      TextureFormat::RGBA8Unorm; // by convention for bmp, png and jpg file. Be
-                                 // careful with other formats.
-  textureDesc.size = {(unsigned int)width, (unsigned int)height, 1};
+  textureDesc.format = format;
+  textureDesc.size = {width, height, 1};
   textureDesc.mipLevelCount =
       bit_width(std::max(textureDesc.size.width, textureDesc.size.height));
   textureDesc.sampleCount = 1;
@@ -231,11 +163,20 @@ Texture ResourceManager::loadTexture(const path &path, Device device,
   textureDesc.viewFormats = nullptr;
   Texture texture = device.createTexture(textureDesc);
 
-  // Upload data to the GPU texture
-  writeMipMaps(device, texture, textureDesc.size, textureDesc.mipLevelCount,
-               pixelData);
-
-  stbi_image_free(pixelData);
+  // Upload data to the GPU texture. Without a shared uploader, the upload is
+  // a batch of its own.
+  auto freePixels = [pixelData, freePixelData]() { freePixelData(pixelData); };
+  if (pUploader) {
+    pUploader->add(texture, 0, width, height, textureDesc.mipLevelCount,
+                   pixelData, freePixels);
+  } else {
+    Queue queue = device.getQueue();
+    ZTextureUploader uploader(device, queue);
+    uploader.add(texture, 0, width, height, textureDesc.mipLevelCount,
+                 pixelData, freePixels);
+    uploader.flush();
+    queue.release();
+  }
   // (Do not use data after this)
 
   if (pTextureView) {
@@ -251,4 +192,95 @@ Texture ResourceManager::loadTexture(const path &path, Device device,
   }
 
   return texture;
-}
\ No newline at end of file
+}
+
+Texture ResourceManager::loadTexture(const path &path, Device device,
+                                     TextureView *pTextureView,
+                                     ZTextureUploader *pUploader,
+                                     TextureKind kind) {
+  int width, height, channels;
+  if (!stbi_info(path.string().c_str(), &width, &height, &channels))
+    return nullptr;
+
+  // Keep the channel count of data maps. WebGPU has no 3 channels 8 bits
+  // format, and sRGB only exists with 4 channels.
+  TextureFormat format = TextureFormat::RGBA8Unorm;
+  int desiredChannels = 4;
+  if (kind == TextureKind::Color) {
+    format = TextureFormat::RGBA8UnormSrgb;
+  } else if (channels == 1) {
+    format = TextureFormat::R8Unorm;
+    desiredChannels = 1;
+  } else if (channels == 2) {
+    format = TextureFormat::RG8Unorm;
+    desiredChannels = 2;
+  }
+
+  unsigned char *pixelData = stbi_load(path.string().c_str(), &width, &height,
+                                       &channels, desiredChannels);
+  // If data is null, loading failed.
+  if (nullptr == pixelData)
+    return nullptr;
+
+  return createTexture(device, width, height, format, pixelData,
+                       stbi_image_free, pTextureView, pUploader);
+}
+
+Texture ResourceManager::loadPackedTexture(
+    const std::array<path, 4> &channelPaths, Device device,
+    TextureView *pTextureView, ZTextureUploader *pUploader,
+    unsigned char fillValue) {
+  // Only the channels up to the last given map are stored
+  int channelCount = 0;
+  for (int c = 0; c < 4; ++c) {
+    if (!channelPaths[c].empty())
+      channelCount = c + 1;
+  }
+  if (channelCount == 0)
+    return nullptr;
+
+  TextureFormat format = TextureFormat::RGBA8Unorm;
+  if (channelCount == 1) {
+    format = TextureFormat::R8Unorm;
+  } else if (channelCount == 2) {
+    format = TextureFormat::RG8Unorm;
+  } else {
+    channelCount = 4;
+  }
+
+  int width = 0, height = 0;
+  unsigned char *packed = nullptr;
+  for (int c = 0; c < channelCount; ++c) {
+    if (channelPaths[c].empty())
+      continue;
+
+    int mapWidth, mapHeight, mapChannels;
+    unsigned char *mapData =
+        stbi_load(channelPaths[c].string().c_str(), &mapWidth, &mapHeight,
+                  &mapChannels, 1 /* grey level of the map */);
+    if (nullptr == mapData || (packed && (mapWidth != width ||
+                                          mapHeight != height))) {
+      std::cerr << "Could not pack " << channelPaths[c]
+                << (mapData ? ": size mismatch" : "") << std::endl;
+      stbi_image_free(mapData);
+      free(packed);
+      return nullptr;
+    }
+
+    if (!packed) {
+      width = mapWidth;
+      height = mapHeight;
+      size_t packedSize = (size_t)channelCount * width * height;
+      packed = static_cast<unsigned char *>(malloc(packedSize));
+      memset(packed, fillValue, packedSize);
+    }
+    size_t texelCount = (size_t)width * height;
+    for (size_t i = 0; i < texelCount; ++i) {
+      packed[channelCount * i + c] = mapData[i];
+    }
+    stbi_image_free(mapData);
+  }
+
+  return createTexture(device, width, height, format, packed, free,
+                       pTextureView, pUploader);
+}
@@ -26,11 +26,14 @@
 
 #pragma once
 
+#include <array>
 #include <filesystem>
 #include <glm/glm.hpp>
 #include <vector>
 #include <webgpu/webgpu.hpp>
 
+class ZTextureUploader;
+
 class ResourceManager {
 public:
   // (Just aliases to make notations lighter)
@@ -38,6 +41,15 @@ public:
   using vec3 = glm::vec3;
   using vec2 = glm::vec2;
 
+  // How the texels of an image file are interpreted
+  enum class TextureKind {
+    // Colors authored in sRGB (albedo, emissive), stored as RGBA8UnormSrgb
+    Color,
+    // Linear data (roughness, metalness, AO, height...), stored as
+    // R8Unorm/RG8Unorm/RGBA8Unorm depending on the channels of the file
+    Data,
+  };
+
   /**
    * A structure that describes the data layout in the vertex buffer,
    * used by loadGeometryFromObj and used it in `sizeof` and `offsetof`
@@ -54,13 +66,32 @@ public:
   static wgpu::ShaderModule loadShaderModule(const path &path,
                                              wgpu::Device device);
 
+  // Load the concatenation of several WGSL files into a new shader module,
+  // so that shaders can share declarations
+  static wgpu::ShaderModule loadShaderModule(const std::vector<path> &paths,
+                                             wgpu::Device device);
+
   // Load an 3D mesh from a standard .obj file into a vertex data buffer
   // static bool loadGeometryFromObj(const path &path,
   // std::vector<VertexAttributes> &vertexData);
 
   // Load an image from a standard image file
   // into a new texture object NB: The texture
-  // must be destroyed after use
+  // must be destroyed after use. When an uploader is given, the pixels are
+  // only uploaded when it is flushed, together with its other textures.
   static wgpu::Texture loadTexture(const path &path, wgpu::Device device,
-                                   wgpu::TextureView *pTextureView = nullptr);
+                                   wgpu::TextureView *pTextureView = nullptr,
+                                   ZTextureUploader *pUploader = nullptr,
+                                   TextureKind kind = TextureKind::Color);
+
+  // Pack up to four single channel maps (e.g. AO, roughness, metalness) into
+  // the channels of one texture, R8Unorm/RG8Unorm for one or two channels
+  // and RGBA8Unorm otherwise. The maps must have the same size, and channels
+  // without a path are filled with `fillValue`.
+  static wgpu::Texture
+  loadPackedTexture(const std::array<path, 4> &channelPaths,
+                    wgpu::Device device,
+                    wgpu::TextureView *pTextureView = nullptr,
+                    ZTextureUploader *pUploader = nullptr,
+                    unsigned char fillValue = 255);
 };
\ No newline at end of file
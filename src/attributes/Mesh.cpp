@@ -1,23 +1,43 @@
 #include "Mesh.hpp"
+#include "UploadScheduler.hpp"
 
 #include "tiny_obj_loader.h"
 #include <iostream>
+#include <utility>
 
 using namespace wgpu;
 
-ZMesh::ZMesh(Device &rDevice, Queue &rQueue)
-    : _rDevice(rDevice), _rQueue(rQueue), _vertexData{} {}
+ZMesh::ZMesh(Device &rDevice, Queue &rQueue, ZBufferAllocator &rAllocator)
+    : _rDevice(rDevice), _rQueue(rQueue), _rAllocator(rAllocator),
+      _vertexData{} {}
 
-ZMesh::~ZMesh() { _vertexBuffer.release(); }
+ZMesh::~ZMesh() {
+  if (_vertexAllocation != ZBufferAllocator::InvalidHandle) {
+    _rAllocator.free(_vertexAllocation);
+  }
+}
 
-int ZMesh::init(const std::vector<VertexAttributes> &vertices) {
-  _vertexData = vertices;
+int ZMesh::init(std::vector<VertexAttributes> vertices,
+                ZUploadScheduler *pScheduler, int priority) {
+  _vertexData = std::move(vertices);
 
-  _createVertexBuffer();
-  return 0;
+  return _createVertexBuffer(pScheduler, priority);
+}
+
+int ZMesh::init(const std::filesystem::path &objPath,
+                ZUploadScheduler *pScheduler, int priority) {
+  if (load(objPath) != 0) {
+    return 1;
+  }
+  return upload(pScheduler, priority);
 }
 
-int ZMesh::init(const std::filesystem::path &objPath) {
+int ZMesh::load(const std::filesystem::path &objPath) {
+  return parse(objPath, _vertexData);
+}
+
+int ZMesh::parse(const std::filesystem::path &objPath,
+                 std::vector<VertexAttributes> &rVertices) {
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> materials;
@@ -42,55 +62,82 @@ int ZMesh::init(const std::filesystem::path &objPath) {
     return 1;
   }
 
-  // Filling in vertexData
-  _vertexData.clear();
+  // Filling in the vertices
+  rVertices.clear();
   for (const auto &shape : shapes) {
-    size_t offset = _vertexData.size();
-    _vertexData.resize(offset + shape.mesh.indices.size());
+    size_t offset = rVertices.size();
+    rVertices.resize(offset + shape.mesh.indices.size());
 
     for (size_t i = 0; i < shape.mesh.indices.size(); ++i) {
       const tinyobj::index_t &idx = shape.mesh.indices[i];
 
-      _vertexData[offset + i].position = {
+      rVertices[offset + i].position = {
           attrib.vertices[3 * idx.vertex_index + 0],
           -attrib.vertices[3 * idx.vertex_index + 2],
           attrib.vertices[3 * idx.vertex_index + 1]};
 
-      _vertexData[offset + i].normal = {
+      rVertices[offset + i].normal = {
           attrib.normals[3 * idx.normal_index + 0],
           -attrib.normals[3 * idx.normal_index + 2],
           attrib.normals[3 * idx.normal_index + 1]};
 
-      _vertexData[offset + i].color = {attrib.colors[3 * idx.vertex_index + 0],
-                                       attrib.colors[3 * idx.vertex_index + 1],
-                                       attrib.colors[3 * idx.vertex_index + 2]};
+      rVertices[offset + i].color = {attrib.colors[3 * idx.vertex_index + 0],
+                                     attrib.colors[3 * idx.vertex_index + 1],
+                                     attrib.colors[3 * idx.vertex_index + 2]};
 
-      _vertexData[offset + i].uv = {
+      rVertices[offset + i].uv = {
           attrib.texcoords[2 * idx.texcoord_index + 0],
           1 - attrib.texcoords[2 * idx.texcoord_index + 1]};
     }
   }
 
-  _createVertexBuffer();
   return 0;
 }
 
-int ZMesh::render(RenderPassEncoder &rRenderPassEncoder) {
-  rRenderPassEncoder.setVertexBuffer(
-      0, _vertexBuffer, 0, _vertexData.size() * sizeof(VertexAttributes));
-  rRenderPassEncoder.draw(_vertexData.size(), 1, 0, 0);
+int ZMesh::upload(ZUploadScheduler *pScheduler, int priority) {
+  return _createVertexBuffer(pScheduler, priority);
+}
+
+int ZMesh::render(RenderPassEncoder &rRenderPassEncoder,
+                  uint32_t objectIndex) {
+  if (!_uploaded) {
+    return 1;
+  }
+  // Resolved at each draw, compaction may have moved the vertices
+  ZBufferAllocator::Binding binding = _rAllocator.get(_vertexAllocation);
+  rRenderPassEncoder.setVertexBuffer(0, binding.buffer, binding.offset,
+                                     binding.size);
+  // The object index reaches the shader as its instance index
+  rRenderPassEncoder.draw(_vertexData.size(), 1, 0, objectIndex);
 
   return 0;
 }
 
-int ZMesh::_createVertexBuffer() {
-  // Create vertex buffer
-  BufferDescriptor bufferDesc;
-  bufferDesc.size = _vertexData.size() * sizeof(VertexAttributes);
-  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-  bufferDesc.mappedAtCreation = false;
-  _vertexBuffer = _rDevice.createBuffer(bufferDesc);
-  _rQueue.writeBuffer(_vertexBuffer, 0, _vertexData.data(), bufferDesc.size);
+ZBufferAllocator::Binding ZMesh::getVertexBinding() const {
+  return _rAllocator.get(_vertexAllocation);
+}
+
+int ZMesh::_createVertexBuffer(ZUploadScheduler *pScheduler, int priority) {
+  // Allocate the vertex buffer
+  if (_vertexAllocation != ZBufferAllocator::InvalidHandle) {
+    _rAllocator.free(_vertexAllocation);
+  }
+  uint64_t size = _vertexData.size() * sizeof(VertexAttributes);
+  _vertexAllocation = _rAllocator.allocate(ZBufferUsage::Vertex, size);
+  if (_vertexAllocation == ZBufferAllocator::InvalidHandle) {
+    return 1;
+  }
+  _uploaded = false;
+  if (pScheduler) {
+    pScheduler->enqueueBuffer(_rAllocator, _vertexAllocation,
+                              _vertexData.data(), size, priority,
+                              [this]() { _uploaded = true; });
+    return 0;
+  }
+  ZBufferAllocator::Binding binding = _rAllocator.get(_vertexAllocation);
+  _rQueue.writeBuffer(binding.buffer, binding.offset, _vertexData.data(),
+                      size);
+  _uploaded = true;
 
   return 0;
 }
\ No newline at end of file
@@ -5,6 +5,10 @@
 #include <vector>
 #include <webgpu/webgpu.hpp>
 
+#include "BufferAllocator.hpp"
+
+class ZUploadScheduler;
+
 class ZMesh {
 public:
   /**
@@ -20,20 +24,46 @@ public:
   };
 
 public:
-  ZMesh(wgpu::Device &rDevice, wgpu::Queue &rQueue);
+  ZMesh(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+        ZBufferAllocator &rAllocator);
   ~ZMesh();
 
-  int init(const std::vector<VertexAttributes> &vertices);
-  int init(const std::filesystem::path &path);
+  // With a scheduler, the vertices are uploaded over the next frames with
+  // `priority` and the mesh is not drawn until they are
+  int init(std::vector<VertexAttributes> vertices,
+           ZUploadScheduler *pScheduler = nullptr, int priority = 0);
+  int init(const std::filesystem::path &path,
+           ZUploadScheduler *pScheduler = nullptr, int priority = 0);
+
+  // The two halves of init: `load` only parses the file and touches no GPU
+  // object, so meshes can be loaded in parallel jobs; `upload` then creates
+  // the vertex buffer on the thread that owns the device.
+  int load(const std::filesystem::path &path);
+  int upload(ZUploadScheduler *pScheduler = nullptr, int priority = 0);
+
+  // Parse an OBJ file into `rVertices`, before any mesh or device exists
+  static int parse(const std::filesystem::path &path,
+                   std::vector<VertexAttributes> &rVertices);
+
+  // Draw the mesh with the record `objectIndex` of the object buffer
+  int render(wgpu::RenderPassEncoder &rRenderPassEncoder,
+             uint32_t objectIndex);
 
-  int render(wgpu::RenderPassEncoder &rRenderPassEncoder);
+  // Whether the vertices reached the GPU and the mesh can be drawn
+  bool isUploaded() const { return _uploaded; }
+  // Where the vertices currently are, compaction may move them
+  ZBufferAllocator::Binding getVertexBinding() const;
+  uint32_t getVertexCount() const { return (uint32_t)_vertexData.size(); }
 
 private:
- int _createVertexBuffer();
+ int _createVertexBuffer(ZUploadScheduler *pScheduler, int priority);
 
 private:
   wgpu::Device &_rDevice;
   wgpu::Queue &_rQueue;
+  ZBufferAllocator &_rAllocator;
   std::vector<VertexAttributes> _vertexData;
-  wgpu::Buffer _vertexBuffer = nullptr;
+  // Vertices are suballocated in a shared buffer, and may move
+  ZBufferAllocator::Handle _vertexAllocation = ZBufferAllocator::InvalidHandle;
+  bool _uploaded = false;
 };
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "JobSystem.hpp"
+
+#include <algorithm>
+
+// The system and deque the current thread works for, if any
+static thread_local const ZJobSystem *tpSystem = nullptr;
+static thread_local uint32_t tDeque = 0;
+
+ZJobSystem::ZJobSystem()
+    : ZJobSystem(std::max(std::thread::hardware_concurrency(), 2u) - 1) {}
+
+ZJobSystem::ZJobSystem(uint32_t workerCount) {
+  for (uint32_t i = 0; i <= workerCount; ++i) {
+    _deques.push_back(std::make_unique<_Deque>());
+  }
+  tpSystem = this;
+  tDeque = 0;
+  for (uint32_t i = 1; i <= workerCount; ++i) {
+    _workers.emplace_back(&ZJobSystem::_workerMain, this, i);
+  }
+}
+
+ZJobSystem::~ZJobSystem() {
+  _running.store(false);
+  _epoch.fetch_add(1);
+  _epoch.notify_all();
+  for (std::thread &worker : _workers) {
+    worker.join();
+  }
+
+  // Jobs that never ran are dropped
+  for (std::unique_ptr<_Deque> &pDeque : _deques) {
+    while (_Job *pJob = pDeque->steal()) {
+      delete pJob;
+    }
+  }
+  for (_Job *pJob : _injected) {
+    delete pJob;
+  }
+  if (tpSystem == this) {
+    tpSystem = nullptr;
+  }
+}
+
+void ZJobSystem::run(Job job, Counter *pCounter, Counter *pDependency) {
+  if (pCounter) {
+    pCounter->_value.fetch_add(1, std::memory_order_acq_rel);
+  }
+  if (pDependency) {
+    std::lock_guard<std::mutex> lock(pDependency->_mutex);
+    if (!pDependency->isDone()) {
+      pDependency->_continuations.emplace_back(std::move(job), pCounter);
+      return;
+    }
+  }
+  _schedule(new _Job{std::move(job), pCounter});
+}
+
+void ZJobSystem::wait(Counter &rCounter) {
+  uint32_t deque = _currentDeque();
+  bool helpAll = deque != _NoDeque || _workers.empty();
+  while (!rCounter.isDone()) {
+    bool ran = helpAll ? _runOne(deque) : _runInjected(rCounter);
+    if (!ran) {
+      std::this_thread::yield();
+    }
+  }
+  // The job that brought the counter to zero may still hold its mutex
+  std::lock_guard<std::mutex> lock(rCounter._mutex);
+}
+
+ZJobSystem::Stats ZJobSystem::getStats() const {
+  return {_jobCount.load(std::memory_order_relaxed),
+          _stealCount.load(std::memory_order_relaxed)};
+}
+
+void ZJobSystem::_workerMain(uint32_t deque) {
+  tpSystem = this;
+  tDeque = deque;
+  while (_running.load(std::memory_order_acquire)) {
+    if (_runOne(deque)) {
+      continue;
+    }
+    // Look once more after reading the epoch, a job submitted in between
+    // changes it and the wait returns right away
+    uint32_t epoch = _epoch.load();
+    if (_runOne(deque)) {
+      continue;
+    }
+    if (!_running.load(std::memory_order_acquire)) {
+      break;
+    }
+    _epoch.wait(epoch);
+  }
+}
+
+uint32_t ZJobSystem::_currentDeque() const {
+  return tpSystem == this ? tDeque : _NoDeque;
+}
+
+void ZJobSystem::_schedule(_Job *pJob) {
+  uint32_t deque = _currentDeque();
+  if (deque == _NoDeque || !_deques[deque]->push(pJob)) {
+    std::lock_guard<std::mutex> lock(_injectedMutex);
+    _injected.push_back(pJob);
+    _injectedCount.fetch_add(1, std::memory_order_release);
+  }
+  _epoch.fetch_add(1);
+  _epoch.notify_one();
+}
+
+bool ZJobSystem::_runOne(uint32_t deque) {
+  _Job *pJob = deque != _NoDeque ? _deques[deque]->pop() : nullptr;
+
+  if (!pJob && _injectedCount.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> lock(_injectedMutex);
+    if (!_injected.empty()) {
+      pJob = _injected.front();
+      _injected.pop_front();
+      _injectedCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  if (!pJob) {
+    // Steal from the next deques first, so thieves spread over victims
+    uint32_t count = (uint32_t)_deques.size();
+    uint32_t first = deque != _NoDeque ? deque + 1 : 0;
+    for (uint32_t i = 0; i < count && !pJob; ++i) {
+      uint32_t victim = (first + i) % count;
+      if (victim != deque) {
+        pJob = _deques[victim]->steal();
+      }
+    }
+    if (!pJob) {
+      return false;
+    }
+    _stealCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  _execute(pJob);
+  return true;
+}
+
+bool ZJobSystem::_runInjected(const Counter &rCounter) {
+  if (_injectedCount.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  _Job *pJob = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_injectedMutex);
+    auto it = std::find_if(_injected.begin(), _injected.end(),
+                           [&rCounter](const _Job *pInjected) {
+                             return pInjected->pCounter == &rCounter;
+                           });
+    if (it == _injected.end()) {
+      return false;
+    }
+    pJob = *it;
+    _injected.erase(it);
+    _injectedCount.fetch_sub(1, std::memory_order_relaxed);
+  }
+  _execute(pJob);
+  return true;
+}
+
+void ZJobSystem::_execute(_Job *pJob) {
+  pJob->job();
+  // Counted before the counter is released, so that the stats include the
+  // jobs a `wait` returned for
+  _jobCount.fetch_add(1, std::memory_order_relaxed);
+  _finish(pJob->pCounter);
+  delete pJob;
+}
+
+void ZJobSystem::_finish(Counter *pCounter) {
+  if (!pCounter) {
+    return;
+  }
+  // Decrements that do not reach zero need no lock
+  uint32_t value = pCounter->_value.load(std::memory_order_acquire);
+  while (value > 1) {
+    if (pCounter->_value.compare_exchange_weak(value, value - 1,
+                                               std::memory_order_acq_rel)) {
+      return;
+    }
+  }
+
+  std::vector<std::pair<Job, Counter *>> continuations;
+  {
+    std::lock_guard<std::mutex> lock(pCounter->_mutex);
+    if (pCounter->_value.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      continuations.swap(pCounter->_continuations);
+    }
+  }
+  // The counter may be gone by now, only its continuations are used
+  for (auto &[job, pJobCounter] : continuations) {
+    _schedule(new _Job{std::move(job), pJobCounter});
+  }
+}
+
+bool ZJobSystem::_Deque::push(_Job *pJob) {
+  int64_t bottom = _bottom.load(std::memory_order_relaxed);
+  int64_t top = _top.load(std::memory_order_acquire);
+  if (bottom - top >= _Capacity) {
+    return false;
+  }
+  _jobs[bottom % _Capacity].store(pJob, std::memory_order_relaxed);
+  // Publishes the job to the thieves
+  _bottom.store(bottom + 1, std::memory_order_release);
+  return true;
+}
+
+ZJobSystem::_Job *ZJobSystem::_Deque::pop() {
+  int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+  // Sequentially consistent, so that a thief cannot miss the reservation
+  // while the owner misses its steal
+  _bottom.store(bottom, std::memory_order_seq_cst);
+  int64_t top = _top.load(std::memory_order_seq_cst);
+  if (top > bottom) {
+    // Empty
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  _Job *pJob = _jobs[bottom % _Capacity].load(std::memory_order_relaxed);
+  if (top == bottom) {
+    // Last job, race the thieves for it
+    if (!_top.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      pJob = nullptr;
+    }
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return pJob;
+}
+
+ZJobSystem::_Job *ZJobSystem::_Deque::steal() {
+  int64_t top = _top.load(std::memory_order_seq_cst);
+  int64_t bottom = _bottom.load(std::memory_order_seq_cst);
+  if (top >= bottom) {
+    return nullptr;
+  }
+  _Job *pJob = _jobs[top % _Capacity].load(std::memory_order_relaxed);
+  if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+    // Lost to the owner or another thief
+    return nullptr;
+  }
+  return pJob;
+}
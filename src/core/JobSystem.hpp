@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Work-stealing job scheduler.
+ *
+ * Each worker, and the thread that created the system, owns a Chase-Lev
+ * deque: it pushes and pops jobs at the bottom without locking, while idle
+ * workers steal from the top of the others' deques. Jobs submitted from
+ * other threads (e.g. the render thread) go through a locked injection
+ * queue. Idle workers sleep on an atomic wait until jobs are submitted.
+ *
+ * Completion is tracked with counters: every job submitted with a counter
+ * increments it and decrements it when done. A job can depend on a counter,
+ * in which case it is only scheduled once that counter drops to zero.
+ * `wait` runs jobs on the calling thread until its counter reaches zero, so
+ * the waiting thread helps instead of blocking. Threads outside of the
+ * system only help with the jobs they submitted with that counter, so that
+ * e.g. the render thread never picks up a long job submitted by someone
+ * else. Without workers, they run any job, as nothing else would.
+ */
+class ZJobSystem {
+public:
+  using Job = std::function<void()>;
+
+  class Counter {
+  public:
+    bool isDone() const { return _value.load(std::memory_order_acquire) == 0; }
+
+  private:
+    friend class ZJobSystem;
+
+    std::atomic<uint32_t> _value = 0;
+    // Taken when the counter drops to zero, so that `wait` does not return
+    // while the last job still uses it
+    std::mutex _mutex;
+    // Jobs waiting for the counter to reach zero, with their own counter
+    std::vector<std::pair<Job, Counter *>> _continuations;
+  };
+
+  struct Stats {
+    uint64_t jobs = 0;
+    uint64_t steals = 0;
+  };
+
+public:
+  // One worker per core besides the creating thread by default
+  ZJobSystem();
+  explicit ZJobSystem(uint32_t workerCount);
+  ~ZJobSystem();
+
+  // Schedule `job`, which increments `pCounter` until it is done. With
+  // `pDependency`, the job only runs once that counter reached zero.
+  void run(Job job, Counter *pCounter = nullptr,
+           Counter *pDependency = nullptr);
+
+  // Run jobs until `rCounter` reaches zero
+  void wait(Counter &rCounter);
+
+  // Call `function(begin, end)` over [0, count) in ranges of at most `grain`
+  // indices, in parallel, and wait for all of them
+  template <typename F>
+  void parallelFor(uint32_t count, uint32_t grain, F &&function) {
+    grain = std::max(grain, 1u);
+    Counter counter;
+    for (uint32_t begin = 0; begin < count; begin += grain) {
+      uint32_t end = std::min(count, begin + grain);
+      run([&function, begin, end]() { function(begin, end); }, &counter);
+    }
+    wait(counter);
+  }
+
+  // Worker threads, not counting the creating thread
+  uint32_t getWorkerCount() const { return (uint32_t)_workers.size(); }
+  Stats getStats() const;
+
+private:
+  struct _Job {
+    Job job;
+    Counter *pCounter = nullptr;
+  };
+
+  // Chase-Lev deque of a fixed capacity. Only the owner pushes and pops.
+  class _Deque {
+  public:
+    bool push(_Job *pJob);
+    _Job *pop();
+    _Job *steal();
+
+  private:
+    static constexpr int64_t _Capacity = 4096;
+
+    alignas(64) std::atomic<int64_t> _top = 0;
+    alignas(64) std::atomic<int64_t> _bottom = 0;
+    std::array<std::atomic<_Job *>, _Capacity> _jobs{};
+  };
+
+  static constexpr uint32_t _NoDeque = 0xFFFFFFFF;
+
+  void _workerMain(uint32_t deque);
+  // Deque of the calling thread, or _NoDeque
+  uint32_t _currentDeque() const;
+  void _schedule(_Job *pJob);
+  // Run one job if any can be found. Returns false otherwise.
+  bool _runOne(uint32_t deque);
+  // Run one injected job submitted with `rCounter`, if any
+  bool _runInjected(const Counter &rCounter);
+  void _execute(_Job *pJob);
+  void _finish(Counter *pCounter);
+
+private:
+  // Deque 0 belongs to the creating thread, deque i to worker i - 1
+  std::vector<std::unique_ptr<_Deque>> _deques;
+  std::vector<std::thread> _workers;
+  std::mutex _injectedMutex;
+  std::deque<_Job *> _injected;
+  std::atomic<uint32_t> _injectedCount = 0;
+
+  std::atomic<bool> _running = true;
+  // Bumped on every submission, idle workers wait for it to change
+  std::atomic<uint32_t> _epoch = 0;
+
+  std::atomic<uint64_t> _jobCount = 0;
+  std::atomic<uint64_t> _stealCount = 0;
+};
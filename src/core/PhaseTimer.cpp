@@ -0,0 +1,56 @@
+#include "PhaseTimer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+static double toMs(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+ZPhaseTimer::ZPhaseTimer() : _origin(_Clock::now()) {}
+
+ZPhaseTimer::Phase ZPhaseTimer::begin(std::string name) {
+  _Clock::time_point now = _Clock::now();
+  std::lock_guard<std::mutex> lock(_mutex);
+  _phases.push_back({std::move(name), now, now});
+  return (Phase)_phases.size() - 1;
+}
+
+void ZPhaseTimer::end(Phase phase) {
+  _Clock::time_point now = _Clock::now();
+  std::lock_guard<std::mutex> lock(_mutex);
+  _phases[phase].end = now;
+  _phases[phase].ended = true;
+}
+
+void ZPhaseTimer::report(std::ostream &rStream) const {
+  std::vector<_Phase> phases;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const _Phase &phase : _phases) {
+      if (phase.ended) {
+        phases.push_back(phase);
+      }
+    }
+  }
+  if (phases.empty()) {
+    return;
+  }
+  std::stable_sort(phases.begin(), phases.end(),
+                   [](const _Phase &a, const _Phase &b) {
+                     return a.start < b.start;
+                   });
+
+  _Clock::time_point last = phases.front().end;
+  char line[160];
+  for (const _Phase &phase : phases) {
+    std::snprintf(line, sizeof(line), "  %8.1f - %8.1f ms  %8.1f ms  %s\n",
+                  toMs(phase.start - _origin), toMs(phase.end - _origin),
+                  toMs(phase.end - phase.start), phase.name.c_str());
+    rStream << line;
+    last = std::max(last, phase.end);
+  }
+  std::snprintf(line, sizeof(line), "  %.1f ms in total\n",
+                toMs(last - _origin));
+  rStream << line;
+}
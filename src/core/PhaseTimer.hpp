@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Wall-clock spans of named phases, e.g. of the startup.
+ *
+ * Phases may run on any thread and overlap. `report` lists them by start,
+ * as offsets from the creation of the timer, so that phases that ran at the
+ * same time show as overlapping ranges.
+ */
+class ZPhaseTimer {
+public:
+  using Phase = uint32_t;
+
+  // Ends its phase when destroyed
+  class Scope {
+  public:
+    Scope(ZPhaseTimer &rTimer, std::string name)
+        : _rTimer(rTimer), _phase(rTimer.begin(std::move(name))) {}
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() { _rTimer.end(_phase); }
+
+  private:
+    ZPhaseTimer &_rTimer;
+    Phase _phase;
+  };
+
+public:
+  ZPhaseTimer();
+
+  Phase begin(std::string name);
+  void end(Phase phase);
+
+  // Print the ended phases, and the time until the last one ended
+  void report(std::ostream &rStream) const;
+
+private:
+  using _Clock = std::chrono::steady_clock;
+
+  struct _Phase {
+    std::string name;
+    _Clock::time_point start;
+    _Clock::time_point end;
+    bool ended = false;
+  };
+
+private:
+  _Clock::time_point _origin;
+  mutable std::mutex _mutex;
+  std::vector<_Phase> _phases;
+};
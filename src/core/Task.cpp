@@ -0,0 +1,53 @@
+#include "Task.hpp"
+
+#include <thread>
+
+ZTaskExecutor::ZTaskExecutor(ZJobSystem &rJobs, Pump pump)
+    : _rJobs(rJobs), _pump(std::move(pump)) {}
+
+ZTaskExecutor::~ZTaskExecutor() { drain(); }
+
+void ZTaskExecutor::post(std::coroutine_handle<> handle) {
+  std::lock_guard<std::mutex> lock(_postedMutex);
+  _posted.push_back(handle);
+}
+
+void ZTaskExecutor::poll() {
+  if (_pump) {
+    _pump();
+  }
+  std::vector<std::coroutine_handle<>> posted;
+  {
+    std::lock_guard<std::mutex> lock(_postedMutex);
+    posted.swap(_posted);
+  }
+  // Coroutines posted while these run wait for the next poll
+  for (std::coroutine_handle<> handle : posted) {
+    handle.resume();
+  }
+}
+
+void ZTaskExecutor::spawn(ZTask<void> task) {
+  _pending.fetch_add(1, std::memory_order_relaxed);
+  _detach(std::move(task), this);
+}
+
+void ZTaskExecutor::drain() {
+  while (getPendingCount() > 0) {
+    poll();
+    std::this_thread::yield();
+  }
+}
+
+ZTaskExecutor::_Detached ZTaskExecutor::_detach(ZTask<void> task,
+                                                ZTaskExecutor *pExecutor) {
+  co_await task;
+  pExecutor->_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void ZTaskExecutor::_pollUntil(const std::atomic<bool> &rDone) {
+  while (!rDone.load(std::memory_order_acquire)) {
+    poll();
+    std::this_thread::yield();
+  }
+}
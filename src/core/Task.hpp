@@ -0,0 +1,233 @@
+#pragma once
+
+#include "JobSystem.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename T> class ZTask;
+
+// Result storage of the promise of a ZTask
+template <typename T> class ZTaskResult {
+public:
+  void return_value(T value) { _value = std::move(value); }
+  T take() { return std::move(*_value); }
+
+private:
+  std::optional<T> _value;
+};
+
+template <> class ZTaskResult<void> {
+public:
+  void return_void() {}
+  void take() {}
+};
+
+/**
+ * Coroutine producing a T, started when it is awaited.
+ *
+ * A task runs on the thread that awaits it until it suspends, on a GPU
+ * operation or to move to another thread through its executor. When it
+ * completes, the coroutine awaiting it resumes right away on the same
+ * thread. Tasks are started from regular code with ZTaskExecutor::spawn or
+ * ZTaskExecutor::run.
+ *
+ * Errors are returned as values, as in the rest of the engine: an exception
+ * escaping a task terminates.
+ */
+template <typename T = void> class ZTask {
+public:
+  struct promise_type : ZTaskResult<T> {
+    // Resumed on completion
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    struct FinalAwaiter {
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        return handle.promise().continuation;
+      }
+      void await_resume() const noexcept {}
+    };
+
+    ZTask get_return_object() {
+      return ZTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+
+public:
+  ZTask(ZTask &&other) noexcept
+      : _handle(std::exchange(other._handle, nullptr)) {}
+  ZTask &operator=(ZTask &&other) noexcept {
+    if (this != &other) {
+      if (_handle) {
+        _handle.destroy();
+      }
+      _handle = std::exchange(other._handle, nullptr);
+    }
+    return *this;
+  }
+  ZTask(const ZTask &) = delete;
+  ZTask &operator=(const ZTask &) = delete;
+  ~ZTask() {
+    if (_handle) {
+      _handle.destroy();
+    }
+  }
+
+  bool isDone() const { return !_handle || _handle.done(); }
+
+  bool await_ready() const noexcept { return isDone(); }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    _handle.promise().continuation = awaiting;
+    // Symmetric transfer, deep chains of tasks do not grow the stack
+    return _handle;
+  }
+  T await_resume() { return _handle.promise().take(); }
+
+private:
+  explicit ZTask(std::coroutine_handle<promise_type> handle)
+      : _handle(handle) {}
+
+private:
+  std::coroutine_handle<promise_type> _handle;
+};
+
+/**
+ * Resumes ZTask coroutines on the thread that owns the device, or on the
+ * workers of the job system.
+ *
+ * The owner thread calls `poll` regularly, e.g. once per frame. Polling
+ * calls the `pump` function, which has the device and the instance process
+ * their callbacks, then resumes the coroutines posted since the last poll:
+ * the ones whose GPU operation completed, and the ones that asked to move
+ * to the owner thread. `resumeOnWorker` moves a coroutine to the job
+ * system, for file reads and decoding, and `resumeOnOwner` brings it back
+ * before it touches the device.
+ *
+ * Outside of a coroutine, `spawn` starts a task in the background and `run`
+ * polls until it completes, which bridges the blocking initialization code.
+ */
+class ZTaskExecutor {
+public:
+  using Pump = std::function<void()>;
+
+  class WorkerAwaiter {
+  public:
+    explicit WorkerAwaiter(ZJobSystem &rJobs) : _rJobs(rJobs) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      _rJobs.run([handle]() { handle.resume(); });
+    }
+    void await_resume() const noexcept {}
+
+  private:
+    ZJobSystem &_rJobs;
+  };
+
+  class OwnerAwaiter {
+  public:
+    explicit OwnerAwaiter(ZTaskExecutor &rExecutor) : _rExecutor(rExecutor) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      _rExecutor.post(handle);
+    }
+    void await_resume() const noexcept {}
+
+  private:
+    ZTaskExecutor &_rExecutor;
+  };
+
+public:
+  ZTaskExecutor(ZJobSystem &rJobs, Pump pump);
+  ZTaskExecutor(const ZTaskExecutor &) = delete;
+  ZTaskExecutor &operator=(const ZTaskExecutor &) = delete;
+  // Waits for the spawned tasks, which reference the executor
+  ~ZTaskExecutor();
+
+  WorkerAwaiter resumeOnWorker() { return WorkerAwaiter(_rJobs); }
+  OwnerAwaiter resumeOnOwner() { return OwnerAwaiter(*this); }
+
+  // Resume `handle` at the next poll. Thread-safe.
+  void post(std::coroutine_handle<> handle);
+
+  // Pump the callbacks, then resume the coroutines posted until now. Owner
+  // thread only.
+  void poll();
+
+  // Start `task` now. It keeps running, and is destroyed once done.
+  void spawn(ZTask<void> task);
+
+  // Poll until every spawned task is done
+  void drain();
+
+  // Start `awaitable`, a task or a GPU operation, and poll until it
+  // completes. Returns its result.
+  template <typename Awaitable> auto run(Awaitable awaitable) {
+    using Result = decltype(awaitable.await_resume());
+    std::atomic<bool> done = false;
+    if constexpr (std::is_void_v<Result>) {
+      spawn(_runTask(std::move(awaitable), done));
+      _pollUntil(done);
+    } else {
+      std::optional<Result> result;
+      spawn(_runTask(std::move(awaitable), result, done));
+      _pollUntil(done);
+      return std::move(*result);
+    }
+  }
+
+  uint32_t getPendingCount() const {
+    return _pending.load(std::memory_order_acquire);
+  }
+
+private:
+  // Owns a spawned task while it runs
+  struct _Detached {
+    struct promise_type {
+      _Detached get_return_object() const noexcept { return {}; }
+      std::suspend_never initial_suspend() const noexcept { return {}; }
+      std::suspend_never final_suspend() const noexcept { return {}; }
+      void return_void() const noexcept {}
+      void unhandled_exception() const noexcept { std::terminate(); }
+    };
+  };
+
+  static _Detached _detach(ZTask<void> task, ZTaskExecutor *pExecutor);
+
+  template <typename Awaitable>
+  static ZTask<void> _runTask(Awaitable awaitable, std::atomic<bool> &rDone) {
+    co_await std::move(awaitable);
+    rDone.store(true, std::memory_order_release);
+  }
+
+  template <typename Awaitable, typename Result>
+  static ZTask<void> _runTask(Awaitable awaitable,
+                              std::optional<Result> &rResult,
+                              std::atomic<bool> &rDone) {
+    rResult = co_await std::move(awaitable);
+    rDone.store(true, std::memory_order_release);
+  }
+
+  void _pollUntil(const std::atomic<bool> &rDone);
+
+private:
+  ZJobSystem &_rJobs;
+  Pump _pump;
+  std::mutex _postedMutex;
+  std::vector<std::coroutine_handle<>> _posted;
+  // Spawned tasks not done yet
+  std::atomic<uint32_t> _pending = 0;
+};
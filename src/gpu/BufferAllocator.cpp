@@ -0,0 +1,261 @@
+#include "BufferAllocator.hpp"
+
+#include <algorithm>
+#include <bit>
+
+using namespace wgpu;
+
+// Default size of the pools of each class, larger allocations get a pool of
+// their own size
+static constexpr uint64_t VertexPoolSize = 16 * 1024 * 1024;
+static constexpr uint64_t UniformPoolSize = 1024 * 1024;
+static constexpr uint64_t StoragePoolSize = 4 * 1024 * 1024;
+
+// A pool is evacuated once less than this fraction of it is used
+static constexpr double DrainThreshold = 0.25;
+
+ZBufferAllocator::ZBufferAllocator(Device &rDevice, uint64_t compactionBudget)
+    : _rDevice(rDevice), _compactionBudget(compactionBudget) {
+  SupportedLimits supportedLimits;
+  _rDevice.getLimits(&supportedLimits);
+  const Limits &limits = supportedLimits.limits;
+  _maxBufferSize = limits.maxBufferSize;
+
+  // Every pool can be copied from and to, for compaction
+  _Class &vertexClass = _classes[(size_t)ZBufferUsage::Vertex];
+  vertexClass.usage = BufferUsage::Vertex | BufferUsage::Index |
+                      BufferUsage::CopyDst | BufferUsage::CopySrc;
+  vertexClass.alignment = 16;
+  vertexClass.poolSize = VertexPoolSize;
+
+  _Class &uniformClass = _classes[(size_t)ZBufferUsage::Uniform];
+  uniformClass.usage =
+      BufferUsage::Uniform | BufferUsage::CopyDst | BufferUsage::CopySrc;
+  uniformClass.alignment =
+      std::max<uint64_t>(limits.minUniformBufferOffsetAlignment, 16);
+  uniformClass.poolSize = UniformPoolSize;
+
+  _Class &storageClass = _classes[(size_t)ZBufferUsage::Storage];
+  storageClass.usage =
+      BufferUsage::Storage | BufferUsage::CopyDst | BufferUsage::CopySrc;
+  storageClass.alignment =
+      std::max<uint64_t>(limits.minStorageBufferOffsetAlignment, 16);
+  storageClass.poolSize = StoragePoolSize;
+}
+
+ZBufferAllocator::~ZBufferAllocator() {
+  for (_Class &usageClass : _classes) {
+    for (std::unique_ptr<_Pool> &pPool : usageClass.pools) {
+      if (pPool) {
+        pPool->buffer.destroy();
+        pPool->buffer.release();
+      }
+    }
+  }
+}
+
+ZBufferAllocator::Handle ZBufferAllocator::allocate(
+    ZBufferUsage usage, uint64_t size, std::function<void()> onMoved) {
+  _Class &usageClass = _classes[(size_t)usage];
+  uint32_t pool, block;
+  if (!_allocateIn(usageClass, size, ZTlsf::InvalidBlock, pool, block)) {
+    pool = _createPool(usageClass, size);
+    if (pool == ZTlsf::InvalidBlock) {
+      return InvalidHandle;
+    }
+    block = usageClass.pools[pool]->tlsf.allocate(size, usageClass.alignment);
+    if (block == ZTlsf::InvalidBlock) {
+      return InvalidHandle;
+    }
+  }
+
+  Handle handle;
+  if (!_freeHandles.empty()) {
+    handle = _freeHandles.back();
+    _freeHandles.pop_back();
+  } else {
+    handle = (Handle)_allocations.size();
+    _allocations.emplace_back();
+  }
+  _allocations[handle] = {usage, pool, block, size, std::move(onMoved)};
+  return handle;
+}
+
+void ZBufferAllocator::free(Handle handle) {
+  _Allocation &allocation = _allocations[handle];
+  _Class &usageClass = _classes[(size_t)allocation.usage];
+  usageClass.pools[allocation.pool]->tlsf.free(allocation.block);
+  allocation = {};
+  _freeHandles.push_back(handle);
+}
+
+ZBufferAllocator::Binding ZBufferAllocator::get(Handle handle) const {
+  const _Allocation &allocation = _allocations[handle];
+  const _Pool &pool =
+      *_classes[(size_t)allocation.usage].pools[allocation.pool];
+  return {pool.buffer, pool.tlsf.getOffset(allocation.block),
+          allocation.size};
+}
+
+void ZBufferAllocator::compact(CommandEncoder &rEncoder) {
+  uint64_t budget = _compactionBudget;
+  for (size_t usage = 0; usage < _classes.size() && budget > 0; ++usage) {
+    _Class &usageClass = _classes[usage];
+    auto draining = std::find_if(
+        usageClass.pools.begin(), usageClass.pools.end(),
+        [](const std::unique_ptr<_Pool> &pPool) {
+          return pPool && pPool->draining;
+        });
+    if (draining == usageClass.pools.end()) {
+      _startDraining(usageClass);
+      continue;
+    }
+    uint32_t drainingPool = (uint32_t)(draining - usageClass.pools.begin());
+    _Pool &source = **draining;
+
+    for (Handle handle = 0; handle < _allocations.size() && budget > 0;
+         ++handle) {
+      _Allocation &allocation = _allocations[handle];
+      if (allocation.block == ZTlsf::InvalidBlock ||
+          allocation.usage != (ZBufferUsage)usage ||
+          allocation.pool != drainingPool) {
+        continue;
+      }
+      uint32_t pool, block;
+      if (!_allocateIn(usageClass, allocation.size, drainingPool, pool,
+                       block)) {
+        // The other pools filled up in the meantime, give up on this one
+        source.draining = false;
+        break;
+      }
+
+      // Copies are in multiples of 4 bytes, blocks are rounded to 16
+      _Pool &destination = *usageClass.pools[pool];
+      uint64_t copySize = (allocation.size + 3) & ~uint64_t(3);
+      rEncoder.copyBufferToBuffer(
+          source.buffer, source.tlsf.getOffset(allocation.block),
+          destination.buffer, destination.tlsf.getOffset(block), copySize);
+      // Nothing is allocated in a draining pool, so the old range cannot
+      // be overwritten before the copy runs
+      source.tlsf.free(allocation.block);
+      allocation.pool = pool;
+      allocation.block = block;
+
+      ++usageClass.stats.moves;
+      usageClass.stats.movedBytes += copySize;
+      budget -= std::min(budget, copySize);
+      if (allocation.onMoved) {
+        allocation.onMoved();
+      }
+    }
+  }
+}
+
+void ZBufferAllocator::endFrame() {
+  // The copies out of the evacuated pools were submitted, they can go
+  for (_Class &usageClass : _classes) {
+    for (size_t i = 0; i < usageClass.pools.size(); ++i) {
+      std::unique_ptr<_Pool> &pPool = usageClass.pools[i];
+      // The first pool of each class is kept even when empty
+      if (pPool && pPool->tlsf.getUsed() == 0 && (i > 0 || pPool->draining)) {
+        pPool->buffer.destroy();
+        pPool->buffer.release();
+        pPool.reset();
+      }
+    }
+  }
+}
+
+ZBufferAllocator::Stats ZBufferAllocator::getStats(ZBufferUsage usage) const {
+  const _Class &usageClass = _classes[(size_t)usage];
+  Stats stats = usageClass.stats;
+  for (const std::unique_ptr<_Pool> &pPool : usageClass.pools) {
+    if (pPool) {
+      ++stats.poolCount;
+      stats.capacity += pPool->tlsf.getCapacity();
+      stats.used += pPool->tlsf.getUsed();
+    }
+  }
+  for (const _Allocation &allocation : _allocations) {
+    if (allocation.block != ZTlsf::InvalidBlock &&
+        allocation.usage == usage) {
+      ++stats.allocationCount;
+    }
+  }
+  return stats;
+}
+
+bool ZBufferAllocator::_allocateIn(_Class &usageClass, uint64_t size,
+                                   uint32_t excludedPool, uint32_t &pool,
+                                   uint32_t &block) {
+  for (pool = 0; pool < usageClass.pools.size(); ++pool) {
+    _Pool *pPool = usageClass.pools[pool].get();
+    if (pool == excludedPool || !pPool || pPool->draining) {
+      continue;
+    }
+    block = pPool->tlsf.allocate(size, usageClass.alignment);
+    if (block != ZTlsf::InvalidBlock) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t ZBufferAllocator::_createPool(_Class &usageClass, uint64_t minSize) {
+  // Room for the allocation wherever the alignment puts it
+  uint64_t size = std::max(usageClass.poolSize,
+                           std::bit_ceil(minSize + usageClass.alignment));
+  size = std::min(size, _maxBufferSize);
+  if (size < minSize) {
+    return ZTlsf::InvalidBlock;
+  }
+
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = size;
+  bufferDesc.usage = usageClass.usage;
+  bufferDesc.mappedAtCreation = false;
+  Buffer buffer = _rDevice.createBuffer(bufferDesc);
+  if (!buffer) {
+    return ZTlsf::InvalidBlock;
+  }
+
+  auto pPool = std::make_unique<_Pool>(buffer, ZTlsf(size), false);
+  for (uint32_t pool = 0; pool < usageClass.pools.size(); ++pool) {
+    if (!usageClass.pools[pool]) {
+      usageClass.pools[pool] = std::move(pPool);
+      return pool;
+    }
+  }
+  usageClass.pools.push_back(std::move(pPool));
+  return (uint32_t)usageClass.pools.size() - 1;
+}
+
+void ZBufferAllocator::_startDraining(_Class &usageClass) {
+  // Evacuate the sparsest pool, if the others can take its allocations
+  _Pool *pSparsest = nullptr;
+  uint64_t freeElsewhere = 0;
+  uint32_t poolCount = 0;
+  for (std::unique_ptr<_Pool> &pPool : usageClass.pools) {
+    if (!pPool) {
+      continue;
+    }
+    ++poolCount;
+    uint64_t free = pPool->tlsf.getCapacity() - pPool->tlsf.getUsed();
+    freeElsewhere += free;
+    if (!pSparsest ||
+        pPool->tlsf.getUsed() * pSparsest->tlsf.getCapacity() <
+            pSparsest->tlsf.getUsed() * pPool->tlsf.getCapacity()) {
+      pSparsest = pPool.get();
+    }
+  }
+  if (poolCount < 2) {
+    return;
+  }
+
+  uint64_t used = pSparsest->tlsf.getUsed();
+  freeElsewhere -= pSparsest->tlsf.getCapacity() - used;
+  if (used < DrainThreshold * pSparsest->tlsf.getCapacity() &&
+      used < freeElsewhere) {
+    pSparsest->draining = true;
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Tlsf.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+enum class ZBufferUsage { Vertex, Uniform, Storage };
+
+/**
+ * Suballocates GPU buffers out of a few large backing buffers ("pools").
+ *
+ * Each usage class has its own pools, each managed by a ZTlsf, so that
+ * allocation and free are O(1). Offsets are aligned to what the class
+ * requires (minUniformBufferOffsetAlignment for uniforms,
+ * minStorageBufferOffsetAlignment for storage).
+ *
+ * Allocations are referred to by handle and may move: `compact`
+ * incrementally evacuates the sparsest pool of a class into the others
+ * with copyBufferToBuffer, then releases it. Users either resolve their
+ * handle with `get` each time they bind it, or pass an `onMoved` callback
+ * to refresh what they derived from it (e.g. a bind group).
+ */
+class ZBufferAllocator {
+public:
+  using Handle = uint32_t;
+  static constexpr Handle InvalidHandle = 0xFFFFFFFF;
+
+  struct Binding {
+    wgpu::Buffer buffer = nullptr;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+  };
+
+  struct Stats {
+    uint32_t poolCount = 0;
+    uint32_t allocationCount = 0;
+    // Bytes of the pools, and bytes allocated in them
+    uint64_t capacity = 0;
+    uint64_t used = 0;
+    // Allocations moved by compaction
+    uint64_t moves = 0;
+    uint64_t movedBytes = 0;
+  };
+
+public:
+  // At most `compactionBudget` bytes are moved per frame
+  ZBufferAllocator(wgpu::Device &rDevice,
+                   uint64_t compactionBudget = 1024 * 1024);
+  ~ZBufferAllocator();
+
+  // Returns InvalidHandle when the allocation does not fit in a buffer.
+  // `onMoved` is called when compaction moved the allocation.
+  Handle allocate(ZBufferUsage usage, uint64_t size,
+                  std::function<void()> onMoved = {});
+  void free(Handle handle);
+  Binding get(Handle handle) const;
+
+  // Move part of the allocations of sparse pools. To be called once per
+  // frame, before any pass that uses the allocations.
+  void compact(wgpu::CommandEncoder &rEncoder);
+
+  // Release the pools left empty. To be called once per frame, after the
+  // submit.
+  void endFrame();
+
+  Stats getStats(ZBufferUsage usage) const;
+
+private:
+  struct _Pool {
+    wgpu::Buffer buffer = nullptr;
+    ZTlsf tlsf;
+    // Being evacuated, no new allocation goes there
+    bool draining = false;
+  };
+
+  struct _Class {
+    wgpu::BufferUsageFlags usage = wgpu::BufferUsage::None;
+    uint64_t alignment = 16;
+    uint64_t poolSize = 0;
+    // Released pools leave an empty slot so that pool indices are stable
+    std::vector<std::unique_ptr<_Pool>> pools;
+    Stats stats;
+  };
+
+  struct _Allocation {
+    ZBufferUsage usage = ZBufferUsage::Vertex;
+    uint32_t pool = 0;
+    uint32_t block = ZTlsf::InvalidBlock;
+    uint64_t size = 0;
+    std::function<void()> onMoved;
+  };
+
+  // Allocate in an existing pool of the class other than `excludedPool`
+  bool _allocateIn(_Class &usageClass, uint64_t size, uint32_t excludedPool,
+                   uint32_t &pool, uint32_t &block);
+  uint32_t _createPool(_Class &usageClass, uint64_t minSize);
+  void _startDraining(_Class &usageClass);
+
+private:
+  wgpu::Device &_rDevice;
+  uint64_t _compactionBudget;
+  uint64_t _maxBufferSize;
+  std::array<_Class, 3> _classes;
+  std::vector<_Allocation> _allocations;
+  std::vector<Handle> _freeHandles;
+};
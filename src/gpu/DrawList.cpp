@@ -0,0 +1,109 @@
+#include "DrawList.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+static constexpr uint32_t PipelineBits = 10;
+static constexpr uint32_t MaterialBits = 12;
+static constexpr uint32_t VertexBufferBits = 16;
+static constexpr uint32_t DepthBits = 24;
+
+static constexpr uint64_t mask(uint32_t bits) { return (1ull << bits) - 1; }
+
+void ZDrawList::clear() {
+  _draws.clear();
+  _sorted.clear();
+  _stats = Stats{};
+}
+
+void ZDrawList::add(Pass pass, uint32_t pipelineId, uint32_t materialId,
+                    uint32_t vertexBufferId, float depth, const Draw &draw) {
+  _sorted.push_back({makeKey(pass, pipelineId, materialId, vertexBufferId,
+                             depth),
+                     (uint32_t)_draws.size()});
+  _draws.push_back(draw);
+}
+
+void ZDrawList::sort() {
+  size_t count = _sorted.size();
+  _scratch.resize(count);
+  _stats.sortPasses = 0;
+
+  for (uint32_t shift = 0; shift < 64; shift += 8) {
+    std::array<uint32_t, 256> histogram{};
+    for (const _Entry &entry : _sorted) {
+      ++histogram[(entry.key >> shift) & 0xFF];
+    }
+    // All keys share this byte, the pass would not move anything
+    if (count == 0 ||
+        histogram[(_sorted[0].key >> shift) & 0xFF] == count) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t &bucket : histogram) {
+      uint32_t bucketCount = bucket;
+      bucket = offset;
+      offset += bucketCount;
+    }
+    // Stable, so the order of the lower bytes is kept
+    for (const _Entry &entry : _sorted) {
+      _scratch[histogram[(entry.key >> shift) & 0xFF]++] = entry;
+    }
+    _sorted.swap(_scratch);
+    ++_stats.sortPasses;
+  }
+
+  _scratchDraws.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    _scratchDraws[i] = _draws[_sorted[i].index];
+    _sorted[i].index = i;
+  }
+  _draws.swap(_scratchDraws);
+
+  _stats.draws = (uint32_t)count;
+  _stats.stateChanges = countStateChanges(_draws.data(), count);
+  uint32_t stateCount = 0;
+  for (const Draw &draw : _draws) {
+    stateCount += draw.materialBindGroup ? 4 : 3;
+  }
+  _stats.stateChangesSkipped = stateCount - _stats.stateChanges;
+}
+
+uint64_t ZDrawList::makeKey(Pass pass, uint32_t pipelineId,
+                            uint32_t materialId, uint32_t vertexBufferId,
+                            float depth) {
+  depth = std::clamp(depth, 0.0f, 1.0f);
+  if (pass == Pass::Transparent) {
+    // Back to front
+    depth = 1.0f - depth;
+  }
+  uint64_t quantizedDepth =
+      (uint64_t)std::llround(depth * (double)mask(DepthBits));
+
+  uint64_t key = (uint64_t)pass;
+  key = (key << PipelineBits) | (pipelineId & mask(PipelineBits));
+  key = (key << MaterialBits) | (materialId & mask(MaterialBits));
+  key = (key << VertexBufferBits) | (vertexBufferId & mask(VertexBufferBits));
+  key = (key << DepthBits) | quantizedDepth;
+  return key;
+}
+
+uint32_t ZDrawList::countStateChanges(const Draw *pDraws, size_t count) {
+  uint32_t changes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Draw &draw = pDraws[i];
+    const Draw *pPrevious = i > 0 ? &pDraws[i - 1] : nullptr;
+    changes += !pPrevious || draw.pipeline != pPrevious->pipeline;
+    changes += !pPrevious || draw.bindGroup != pPrevious->bindGroup;
+    changes += draw.materialBindGroup &&
+               (!pPrevious ||
+                draw.materialBindGroup != pPrevious->materialBindGroup ||
+                draw.materialOffset != pPrevious->materialOffset);
+    changes += !pPrevious || draw.vertexBuffer != pPrevious->vertexBuffer ||
+               draw.vertexOffset != pPrevious->vertexOffset ||
+               draw.vertexSize != pPrevious->vertexSize;
+  }
+  return changes;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Draws of a frame, sorted to minimize state changes.
+ *
+ * Each draw gets a 64-bit key, from the most to the least significant bits:
+ *
+ *   pass (2) | pipeline (10) | material (12) | vertex buffer (16) | depth (24)
+ *
+ * so that sorting by key groups the draws by pass, then by state from the
+ * most to the least expensive to change, and orders each group by depth:
+ * front to back for opaque draws, for early depth rejection, and back to
+ * front for transparent ones. The keys are sorted with an LSD radix sort,
+ * one byte per pass, skipping the bytes all keys share.
+ *
+ * Draws replayed from cached render bundles are added without a depth, so
+ * that their order only changes with their state and moving the camera does
+ * not re-record the bundles. Within a state they keep the order they were
+ * added in.
+ *
+ * `encode` then only sets the state that differs from the previous draw.
+ */
+class ZDrawList {
+public:
+  enum class Pass : uint32_t {
+    Opaque = 0,
+    Transparent = 1,
+  };
+
+  // Everything needed to encode a draw
+  struct Draw {
+    WGPURenderPipeline pipeline;
+    WGPUBindGroup bindGroup;
+    // Bind group 1 of pipelines that have one, with a single dynamic offset
+    // selecting the data of the material
+    WGPUBindGroup materialBindGroup;
+    uint32_t materialOffset;
+    WGPUBuffer vertexBuffer;
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint32_t vertexCount;
+    // Index of the object record, read by the shader
+    uint32_t firstInstance;
+
+    bool operator==(const Draw &other) const = default;
+  };
+
+  struct Stats {
+    uint32_t draws = 0;
+    // Pipeline, bind group and vertex buffer changes left after sorting
+    uint32_t stateChanges = 0;
+    // Changes saved compared to setting all of them for every draw
+    uint32_t stateChangesSkipped = 0;
+    // Radix passes run, out of 8
+    uint32_t sortPasses = 0;
+  };
+
+public:
+  void clear();
+
+  // `depth` is the distance to the camera over the far plane, in [0, 1].
+  // IDs above the width of their field are wrapped, which only costs
+  // grouping.
+  void add(Pass pass, uint32_t pipelineId, uint32_t materialId,
+           uint32_t vertexBufferId, float depth, const Draw &draw);
+  // Same sorted by state only, for draws recorded into cached bundles
+  void add(Pass pass, uint32_t pipelineId, uint32_t materialId,
+           uint32_t vertexBufferId, const Draw &draw) {
+    add(pass, pipelineId, materialId, vertexBufferId, 0.0f, draw);
+  }
+
+  // Sort the draws by key and count the state changes left
+  void sort();
+
+  size_t size() const { return _draws.size(); }
+  // The draws, in key order once sorted
+  const Draw *data() const { return _draws.data(); }
+  const Draw &operator[](size_t i) const { return _draws[i]; }
+  const Stats &getStats() const { return _stats; }
+
+  static uint64_t makeKey(Pass pass, uint32_t pipelineId, uint32_t materialId,
+                          uint32_t vertexBufferId, float depth);
+
+  // Pipeline, bind groups and vertex buffer changes needed to encode
+  // `draws` in this order
+  static uint32_t countStateChanges(const Draw *pDraws, size_t count);
+
+  // Encode `draws` in a render pass or bundle, skipping the state already
+  // set by the previous draw
+  template <typename Encoder>
+  static void encode(Encoder &rEncoder, const Draw *pDraws, size_t count) {
+    const Draw *pPrevious = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+      const Draw &draw = pDraws[i];
+      if (!pPrevious || draw.pipeline != pPrevious->pipeline) {
+        rEncoder.setPipeline(draw.pipeline);
+      }
+      if (!pPrevious || draw.bindGroup != pPrevious->bindGroup) {
+        rEncoder.setBindGroup(0, draw.bindGroup, 0, nullptr);
+      }
+      if (draw.materialBindGroup &&
+          (!pPrevious ||
+           draw.materialBindGroup != pPrevious->materialBindGroup ||
+           draw.materialOffset != pPrevious->materialOffset)) {
+        rEncoder.setBindGroup(1, draw.materialBindGroup, 1,
+                              &draw.materialOffset);
+      }
+      if (!pPrevious || draw.vertexBuffer != pPrevious->vertexBuffer ||
+          draw.vertexOffset != pPrevious->vertexOffset ||
+          draw.vertexSize != pPrevious->vertexSize) {
+        rEncoder.setVertexBuffer(0, draw.vertexBuffer, draw.vertexOffset,
+                                 draw.vertexSize);
+      }
+      rEncoder.draw(draw.vertexCount, 1, 0, draw.firstInstance);
+      pPrevious = &draw;
+    }
+  }
+
+private:
+  struct _Entry {
+    uint64_t key;
+    uint32_t index;
+  };
+
+  std::vector<Draw> _draws;
+  std::vector<_Entry> _sorted;
+  // Scratch buffers of the radix sort and of the reordering
+  std::vector<_Entry> _scratch;
+  std::vector<Draw> _scratchDraws;
+  Stats _stats;
+};
@@ -0,0 +1,182 @@
+#include "FrameCapture.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace wgpu;
+
+ZFrameCapture::ZFrameCapture(Device &rDevice, ZJobSystem &rJobs,
+                             uint32_t bufferCount)
+    : _rDevice(rDevice), _rJobs(rJobs),
+      _slots(std::max(bufferCount, 1u)) {
+  _stats.bufferCount = (uint32_t)_slots.size();
+}
+
+ZFrameCapture::~ZFrameCapture() {
+  flush();
+  for (_Slot &slot : _slots) {
+    if (slot.buffer) {
+      slot.buffer.destroy();
+      slot.buffer.release();
+    }
+  }
+}
+
+int ZFrameCapture::start(const std::filesystem::path &directory,
+                         ZImageWriter::Format format) {
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cerr << "Could not create " << directory << ": " << error.message()
+              << std::endl;
+    return 1;
+  }
+  _directory = directory;
+  _format = format;
+  _nextFrame = 0;
+  _active = true;
+  return 0;
+}
+
+void ZFrameCapture::stop() { _active = false; }
+
+bool ZFrameCapture::capture(CommandEncoder &rEncoder, Texture texture,
+                            uint32_t width, uint32_t height, bool bgra) {
+  if (!_active || _pCopied) {
+    return false;
+  }
+  // Texture to buffer copies need rows aligned to 256 bytes
+  uint32_t bytesPerRow = (4 * width + 255) & ~255u;
+  _Slot *pSlot = _acquire((uint64_t)bytesPerRow * height);
+  if (!pSlot) {
+    ++_stats.dropped;
+    return false;
+  }
+
+  ImageCopyTexture source;
+  source.texture = texture;
+  source.mipLevel = 0;
+  source.origin = {0, 0, 0};
+  source.aspect = TextureAspect::All;
+
+  ImageCopyBuffer destination;
+  destination.buffer = pSlot->buffer;
+  destination.layout.offset = 0;
+  destination.layout.bytesPerRow = bytesPerRow;
+  destination.layout.rowsPerImage = height;
+
+  rEncoder.copyTextureToBuffer(source, destination, {width, height, 1});
+  pSlot->state = _State::Copied;
+  pSlot->width = width;
+  pSlot->height = height;
+  pSlot->bytesPerRow = bytesPerRow;
+  pSlot->bgra = bgra;
+  pSlot->frame = _nextFrame++;
+  _pCopied = pSlot;
+  ++_stats.captured;
+  ++_stats.buffersInFlight;
+  return true;
+}
+
+void ZFrameCapture::onSubmitted() {
+  if (nullptr == _pCopied) {
+    return;
+  }
+  _Slot &slot = *_pCopied;
+  _pCopied = nullptr;
+  // Completes once the GPU is done with the copy
+  slot.state = _State::Mapping;
+  slot.mapCallback = slot.buffer.mapAsync(
+      MapMode::Read, 0, (size_t)slot.bytesPerRow * slot.height,
+      [this, &slot](BufferMapAsyncStatus status) {
+        if (status == BufferMapAsyncStatus::Success) {
+          slot.state = _State::Mapped;
+        } else {
+          slot.state = _State::Free;
+          ++_stats.failed;
+          --_stats.buffersInFlight;
+        }
+      });
+}
+
+void ZFrameCapture::update() {
+  for (_Slot &slot : _slots) {
+    if (slot.state == _State::Mapped) {
+      // Read by the job while the buffer stays mapped, without a copy
+      const unsigned char *pPixels = static_cast<const unsigned char *>(
+          slot.buffer.getConstMappedRange(
+              0, (size_t)slot.bytesPerRow * slot.height));
+      slot.state = _State::Encoding;
+      _rJobs.run(
+          [&slot, pPixels, path = _framePath(slot.frame),
+           format = _format]() {
+            slot.result =
+                ZImageWriter::write(path, format, pPixels, slot.width,
+                                    slot.height, slot.bytesPerRow, slot.bgra);
+          },
+          &slot.encoded);
+    } else if (slot.state == _State::Encoding && slot.encoded.isDone()) {
+      slot.buffer.unmap();
+      slot.state = _State::Free;
+      if (slot.result == 0) {
+        ++_stats.written;
+      } else {
+        ++_stats.failed;
+      }
+      --_stats.buffersInFlight;
+    }
+  }
+}
+
+void ZFrameCapture::flush() {
+  if (_pCopied) {
+    // Copied but never submitted
+    _pCopied->state = _State::Free;
+    _pCopied = nullptr;
+    --_stats.buffersInFlight;
+  }
+  while (_stats.buffersInFlight > 0) {
+    for (_Slot &slot : _slots) {
+      if (slot.state == _State::Encoding) {
+        _rJobs.wait(slot.encoded);
+      }
+    }
+    _rDevice.tick();
+    update();
+  }
+}
+
+ZFrameCapture::_Slot *ZFrameCapture::_acquire(uint64_t size) {
+  for (_Slot &slot : _slots) {
+    if (slot.state != _State::Free) {
+      continue;
+    }
+    if (slot.capacity < size) {
+      if (slot.buffer) {
+        slot.buffer.destroy();
+        slot.buffer.release();
+      }
+      BufferDescriptor bufferDesc;
+      bufferDesc.label = "Frame capture";
+      bufferDesc.size = size;
+      bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+      bufferDesc.mappedAtCreation = false;
+      slot.buffer = _rDevice.createBuffer(bufferDesc);
+      slot.capacity = slot.buffer ? size : 0;
+      if (!slot.buffer) {
+        return nullptr;
+      }
+    }
+    return &slot;
+  }
+  return nullptr;
+}
+
+std::filesystem::path ZFrameCapture::_framePath(uint64_t frame) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "frame_%06llu.%s",
+                (unsigned long long)frame,
+                _format == ZImageWriter::Format::Png ? "png" : "raw");
+  return _directory / name;
+}
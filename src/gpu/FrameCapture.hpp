@@ -0,0 +1,107 @@
+#pragma once
+
+#include "ImageWriter.hpp"
+#include "JobSystem.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Records rendered frames to disk without stalling the render loop.
+ *
+ * Each captured frame is copied into one of `bufferCount` MapRead buffers
+ * with copyTextureToBuffer. After the submit, the buffer is mapped
+ * asynchronously, which completes a few frames later once the GPU is done.
+ * `update` then hands the mapped pixels to the job system, where the frames
+ * are encoded in parallel, and recycles the buffers whose frame is written.
+ *
+ * When every buffer is still being mapped or encoded, the frame is dropped
+ * and counted rather than waited for: the encoders fell behind the frame
+ * rate.
+ */
+class ZFrameCapture {
+public:
+  struct Stats {
+    // Frames copied from the GPU, and written to disk or failed to be
+    uint64_t captured = 0;
+    uint64_t written = 0;
+    uint64_t failed = 0;
+    // Frames skipped because no buffer was free
+    uint64_t dropped = 0;
+    // Buffers holding a frame not yet written
+    uint32_t buffersInFlight = 0;
+    uint32_t bufferCount = 0;
+  };
+
+public:
+  ZFrameCapture(wgpu::Device &rDevice, ZJobSystem &rJobs,
+                uint32_t bufferCount = 4);
+  ZFrameCapture(const ZFrameCapture &) = delete;
+  ZFrameCapture &operator=(const ZFrameCapture &) = delete;
+  ~ZFrameCapture();
+
+  // Write the next frames to `directory`, numbered from 0. Returns 0 on
+  // success.
+  int start(const std::filesystem::path &directory,
+            ZImageWriter::Format format);
+  // Stop capturing. The frames already copied are still written.
+  void stop();
+  bool isActive() const { return _active; }
+
+  // Record a copy of the top left `width` x `height` region of `texture`,
+  // which has 4 bytes per texel. Returns false when not capturing, or when
+  // the frame is dropped.
+  bool capture(wgpu::CommandEncoder &rEncoder, wgpu::Texture texture,
+               uint32_t width, uint32_t height, bool bgra);
+
+  // Map the buffer of this frame. To be called right after the submit.
+  void onSubmitted();
+
+  // Encode the frames mapped since the last call, and recycle the buffers
+  // of the written ones. To be called once per frame, after the device
+  // processed its callbacks.
+  void update();
+
+  // Wait until every captured frame is written
+  void flush();
+
+  const Stats &getStats() const { return _stats; }
+
+private:
+  enum class _State { Free, Copied, Mapping, Mapped, Encoding };
+
+  struct _Slot {
+    wgpu::Buffer buffer = nullptr;
+    uint64_t capacity = 0;
+    _State state = _State::Free;
+    std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bytesPerRow = 0;
+    bool bgra = false;
+    uint64_t frame = 0;
+    // Set by the encoding job
+    ZJobSystem::Counter encoded;
+    int result = 0;
+  };
+
+  // A free slot, with a buffer of at least `size` bytes, or nullptr
+  _Slot *_acquire(uint64_t size);
+  std::filesystem::path _framePath(uint64_t frame) const;
+
+private:
+  wgpu::Device &_rDevice;
+  ZJobSystem &_rJobs;
+  // Sized once, the callbacks and jobs refer to the slots
+  std::vector<_Slot> _slots;
+  // Slot copied into by the current frame
+  _Slot *_pCopied = nullptr;
+  bool _active = false;
+  std::filesystem::path _directory;
+  ZImageWriter::Format _format = ZImageWriter::Format::Png;
+  uint64_t _nextFrame = 0;
+  Stats _stats;
+};
@@ -0,0 +1,260 @@
+#include "FrameGraph.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+ZFrameGraph::ZFrameGraph(Device &rDevice, uint32_t releaseDelay,
+                         uint32_t sizeGranularity)
+    : _rDevice(rDevice), _releaseDelay(releaseDelay),
+      _sizeGranularity(std::max(sizeGranularity, 1u)) {}
+
+ZFrameGraph::~ZFrameGraph() { clear(); }
+
+ZFrameGraph::Resource ZFrameGraph::importTexture(const char *name,
+                                                 TextureView view) {
+  _Resource resource;
+  resource.name = name;
+  resource.view = view;
+  resource.imported = true;
+  _resources.push_back(std::move(resource));
+  return (Resource)_resources.size() - 1;
+}
+
+ZFrameGraph::Resource ZFrameGraph::createTexture(const char *name,
+                                                 const TextureDesc &desc) {
+  _Resource resource;
+  resource.name = name;
+  resource.desc = desc;
+  _resources.push_back(std::move(resource));
+  return (Resource)_resources.size() - 1;
+}
+
+ZFrameGraph::Pass ZFrameGraph::addPass(const char *name, Execute execute) {
+  _Pass pass;
+  pass.name = name;
+  pass.execute = std::move(execute);
+  _passes.push_back(std::move(pass));
+  return (Pass)_passes.size() - 1;
+}
+
+void ZFrameGraph::read(Pass pass, Resource resource) {
+  _passes[pass].reads.push_back(resource);
+  ++_resources[resource].readerCount;
+}
+
+void ZFrameGraph::write(Pass pass, Resource resource) {
+  _passes[pass].writes.push_back(resource);
+  ++_passes[pass].refCount;
+  _resources[resource].writers.push_back(pass);
+}
+
+void ZFrameGraph::setSideEffect(Pass pass) { _passes[pass].sideEffect = true; }
+
+int ZFrameGraph::compile() {
+  _stats.passes = (uint32_t)_passes.size();
+  _cull();
+  _computeLifetimes();
+  _compiled = _assignTextures() == 0;
+  return _compiled ? 0 : 1;
+}
+
+void ZFrameGraph::execute(CommandEncoder &rEncoder) {
+  for (_Pass &pass : _passes) {
+    if (_compiled && !pass.culled) {
+      rEncoder.pushDebugGroup(pass.name.c_str());
+      pass.execute(rEncoder);
+      rEncoder.popDebugGroup();
+    }
+  }
+
+  _passes.clear();
+  _resources.clear();
+  _compiled = false;
+  _releaseUnused();
+  ++_frame;
+}
+
+TextureView ZFrameGraph::getTextureView(Resource resource) const {
+  return _resources[resource].view;
+}
+
+Texture ZFrameGraph::getTexture(Resource resource) const {
+  return _resources[resource].texture;
+}
+
+const ZFrameGraph::TextureDesc &
+ZFrameGraph::getTextureDesc(Resource resource) const {
+  return _resources[resource].desc;
+}
+
+void ZFrameGraph::clear() {
+  for (_Physical &physical : _pool) {
+    physical.view.release();
+    physical.texture.destroy();
+    physical.texture.release();
+  }
+  _pool.clear();
+  _stats.pooledTextures = 0;
+}
+
+void ZFrameGraph::_cull() {
+  // Resources nobody reads, their writers may be culled
+  std::vector<Resource> unused;
+  for (Resource i = 0; i < _resources.size(); ++i) {
+    if (_resources[i].readerCount == 0 && !_resources[i].imported) {
+      unused.push_back(i);
+    }
+  }
+
+  _stats.culledPasses = 0;
+  while (!unused.empty()) {
+    _Resource &resource = _resources[unused.back()];
+    unused.pop_back();
+    for (Pass writer : resource.writers) {
+      _Pass &pass = _passes[writer];
+      if (--pass.refCount > 0 || pass.sideEffect || pass.culled) {
+        continue;
+      }
+      pass.culled = true;
+      ++_stats.culledPasses;
+      // What it read may no longer be needed either
+      for (Resource read : pass.reads) {
+        _Resource &readResource = _resources[read];
+        if (--readResource.readerCount == 0 && !readResource.imported) {
+          unused.push_back(read);
+        }
+      }
+    }
+  }
+}
+
+void ZFrameGraph::_computeLifetimes() {
+  for (Pass i = 0; i < _passes.size(); ++i) {
+    const _Pass &pass = _passes[i];
+    if (pass.culled) {
+      continue;
+    }
+    for (const std::vector<Resource> *pUses : {&pass.reads, &pass.writes}) {
+      for (Resource use : *pUses) {
+        _Resource &resource = _resources[use];
+        resource.firstUse = std::min(resource.firstUse, i);
+        resource.lastUse = std::max(resource.lastUse, i);
+      }
+    }
+  }
+}
+
+int ZFrameGraph::_assignTextures() {
+  for (_Physical &physical : _pool) {
+    physical.freeFrom = 0;
+    physical.used = false;
+  }
+
+  // By first use, so that a texture is handed over once its previous user
+  // is done with it
+  std::vector<Resource> transients;
+  for (Resource i = 0; i < _resources.size(); ++i) {
+    const _Resource &resource = _resources[i];
+    if (!resource.imported && resource.firstUse <= resource.lastUse) {
+      transients.push_back(i);
+    }
+  }
+  std::stable_sort(transients.begin(), transients.end(),
+                   [this](Resource a, Resource b) {
+                     return _resources[a].firstUse < _resources[b].firstUse;
+                   });
+
+  _stats.transientTextures = (uint32_t)transients.size();
+  _stats.physicalTextures = 0;
+  for (Resource i : transients) {
+    _Resource &resource = _resources[i];
+    _Physical *pPhysical = _acquirePhysical(resource.desc, resource.firstUse);
+    if (!pPhysical) {
+      std::cerr << "Could not create the texture of " << resource.name
+                << std::endl;
+      return 1;
+    }
+    if (!pPhysical->used) {
+      ++_stats.physicalTextures;
+    }
+    pPhysical->used = true;
+    pPhysical->lastUsedFrame = _frame;
+    pPhysical->freeFrom = resource.lastUse + 1;
+    resource.view = pPhysical->view;
+    resource.texture = pPhysical->texture;
+  }
+  return 0;
+}
+
+ZFrameGraph::_Physical *ZFrameGraph::_acquirePhysical(const TextureDesc &desc,
+                                                      Pass first) {
+  for (_Physical &physical : _pool) {
+    if (physical.desc.format == desc.format &&
+        physical.desc.usage == desc.usage && physical.freeFrom <= first &&
+        _fits(physical.desc.width, desc.width) &&
+        _fits(physical.desc.height, desc.height)) {
+      return &physical;
+    }
+  }
+
+  _Physical physical;
+  physical.desc = desc;
+  physical.desc.width = _roundUp(desc.width);
+  physical.desc.height = _roundUp(desc.height);
+
+  TextureDescriptor textureDesc;
+  textureDesc.dimension = TextureDimension::_2D;
+  textureDesc.format = desc.format;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.size = {physical.desc.width, physical.desc.height, 1};
+  textureDesc.usage = desc.usage;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  physical.texture = _rDevice.createTexture(textureDesc);
+  if (!physical.texture) {
+    return nullptr;
+  }
+
+  TextureViewDescriptor viewDesc;
+  viewDesc.aspect = TextureAspect::All;
+  viewDesc.baseArrayLayer = 0;
+  viewDesc.arrayLayerCount = 1;
+  viewDesc.baseMipLevel = 0;
+  viewDesc.mipLevelCount = 1;
+  viewDesc.dimension = TextureViewDimension::_2D;
+  viewDesc.format = desc.format;
+  physical.view = physical.texture.createView(viewDesc);
+
+  ++_stats.createdTextures;
+  _pool.push_back(physical);
+  _stats.pooledTextures = (uint32_t)_pool.size();
+  return &_pool.back();
+}
+
+bool ZFrameGraph::_fits(uint32_t physical, uint32_t size) const {
+  return physical >= size && physical <= _roundUp(size) + _sizeGranularity;
+}
+
+uint32_t ZFrameGraph::_roundUp(uint32_t size) const {
+  return std::max((size + _sizeGranularity - 1) / _sizeGranularity, 1u) *
+         _sizeGranularity;
+}
+
+void ZFrameGraph::_releaseUnused() {
+  size_t kept = 0;
+  for (size_t i = 0; i < _pool.size(); ++i) {
+    _Physical &physical = _pool[i];
+    if (_frame - physical.lastUsedFrame > _releaseDelay) {
+      physical.view.release();
+      physical.texture.destroy();
+      physical.texture.release();
+    } else {
+      _pool[kept++] = physical;
+    }
+  }
+  _pool.resize(kept);
+  _stats.pooledTextures = (uint32_t)_pool.size();
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Passes of a frame, declared with the textures they read and write.
+ *
+ * The graph is built again every frame: textures are either imported (e.g.
+ * the swap chain view) or transient, created by the graph for the frame.
+ * `compile` then
+ *  - culls the passes whose results are never used: a pass is kept if it
+ *    writes an imported texture, is flagged with `setSideEffect`, or writes
+ *    a texture read by a kept pass;
+ *  - computes the lifetime of each transient texture, from the first to the
+ *    last kept pass that uses it;
+ *  - assigns the transient textures to physical ones. WebGPU has no memory
+ *    aliasing, so textures with the same description and disjoint lifetimes
+ *    share the same GPU texture instead.
+ * `execute` runs the kept passes in declaration order.
+ *
+ * Physical textures are kept from frame to frame, and released when unused
+ * for `releaseDelay` frames. Their size is rounded up to a multiple of
+ * `sizeGranularity`, and a texture may serve any request it is large
+ * enough for, up to one step larger than its rounded size: passes render
+ * into the requested top left region with a viewport, and a window that
+ * is resized only reallocates its targets when it outgrows them, or
+ * shrinks by more than a step.
+ */
+class ZFrameGraph {
+public:
+  using Resource = uint32_t;
+  using Pass = uint32_t;
+  static constexpr Resource InvalidResource = 0xFFFFFFFF;
+
+  struct TextureDesc {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    WGPUTextureFormat format = WGPUTextureFormat_Undefined;
+    WGPUTextureUsageFlags usage = WGPUTextureUsage_RenderAttachment;
+
+    bool operator==(const TextureDesc &other) const = default;
+  };
+
+  // Called by `execute`, textures are resolved with `getTextureView`
+  using Execute = std::function<void(wgpu::CommandEncoder &rEncoder)>;
+
+  struct Stats {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    // Transient textures used by kept passes this frame
+    uint32_t transientTextures = 0;
+    // GPU textures they were assigned to
+    uint32_t physicalTextures = 0;
+    // GPU textures alive in the pool, and created since the start
+    uint32_t pooledTextures = 0;
+    uint64_t createdTextures = 0;
+  };
+
+public:
+  ZFrameGraph(wgpu::Device &rDevice, uint32_t releaseDelay = 3,
+              uint32_t sizeGranularity = 256);
+  ZFrameGraph(const ZFrameGraph &) = delete;
+  ZFrameGraph &operator=(const ZFrameGraph &) = delete;
+  ~ZFrameGraph();
+
+  Resource importTexture(const char *name, wgpu::TextureView view);
+  Resource createTexture(const char *name, const TextureDesc &desc);
+
+  Pass addPass(const char *name, Execute execute);
+  void read(Pass pass, Resource resource);
+  void write(Pass pass, Resource resource);
+  // Keep the pass even if nothing uses what it writes
+  void setSideEffect(Pass pass);
+
+  // Cull, compute lifetimes and assign the transient textures. Returns 0 on
+  // success.
+  int compile();
+  // Run the kept passes, then forget the passes and resources of the frame.
+  // Runs nothing if the compilation failed, but still resets the graph.
+  void execute(wgpu::CommandEncoder &rEncoder);
+
+  // View of a texture, valid from `compile` until the end of `execute`
+  wgpu::TextureView getTextureView(Resource resource) const;
+  // Texture of a transient resource, for copies, with the same lifetime.
+  // Null for imported ones.
+  wgpu::Texture getTexture(Resource resource) const;
+  // Description of a transient texture, with the size requested. The
+  // texture itself may be larger.
+  const TextureDesc &getTextureDesc(Resource resource) const;
+
+  // Release every pooled texture
+  void clear();
+
+  const Stats &getStats() const { return _stats; }
+
+private:
+  struct _Resource {
+    std::string name;
+    TextureDesc desc;
+    // Set for imported textures, and for transient ones once assigned
+    wgpu::TextureView view = nullptr;
+    wgpu::Texture texture = nullptr;
+    bool imported = false;
+    std::vector<Pass> writers;
+    uint32_t readerCount = 0;
+    // Kept passes using it, in declaration order
+    Pass firstUse = 0xFFFFFFFF;
+    Pass lastUse = 0;
+  };
+
+  struct _Pass {
+    std::string name;
+    Execute execute;
+    std::vector<Resource> reads;
+    std::vector<Resource> writes;
+    bool sideEffect = false;
+    // Written resources still needed, culled at zero
+    uint32_t refCount = 0;
+    bool culled = false;
+  };
+
+  struct _Physical {
+    // With the rounded size
+    TextureDesc desc;
+    wgpu::Texture texture = nullptr;
+    wgpu::TextureView view = nullptr;
+    uint64_t lastUsedFrame = 0;
+    // First pass of this frame from which it is free
+    Pass freeFrom = 0;
+    bool used = false;
+  };
+
+  void _cull();
+  void _computeLifetimes();
+  int _assignTextures();
+  // Pool entry for a texture used from pass `first` on, created if needed
+  _Physical *_acquirePhysical(const TextureDesc &desc, Pass first);
+  // Whether `physical` can serve a request of `size`
+  bool _fits(uint32_t physical, uint32_t size) const;
+  uint32_t _roundUp(uint32_t size) const;
+  void _releaseUnused();
+
+private:
+  wgpu::Device &_rDevice;
+  uint32_t _releaseDelay;
+  uint32_t _sizeGranularity;
+  uint64_t _frame = 0;
+  bool _compiled = false;
+  std::vector<_Resource> _resources;
+  std::vector<_Pass> _passes;
+  std::vector<_Physical> _pool;
+  Stats _stats;
+};
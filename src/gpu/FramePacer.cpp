@@ -0,0 +1,74 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+// Weight of the newest sample in the latency average
+static constexpr double LatencySmoothing = 0.1;
+
+static double toMs(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+ZFramePacer::ZFramePacer() : ZFramePacer(Settings{}) {}
+
+ZFramePacer::ZFramePacer(const Settings &settings)
+    : _settings(settings), _frameStart(_Clock::now()) {}
+
+void ZFramePacer::beginFrame() {
+  TimePoint now = _Clock::now();
+  _stats.waitMs = 0.0;
+  if (_settings.targetFps > 0.0) {
+    auto interval = std::chrono::duration_cast<_Clock::duration>(
+        std::chrono::duration<double>(1.0 / _settings.targetFps));
+    TimePoint deadline = _frameStart + interval;
+    auto spin = std::chrono::duration_cast<_Clock::duration>(
+        std::chrono::duration<double, std::milli>(_settings.spinMs));
+    TimePoint waitStart = now;
+    if (deadline - now > spin) {
+      std::this_thread::sleep_for(deadline - now - spin);
+    }
+    while ((now = _Clock::now()) < deadline) {
+      std::this_thread::yield();
+    }
+    _stats.waitMs = toMs(now - waitStart);
+  }
+  _stats.frameMs = toMs(now - _frameStart);
+  _frameStart = now;
+}
+
+void ZFramePacer::onInput() {
+  if (!_hasPendingInput) {
+    _pendingInput = _Clock::now();
+    _hasPendingInput = true;
+  }
+}
+
+bool ZFramePacer::takeInput(TimePoint &rInputTime) {
+  if (!_hasPendingInput) {
+    return false;
+  }
+  rInputTime = _pendingInput;
+  _hasPendingInput = false;
+  return true;
+}
+
+void ZFramePacer::addLatencySample(double latencyMs) {
+  _stats.lastLatencyMs = latencyMs;
+  _stats.maxLatencyMs = std::max(_stats.maxLatencyMs, latencyMs);
+  _stats.averageLatencyMs =
+      _stats.latencySamples == 0
+          ? latencyMs
+          : _stats.averageLatencyMs +
+                LatencySmoothing * (latencyMs - _stats.averageLatencyMs);
+  ++_stats.latencySamples;
+}
+
+double ZFramePacer::msSince(TimePoint time) {
+  return toMs(_Clock::now() - time);
+}
+
+void ZFramePacer::resetLatency() {
+  _stats.maxLatencyMs = 0.0;
+  _stats.latencySamples = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Paces frames on the CPU and measures input-to-present latency.
+ *
+ * The limiter holds each frame until `1 / targetFps` after the start of the
+ * previous one. It sleeps for most of the wait and spins for the last
+ * `spinMs`, as sleeps overshoot by up to a scheduler quantum. It is meant
+ * for the present modes that do not wait for vblank (Mailbox, Immediate).
+ *
+ * Input events are stamped by `onInput` when the window system delivers
+ * them; the latency of a frame is the time from the oldest event it
+ * consumed to the return of present. Frames are presented by the render
+ * thread, so the frame carries the stamp from `takeInput` and the latency
+ * measured there comes back through `addLatencySample`. Time spent queued
+ * in the OS or in the swap chain after present is not seen.
+ */
+class ZFramePacer {
+public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  struct Settings {
+    // 0 disables the limiter
+    double targetFps = 0.0;
+    double spinMs = 1.5;
+  };
+
+  struct Stats {
+    // Time between the last two frame starts
+    double frameMs = 0.0;
+    // Time the limiter held the last frame
+    double waitMs = 0.0;
+    double lastLatencyMs = 0.0;
+    // Exponential moving average, as latency drifts with the load
+    double averageLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+    uint64_t latencySamples = 0;
+  };
+
+public:
+  ZFramePacer();
+  explicit ZFramePacer(const Settings &settings);
+
+  // Wait for the frame slot if the limiter is on, then start the frame. To
+  // be called before polling the events of the frame.
+  void beginFrame();
+
+  // Stamp an input event. To be called from the input callbacks.
+  void onInput();
+
+  // Hand the oldest input not yet consumed to the frame being built.
+  // Returns false if there was none.
+  bool takeInput(TimePoint &rInputTime);
+
+  // Latency of a frame, measured right after its present
+  void addLatencySample(double latencyMs);
+
+  static double msSince(TimePoint time);
+
+  // Forget the worst latency seen, e.g. after a change of present mode
+  void resetLatency();
+
+  Settings &getSettings() { return _settings; }
+  const Stats &getStats() const { return _stats; }
+
+private:
+  using _Clock = std::chrono::steady_clock;
+
+private:
+  Settings _settings;
+  TimePoint _frameStart;
+  // Oldest input not yet consumed by a frame
+  TimePoint _pendingInput;
+  bool _hasPendingInput = false;
+  Stats _stats;
+};
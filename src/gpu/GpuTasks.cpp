@@ -0,0 +1,101 @@
+#include "GpuTasks.hpp"
+
+#include <iostream>
+
+using namespace wgpu;
+
+ZGpuTasks::Operation<BufferMapAsyncStatus>
+ZGpuTasks::mapAsync(ZTaskExecutor &rExecutor, Buffer buffer,
+                    MapModeFlags mode, size_t offset, size_t size) {
+  using Op = Operation<BufferMapAsyncStatus>;
+  return Op(rExecutor, [=](Op &rOperation) mutable {
+    BufferMapCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPUBufferMapAsyncStatus status,
+                               void *pUserData) {
+      static_cast<Op *>(pUserData)->complete(status);
+    };
+    callbackInfo.userdata = &rOperation;
+    buffer.mapAsyncF(mode, offset, size, callbackInfo);
+  });
+}
+
+ZGpuTasks::Operation<QueueWorkDoneStatus>
+ZGpuTasks::onSubmittedWorkDone(ZTaskExecutor &rExecutor, Queue queue) {
+  using Op = Operation<QueueWorkDoneStatus>;
+  return Op(rExecutor, [=](Op &rOperation) mutable {
+    QueueWorkDoneCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPUQueueWorkDoneStatus status,
+                               void *pUserData) {
+      static_cast<Op *>(pUserData)->complete(status);
+    };
+    callbackInfo.userdata = &rOperation;
+    queue.onSubmittedWorkDoneF(callbackInfo);
+  });
+}
+
+ZGpuTasks::Operation<RenderPipeline> ZGpuTasks::createRenderPipelineAsync(
+    ZTaskExecutor &rExecutor, Device device,
+    const RenderPipelineDescriptor &descriptor) {
+  using Op = Operation<RenderPipeline>;
+  return Op(rExecutor, [=, &descriptor](Op &rOperation) mutable {
+    CreateRenderPipelineAsyncCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPUCreatePipelineAsyncStatus status,
+                               WGPURenderPipeline pipeline,
+                               char const *message, void *pUserData) {
+      if (status != WGPUCreatePipelineAsyncStatus_Success && message) {
+        std::cerr << "Pipeline creation failed: " << message << std::endl;
+      }
+      static_cast<Op *>(pUserData)->complete(pipeline);
+    };
+    callbackInfo.userdata = &rOperation;
+    device.createRenderPipelineAsyncF(descriptor, callbackInfo);
+  });
+}
+
+ZGpuTasks::Operation<Adapter>
+ZGpuTasks::requestAdapter(ZTaskExecutor &rExecutor, Instance instance,
+                          const RequestAdapterOptions &options) {
+  using Op = Operation<Adapter>;
+  return Op(rExecutor, [=, &options](Op &rOperation) mutable {
+    RequestAdapterCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPURequestAdapterStatus status,
+                               WGPUAdapter adapter, char const *message,
+                               void *pUserData) {
+      if (status != WGPURequestAdapterStatus_Success && message) {
+        std::cerr << "Adapter request failed: " << message << std::endl;
+      }
+      static_cast<Op *>(pUserData)->complete(adapter);
+    };
+    callbackInfo.userdata = &rOperation;
+    instance.requestAdapterF(options, callbackInfo);
+  });
+}
+
+ZGpuTasks::Operation<Device>
+ZGpuTasks::requestDevice(ZTaskExecutor &rExecutor, Adapter adapter,
+                         const DeviceDescriptor &descriptor) {
+  using Op = Operation<Device>;
+  return Op(rExecutor, [=, &descriptor](Op &rOperation) mutable {
+    RequestDeviceCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPURequestDeviceStatus status,
+                               WGPUDevice device, char const *message,
+                               void *pUserData) {
+      if (status != WGPURequestDeviceStatus_Success && message) {
+        std::cerr << "Device request failed: " << message << std::endl;
+      }
+      static_cast<Op *>(pUserData)->complete(device);
+    };
+    callbackInfo.userdata = &rOperation;
+    adapter.requestDeviceF(descriptor, callbackInfo);
+  });
+}
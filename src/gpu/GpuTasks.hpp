@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Task.hpp"
+
+#include <coroutine>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Asynchronous WebGPU operations to co_await in a ZTask.
+ *
+ * The operations are started with CallbackMode::AllowProcessEvents when
+ * awaited, so their callbacks only run from instance.processEvents, which
+ * the pump of the executor calls. The callback stores the result and posts
+ * the coroutine, which resumes later in the same poll, outside of WebGPU.
+ * An operation is to be awaited from the owner thread of the executor, and
+ * the descriptors it is given must live until then:
+ *
+ *   BufferMapAsyncStatus status =
+ *       co_await ZGpuTasks::mapAsync(executor, buffer, MapMode::Read, 0, size);
+ *
+ * Failed requests return a null object, after logging their message.
+ */
+class ZGpuTasks {
+public:
+  template <typename Result> class Operation {
+  public:
+    using Start = std::function<void(Operation &)>;
+
+    Operation(ZTaskExecutor &rExecutor, Start start)
+        : _rExecutor(rExecutor), _start(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      // The callback gets the address of the operation, which stays put in
+      // the frame of the coroutine from here on
+      _handle = handle;
+      _start(*this);
+    }
+    Result await_resume() { return std::move(*_result); }
+
+    // Called by the callback of the operation
+    void complete(Result result) {
+      _result = std::move(result);
+      _rExecutor.post(_handle);
+    }
+
+  private:
+    ZTaskExecutor &_rExecutor;
+    Start _start;
+    std::coroutine_handle<> _handle;
+    // WebGPU enums have no default value
+    std::optional<Result> _result;
+  };
+
+public:
+  static Operation<wgpu::BufferMapAsyncStatus>
+  mapAsync(ZTaskExecutor &rExecutor, wgpu::Buffer buffer,
+           wgpu::MapModeFlags mode, size_t offset, size_t size);
+
+  static Operation<wgpu::QueueWorkDoneStatus>
+  onSubmittedWorkDone(ZTaskExecutor &rExecutor, wgpu::Queue queue);
+
+  static Operation<wgpu::RenderPipeline>
+  createRenderPipelineAsync(ZTaskExecutor &rExecutor, wgpu::Device device,
+                            const wgpu::RenderPipelineDescriptor &descriptor);
+
+  static Operation<wgpu::Adapter>
+  requestAdapter(ZTaskExecutor &rExecutor, wgpu::Instance instance,
+                 const wgpu::RequestAdapterOptions &options);
+
+  static Operation<wgpu::Device>
+  requestDevice(ZTaskExecutor &rExecutor, wgpu::Adapter adapter,
+                const wgpu::DeviceDescriptor &descriptor);
+};
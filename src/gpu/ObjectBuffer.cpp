@@ -0,0 +1,97 @@
+#include "ObjectBuffer.hpp"
+#include "StagingRing.hpp"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+ZObjectBuffer::ZObjectBuffer(Device &rDevice, uint32_t capacity)
+    : _rDevice(rDevice), _capacity(capacity) {}
+
+ZObjectBuffer::~ZObjectBuffer() {
+  if (_buffer) {
+    _buffer.destroy();
+    _buffer.release();
+  }
+}
+
+int ZObjectBuffer::init() {
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = getBufferSize();
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+  bufferDesc.mappedAtCreation = false;
+  _buffer = _rDevice.createBuffer(bufferDesc);
+  return _buffer ? 0 : 1;
+}
+
+uint32_t ZObjectBuffer::add(const glm::mat4x4 &modelMatrix,
+                            const glm::vec4 &color, uint32_t materialId) {
+  uint32_t objectId;
+  if (!_freeObjects.empty()) {
+    objectId = _freeObjects.back();
+    _freeObjects.pop_back();
+  } else if (_objects.size() < _capacity) {
+    objectId = (uint32_t)_objects.size();
+    _objects.emplace_back();
+    _dirty.push_back(false);
+  } else {
+    return InvalidObject;
+  }
+
+  _objects[objectId].color = color;
+  _objects[objectId].materialId = materialId;
+  setModelMatrix(objectId, modelMatrix);
+  return objectId;
+}
+
+void ZObjectBuffer::remove(uint32_t objectId) {
+  // The record stays in the buffer until its index is reused
+  _freeObjects.push_back(objectId);
+}
+
+void ZObjectBuffer::setModelMatrix(uint32_t objectId,
+                                   const glm::mat4x4 &modelMatrix) {
+  ObjectData &object = _objects[objectId];
+  object.modelMatrix = modelMatrix;
+  object.normalMatrix = glm::transpose(glm::inverse(modelMatrix));
+  _markDirty(objectId);
+}
+
+void ZObjectBuffer::setColor(uint32_t objectId, const glm::vec4 &color) {
+  _objects[objectId].color = color;
+  _markDirty(objectId);
+}
+
+void ZObjectBuffer::setMaterial(uint32_t objectId, uint32_t materialId) {
+  _objects[objectId].materialId = materialId;
+  _markDirty(objectId);
+}
+
+void ZObjectBuffer::flush(CommandEncoder &rEncoder, ZStagingRing &rRing) {
+  std::sort(_dirtyObjects.begin(), _dirtyObjects.end());
+  size_t i = 0;
+  while (i < _dirtyObjects.size()) {
+    // Extend the run over consecutive records
+    size_t end = i + 1;
+    while (end < _dirtyObjects.size() &&
+           _dirtyObjects[end] == _dirtyObjects[end - 1] + 1) {
+      ++end;
+    }
+    uint32_t first = _dirtyObjects[i];
+    rRing.write(rEncoder, _buffer, (uint64_t)first * sizeof(ObjectData),
+                &_objects[first], (end - i) * sizeof(ObjectData));
+    i = end;
+  }
+
+  for (uint32_t objectId : _dirtyObjects) {
+    _dirty[objectId] = false;
+  }
+  _dirtyObjects.clear();
+}
+
+void ZObjectBuffer::_markDirty(uint32_t objectId) {
+  if (!_dirty[objectId]) {
+    _dirty[objectId] = true;
+    _dirtyObjects.push_back(objectId);
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class ZStagingRing;
+
+/**
+ * Storage buffer of the per-object data of the scene.
+ *
+ * Each object owns one record, bound once per frame and indexed in the
+ * vertex shader by `instance_index`: objects are drawn with their index as
+ * `firstInstance`, so no per-draw uniform write or bind group switch is
+ * needed. Changed records are uploaded by `flush`, contiguous ones in a
+ * single copy.
+ */
+class ZObjectBuffer {
+public:
+  /**
+   * One record of the buffer, replicated in the shader as `ObjectData`
+   */
+  struct ObjectData {
+    glm::mat4x4 modelMatrix = glm::mat4x4(1.0f);
+    // Inverse transpose of the model matrix, for the normals
+    glm::mat4x4 normalMatrix = glm::mat4x4(1.0f);
+    glm::vec4 color = glm::vec4(1.0f);
+    // Entry of the texture packer's material buffer to sample
+    uint32_t materialId = 0;
+    uint32_t _pad[3] = {};
+  };
+  static_assert(sizeof(ObjectData) % 16 == 0);
+
+  static constexpr uint32_t InvalidObject = 0xFFFFFFFF;
+
+public:
+  ZObjectBuffer(wgpu::Device &rDevice, uint32_t capacity = 1024);
+  ~ZObjectBuffer();
+
+  int init();
+
+  // Add an object, returns its index or InvalidObject when the buffer is
+  // full
+  uint32_t add(const glm::mat4x4 &modelMatrix, const glm::vec4 &color,
+               uint32_t materialId);
+  void remove(uint32_t objectId);
+
+  void setModelMatrix(uint32_t objectId, const glm::mat4x4 &modelMatrix);
+  void setColor(uint32_t objectId, const glm::vec4 &color);
+  void setMaterial(uint32_t objectId, uint32_t materialId);
+  const ObjectData &get(uint32_t objectId) const { return _objects[objectId]; }
+
+  // Record the upload of the changed records in `rEncoder`. To be called once
+  // per frame, between the beginFrame and endFrame of the ring.
+  void flush(wgpu::CommandEncoder &rEncoder, ZStagingRing &rRing);
+
+  wgpu::Buffer getBuffer() const { return _buffer; }
+  uint64_t getBufferSize() const {
+    return (uint64_t)_capacity * sizeof(ObjectData);
+  }
+  uint32_t getCapacity() const { return _capacity; }
+
+private:
+  void _markDirty(uint32_t objectId);
+
+private:
+  wgpu::Device &_rDevice;
+  uint32_t _capacity;
+  wgpu::Buffer _buffer = nullptr;
+  std::vector<ObjectData> _objects;
+  std::vector<uint32_t> _freeObjects;
+  // Records changed since the last flush, and whether they are listed
+  std::vector<uint32_t> _dirtyObjects;
+  std::vector<bool> _dirty;
+};
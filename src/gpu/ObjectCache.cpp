@@ -0,0 +1,187 @@
+#include "ObjectCache.hpp"
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+using namespace wgpu;
+
+// Boost style hash combination
+static void hashCombine(size_t &seed, size_t value) {
+  seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Samplers
+
+ZSamplerKey::ZSamplerKey(const SamplerDescriptor &desc)
+    : addressModeU(desc.addressModeU), addressModeV(desc.addressModeV),
+      addressModeW(desc.addressModeW), magFilter(desc.magFilter),
+      minFilter(desc.minFilter), mipmapFilter(desc.mipmapFilter),
+      lodMinClamp(desc.lodMinClamp), lodMaxClamp(desc.lodMaxClamp),
+      compare(desc.compare), maxAnisotropy(desc.maxAnisotropy) {}
+
+bool ZSamplerKey::operator==(const ZSamplerKey &other) const {
+  // The enum wrappers only compare through their raw values
+  return (WGPUAddressMode)addressModeU == other.addressModeU &&
+         (WGPUAddressMode)addressModeV == other.addressModeV &&
+         (WGPUAddressMode)addressModeW == other.addressModeW &&
+         (WGPUFilterMode)magFilter == other.magFilter &&
+         (WGPUFilterMode)minFilter == other.minFilter &&
+         (WGPUMipmapFilterMode)mipmapFilter == other.mipmapFilter &&
+         lodMinClamp == other.lodMinClamp && lodMaxClamp == other.lodMaxClamp &&
+         (WGPUCompareFunction)compare == other.compare &&
+         maxAnisotropy == other.maxAnisotropy;
+}
+
+size_t ZSamplerKey::Hash::operator()(const ZSamplerKey &key) const {
+  size_t seed = 0;
+  hashCombine(seed, (WGPUAddressMode)key.addressModeU);
+  hashCombine(seed, (WGPUAddressMode)key.addressModeV);
+  hashCombine(seed, (WGPUAddressMode)key.addressModeW);
+  hashCombine(seed, (WGPUFilterMode)key.magFilter);
+  hashCombine(seed, (WGPUFilterMode)key.minFilter);
+  hashCombine(seed, (WGPUMipmapFilterMode)key.mipmapFilter);
+  hashCombine(seed, std::bit_cast<uint32_t>(key.lodMinClamp));
+  hashCombine(seed, std::bit_cast<uint32_t>(key.lodMaxClamp));
+  hashCombine(seed, (WGPUCompareFunction)key.compare);
+  hashCombine(seed, key.maxAnisotropy);
+  return seed;
+}
+
+Sampler ZSamplerCache::_create(const ZSamplerKey &key) {
+  SamplerDescriptor samplerDesc;
+  samplerDesc.addressModeU = key.addressModeU;
+  samplerDesc.addressModeV = key.addressModeV;
+  samplerDesc.addressModeW = key.addressModeW;
+  samplerDesc.magFilter = key.magFilter;
+  samplerDesc.minFilter = key.minFilter;
+  samplerDesc.mipmapFilter = key.mipmapFilter;
+  samplerDesc.lodMinClamp = key.lodMinClamp;
+  samplerDesc.lodMaxClamp = key.lodMaxClamp;
+  samplerDesc.compare = key.compare;
+  samplerDesc.maxAnisotropy = key.maxAnisotropy;
+  return _rDevice.createSampler(samplerDesc);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bind groups
+
+ZBindGroupKey::ZBindGroupKey(const BindGroupDescriptor &desc)
+    : layout(desc.layout) {
+  entries.reserve(desc.entryCount);
+  for (size_t i = 0; i < desc.entryCount; ++i) {
+    const WGPUBindGroupEntry &entry = desc.entries[i];
+    entries.push_back({entry.binding, entry.buffer, entry.offset, entry.size,
+                       entry.sampler, entry.textureView});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.binding < b.binding; });
+}
+
+size_t ZBindGroupKey::Hash::operator()(const ZBindGroupKey &key) const {
+  std::hash<const void *> hashPtr;
+  size_t seed = hashPtr(key.layout);
+  for (const Entry &entry : key.entries) {
+    hashCombine(seed, entry.binding);
+    hashCombine(seed, hashPtr(entry.buffer));
+    hashCombine(seed, entry.offset);
+    hashCombine(seed, entry.size);
+    hashCombine(seed, hashPtr(entry.sampler));
+    hashCombine(seed, hashPtr(entry.textureView));
+  }
+  return seed;
+}
+
+BindGroup ZBindGroupCache::_create(const ZBindGroupKey &key) {
+  std::vector<BindGroupEntry> bindings(key.entries.size());
+  for (size_t i = 0; i < key.entries.size(); ++i) {
+    const ZBindGroupKey::Entry &entry = key.entries[i];
+    bindings[i].binding = entry.binding;
+    bindings[i].buffer = entry.buffer;
+    bindings[i].offset = entry.offset;
+    bindings[i].size = entry.size;
+    bindings[i].sampler = entry.sampler;
+    bindings[i].textureView = entry.textureView;
+  }
+
+  BindGroupDescriptor bindGroupDesc;
+  bindGroupDesc.layout = key.layout;
+  bindGroupDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupDesc.entries = bindings.data();
+  return _rDevice.createBindGroup(bindGroupDesc);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render bundles
+
+size_t ZRenderBundleKey::Hash::operator()(const ZRenderBundleKey &key) const {
+  std::hash<const void *> hashPtr;
+  size_t seed = key.colorFormat;
+  hashCombine(seed, key.depthStencilFormat);
+  hashCombine(seed, key.stencilReadOnly);
+  for (const ZDrawList::Draw &draw : key.draws) {
+    hashCombine(seed, hashPtr(draw.pipeline));
+    hashCombine(seed, hashPtr(draw.bindGroup));
+    hashCombine(seed, hashPtr(draw.materialBindGroup));
+    hashCombine(seed, draw.materialOffset);
+    hashCombine(seed, hashPtr(draw.vertexBuffer));
+    hashCombine(seed, draw.vertexOffset);
+    hashCombine(seed, draw.vertexSize);
+    hashCombine(seed, draw.vertexCount);
+    hashCombine(seed, draw.firstInstance);
+  }
+  return seed;
+}
+
+uint32_t ZRenderBundleCache::acquire(const std::vector<ZRenderBundleKey> &keys,
+                                     std::vector<RenderBundle> &rBundles,
+                                     ZJobSystem *pJobs) {
+  rBundles.assign(keys.size(), nullptr);
+  std::vector<uint32_t> misses;
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    rBundles[i] = _find(keys[i]);
+    if (!rBundles[i]) {
+      misses.push_back(i);
+    }
+  }
+
+  // Bundle encoders are independent, the missing bundles are recorded in
+  // parallel and only added to the cache afterwards
+  auto recordRange = [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      rBundles[misses[i]] = _create(keys[misses[i]]);
+    }
+  };
+  if (pJobs && misses.size() > 1) {
+    pJobs->parallelFor((uint32_t)misses.size(), 1, recordRange);
+  } else {
+    recordRange(0, (uint32_t)misses.size());
+  }
+  for (uint32_t i : misses) {
+    rBundles[i] = _insert(keys[i], rBundles[i]);
+  }
+  return (uint32_t)misses.size();
+}
+
+RenderBundle ZRenderBundleCache::_create(const ZRenderBundleKey &key) {
+  RenderBundleEncoderDescriptor bundleEncoderDesc;
+  bundleEncoderDesc.label = "Scene bundle encoder";
+  bundleEncoderDesc.colorFormatCount = 1;
+  bundleEncoderDesc.colorFormats = &key.colorFormat;
+  bundleEncoderDesc.depthStencilFormat = key.depthStencilFormat;
+  bundleEncoderDesc.sampleCount = 1;
+  bundleEncoderDesc.depthReadOnly = false;
+  bundleEncoderDesc.stencilReadOnly = key.stencilReadOnly;
+  RenderBundleEncoder bundleEncoder =
+      _rDevice.createRenderBundleEncoder(bundleEncoderDesc);
+
+  ZDrawList::encode(bundleEncoder, key.draws.data(), key.draws.size());
+
+  RenderBundleDescriptor bundleDesc;
+  bundleDesc.label = "Scene bundle";
+  RenderBundle bundle = bundleEncoder.finish(bundleDesc);
+  bundleEncoder.release();
+  return bundle;
+}
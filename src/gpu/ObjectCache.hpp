@@ -0,0 +1,299 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+#include "DrawList.hpp"
+
+class ZJobSystem;
+
+/**
+ * Deduplicates GPU objects created from identical descriptors.
+ *
+ * `acquire` hashes the content of a descriptor and returns the existing
+ * object when one was already created for it, adding a reference. `release`
+ * drops a reference; objects that reach zero references are kept for
+ * `releaseDelay` frames (so that materials that come and go do not recreate
+ * them, and so that the GPU is done with them) before being released for
+ * good by `endFrame`.
+ *
+ * `Key` holds the hashable content of a descriptor, `Handle` is the wgpu
+ * handle type. Concrete caches provide `_create`.
+ */
+template <typename Key, typename Handle> class ZObjectCache {
+public:
+  struct Stats {
+    // Objects alive in the cache, referenced or waiting for release
+    size_t objectCount = 0;
+    // acquire calls that returned an existing object
+    uint64_t hits = 0;
+    // acquire calls that had to create an object
+    uint64_t misses = 0;
+    // Objects checked by endFrame for release
+    size_t unusedCount = 0;
+  };
+
+public:
+  ZObjectCache(wgpu::Device &rDevice, uint32_t releaseDelay)
+      : _rDevice(rDevice), _releaseDelay(releaseDelay) {}
+  ZObjectCache(const ZObjectCache &) = delete;
+  ZObjectCache &operator=(const ZObjectCache &) = delete;
+  virtual ~ZObjectCache() { clear(); }
+
+  // Drop a reference to an object returned by `acquire`
+  void release(Handle handle) {
+    auto it = _keys.find(handle);
+    if (it == _keys.end()) {
+      return;
+    }
+    _Entry &entry = _entries.at(it->second);
+    if (entry.refCount > 0 && --entry.refCount == 0) {
+      entry.unusedSince = _frame;
+      // Listed once, however often it is acquired and released again
+      if (!entry.inUnused) {
+        entry.inUnused = true;
+        _unused.push_back(it->second);
+      }
+    }
+  }
+
+  // Release the objects that have not been referenced for `releaseDelay`
+  // frames. To be called once per frame.
+  void endFrame() {
+    ++_frame;
+    size_t kept = 0;
+    for (size_t i = 0; i < _unused.size(); ++i) {
+      auto it = _entries.find(_unused[i]);
+      if (it == _entries.end()) {
+        continue;
+      }
+      if (it->second.refCount > 0) {
+        // Acquired again in the meantime, listed again by its next release
+        it->second.inUnused = false;
+        continue;
+      }
+      if (_frame - it->second.unusedSince > _releaseDelay) {
+        _keys.erase(it->second.handle);
+        it->second.handle.release();
+        _entries.erase(it);
+      } else {
+        _unused[kept++] = _unused[i];
+      }
+    }
+    _unused.resize(kept);
+  }
+
+  // Release every object, referenced or not
+  void clear() {
+    for (auto &[key, entry] : _entries) {
+      entry.handle.release();
+    }
+    _entries.clear();
+    _keys.clear();
+    _unused.clear();
+  }
+
+  Stats getStats() const {
+    Stats stats = _stats;
+    stats.objectCount = _entries.size();
+    stats.unusedCount = _unused.size();
+    return stats;
+  }
+
+protected:
+  Handle _acquire(const Key &key) {
+    Handle handle = _find(key);
+    if (handle) {
+      return handle;
+    }
+    return _insert(key, _create(key));
+  }
+
+  // The existing object for `key` with a reference added, or null
+  Handle _find(const Key &key) {
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+      return nullptr;
+    }
+    ++it->second.refCount;
+    ++_stats.hits;
+    return it->second.handle;
+  }
+
+  // Take ownership of `handle`, created for `key` outside of `_acquire`,
+  // with one reference
+  Handle _insert(const Key &key, Handle handle) {
+    if (!handle) {
+      return nullptr;
+    }
+    ++_stats.misses;
+    _entries.emplace(key, _Entry{handle, 1, 0, false});
+    _keys.emplace(handle, key);
+    return handle;
+  }
+
+  virtual Handle _create(const Key &key) = 0;
+
+protected:
+  wgpu::Device &_rDevice;
+
+private:
+  struct _Entry {
+    Handle handle;
+    uint32_t refCount;
+    uint64_t unusedSince;
+    // Whether the key is in `_unused`
+    bool inUnused;
+  };
+
+  struct _HandleHash {
+    size_t operator()(const Handle &handle) const {
+      return std::hash<const void *>()(
+          static_cast<const typename Handle::W &>(handle));
+    }
+  };
+
+  uint32_t _releaseDelay;
+  uint64_t _frame = 0;
+  std::unordered_map<Key, _Entry, typename Key::Hash> _entries;
+  std::unordered_map<Handle, Key, _HandleHash> _keys;
+  // Keys whose reference count dropped to zero, candidates for release,
+  // each listed once
+  std::vector<Key> _unused;
+  Stats _stats;
+};
+
+/**
+ * Hashable content of a SamplerDescriptor (the label is ignored)
+ */
+struct ZSamplerKey {
+  wgpu::AddressMode addressModeU = wgpu::AddressMode::ClampToEdge;
+  wgpu::AddressMode addressModeV = wgpu::AddressMode::ClampToEdge;
+  wgpu::AddressMode addressModeW = wgpu::AddressMode::ClampToEdge;
+  wgpu::FilterMode magFilter = wgpu::FilterMode::Nearest;
+  wgpu::FilterMode minFilter = wgpu::FilterMode::Nearest;
+  wgpu::MipmapFilterMode mipmapFilter = wgpu::MipmapFilterMode::Nearest;
+  float lodMinClamp = 0.0f;
+  float lodMaxClamp = 32.0f;
+  wgpu::CompareFunction compare = wgpu::CompareFunction::Undefined;
+  uint16_t maxAnisotropy = 1;
+
+  ZSamplerKey() = default;
+  explicit ZSamplerKey(const wgpu::SamplerDescriptor &desc);
+  bool operator==(const ZSamplerKey &other) const;
+
+  struct Hash {
+    size_t operator()(const ZSamplerKey &key) const;
+  };
+};
+
+class ZSamplerCache : public ZObjectCache<ZSamplerKey, wgpu::Sampler> {
+public:
+  ZSamplerCache(wgpu::Device &rDevice, uint32_t releaseDelay = 3)
+      : ZObjectCache(rDevice, releaseDelay) {}
+  ~ZSamplerCache() override = default;
+
+  // Return a sampler for this descriptor, created only if no identical one
+  // exists. Must be given back with `release`.
+  wgpu::Sampler acquire(const wgpu::SamplerDescriptor &desc) {
+    return _acquire(ZSamplerKey(desc));
+  }
+
+private:
+  wgpu::Sampler _create(const ZSamplerKey &key) override;
+};
+
+/**
+ * Hashable content of a BindGroupDescriptor (the label is ignored). Entries
+ * are sorted by binding so that their order does not matter.
+ */
+struct ZBindGroupKey {
+  struct Entry {
+    uint32_t binding;
+    WGPUBuffer buffer;
+    uint64_t offset;
+    uint64_t size;
+    WGPUSampler sampler;
+    WGPUTextureView textureView;
+
+    bool operator==(const Entry &other) const = default;
+  };
+
+  WGPUBindGroupLayout layout = nullptr;
+  std::vector<Entry> entries;
+
+  ZBindGroupKey() = default;
+  explicit ZBindGroupKey(const wgpu::BindGroupDescriptor &desc);
+  bool operator==(const ZBindGroupKey &other) const = default;
+
+  struct Hash {
+    size_t operator()(const ZBindGroupKey &key) const;
+  };
+};
+
+/**
+ * Bind groups are keyed by the handles of the resources they reference, so
+ * the bind groups of a destroyed resource must be released before a new
+ * resource can reuse its address.
+ */
+class ZBindGroupCache : public ZObjectCache<ZBindGroupKey, wgpu::BindGroup> {
+public:
+  ZBindGroupCache(wgpu::Device &rDevice, uint32_t releaseDelay = 3)
+      : ZObjectCache(rDevice, releaseDelay) {}
+  ~ZBindGroupCache() override = default;
+
+  // Return a bind group for this descriptor, created only if no identical
+  // one exists. Must be given back with `release`.
+  wgpu::BindGroup acquire(const wgpu::BindGroupDescriptor &desc) {
+    return _acquire(ZBindGroupKey(desc));
+  }
+
+private:
+  wgpu::BindGroup _create(const ZBindGroupKey &key) override;
+};
+
+/**
+ * Hashable content of a render bundle of scene draws: the attachments it
+ * is recorded for and its draws, in order, with their state and resolved
+ * vertex buffer range. As the key holds everything the bundle records, a
+ * bundle is re-recorded exactly when a draw is added, removed, reordered or
+ * moved to another buffer range, or when its state or the attachments
+ * change.
+ */
+struct ZRenderBundleKey {
+  WGPUTextureFormat colorFormat = WGPUTextureFormat_Undefined;
+  WGPUTextureFormat depthStencilFormat = WGPUTextureFormat_Undefined;
+  bool stencilReadOnly = false;
+  std::vector<ZDrawList::Draw> draws;
+
+  bool operator==(const ZRenderBundleKey &other) const = default;
+
+  struct Hash {
+    size_t operator()(const ZRenderBundleKey &key) const;
+  };
+};
+
+/**
+ * Render bundles replayed frame after frame while their draws do not
+ * change. Like bind groups, they are keyed by raw handles, which must not
+ * be reused by new objects while a bundle referencing them is cached.
+ */
+class ZRenderBundleCache
+    : public ZObjectCache<ZRenderBundleKey, wgpu::RenderBundle> {
+public:
+  ZRenderBundleCache(wgpu::Device &rDevice, uint32_t releaseDelay = 3)
+      : ZObjectCache(rDevice, releaseDelay) {}
+  ~ZRenderBundleCache() override = default;
+
+  // Return a bundle for each key in `rBundles`, recording the ones not
+  // cached yet, in parallel with `pJobs`. Each must be given back with
+  // `release`. Returns the number of bundles recorded.
+  uint32_t acquire(const std::vector<ZRenderBundleKey> &keys,
+                   std::vector<wgpu::RenderBundle> &rBundles,
+                   ZJobSystem *pJobs = nullptr);
+
+private:
+  wgpu::RenderBundle _create(const ZRenderBundleKey &key) override;
+};
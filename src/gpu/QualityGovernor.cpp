@@ -0,0 +1,257 @@
+#include "QualityGovernor.hpp"
+
+#include "GpuTasks.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace wgpu;
+
+ZQualityGovernor::ZQualityGovernor(Device &rDevice, Queue &rQueue,
+                                   ZTaskExecutor &rExecutor)
+    : ZQualityGovernor(rDevice, rQueue, rExecutor, Settings{}) {}
+
+ZQualityGovernor::ZQualityGovernor(Device &rDevice, Queue &rQueue,
+                                   ZTaskExecutor &rExecutor,
+                                   const Settings &settings)
+    : _rDevice(rDevice), _rQueue(rQueue), _rExecutor(rExecutor),
+      _settings(settings) {
+  _setLevel(0);
+  if (_rDevice.hasFeature(FeatureName::TimestampQuery)) {
+    _initTimestamps();
+  }
+  _stats.gpuTimestamps = _querySet != nullptr;
+}
+
+ZQualityGovernor::~ZQualityGovernor() {
+  // The tasks and callbacks reference the governor and the readbacks, let
+  // the pending ones complete
+  auto isMapping = [](const _Readback &readback) {
+    return readback.state == _ReadbackState::Mapping;
+  };
+  while (_timedFrames > 0 ||
+         std::any_of(_readbacks.begin(), _readbacks.end(), isMapping)) {
+    _rExecutor.poll();
+  }
+
+  for (_Readback &readback : _readbacks) {
+    if (readback.buffer) {
+      readback.buffer.destroy();
+      readback.buffer.release();
+    }
+  }
+  if (_resolveBuffer) {
+    _resolveBuffer.destroy();
+    _resolveBuffer.release();
+  }
+  if (_querySet) {
+    _querySet.destroy();
+    _querySet.release();
+  }
+}
+
+void ZQualityGovernor::_initTimestamps() {
+  uint32_t queriesPerFrame = 2 * _settings.maxTimedPasses;
+  QuerySetDescriptor querySetDesc;
+  querySetDesc.label = "Quality governor timestamps";
+  querySetDesc.type = QueryType::Timestamp;
+  querySetDesc.count = _RingSize * queriesPerFrame;
+  _querySet = _rDevice.createQuerySet(querySetDesc);
+  if (!_querySet) {
+    return;
+  }
+
+  uint64_t frameBytes = queriesPerFrame * sizeof(uint64_t);
+  _resolveStride = (frameBytes + _ResolveAlignment - 1) / _ResolveAlignment *
+                   _ResolveAlignment;
+  BufferDescriptor bufferDesc;
+  bufferDesc.label = "Quality governor resolve";
+  bufferDesc.size = _RingSize * _resolveStride;
+  bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+  bufferDesc.mappedAtCreation = false;
+  _resolveBuffer = _rDevice.createBuffer(bufferDesc);
+
+  bufferDesc.label = "Quality governor readback";
+  bufferDesc.size = frameBytes;
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+  for (_Readback &readback : _readbacks) {
+    readback.buffer = _rDevice.createBuffer(bufferDesc);
+  }
+}
+
+bool ZQualityGovernor::getTimestampWrites(RenderPassTimestampWrites &rWrites) {
+  if (!_querySet) {
+    return false;
+  }
+  if (_current == _NoReadback) {
+    if (_readbacks[_next].state != _ReadbackState::Free) {
+      // The readbacks lag behind, this frame goes without a sample
+      return false;
+    }
+    _current = _next;
+    _readbacks[_current].state = _ReadbackState::Encoding;
+    _readbacks[_current].passCount = 0;
+  }
+
+  _Readback &readback = _readbacks[_current];
+  if (readback.passCount == _settings.maxTimedPasses) {
+    return false;
+  }
+  uint32_t query =
+      2 * (_current * _settings.maxTimedPasses + readback.passCount);
+  ++readback.passCount;
+  rWrites.querySet = _querySet;
+  rWrites.beginningOfPassWriteIndex = query;
+  rWrites.endOfPassWriteIndex = query + 1;
+  return true;
+}
+
+void ZQualityGovernor::resolveTimestamps(CommandEncoder &rEncoder) {
+  if (_current == _NoReadback) {
+    return;
+  }
+  _Readback &readback = _readbacks[_current];
+  uint64_t offset = _current * _resolveStride;
+  rEncoder.resolveQuerySet(_querySet, 2 * _current * _settings.maxTimedPasses,
+                           2 * readback.passCount, _resolveBuffer, offset);
+  rEncoder.copyBufferToBuffer(_resolveBuffer, offset, readback.buffer, 0,
+                              2 * readback.passCount * sizeof(uint64_t));
+  readback.state = _ReadbackState::Resolved;
+}
+
+void ZQualityGovernor::onSubmitted() {
+  if (_querySet) {
+    _onSubmittedTimestamps();
+  } else {
+    _rExecutor.spawn(_timeFrame(_Clock::now()));
+  }
+}
+
+void ZQualityGovernor::_onSubmittedTimestamps() {
+  if (_current == _NoReadback) {
+    ++_stats.skippedFrames;
+    return;
+  }
+  _Readback &readback = _readbacks[_current];
+  _current = _NoReadback;
+  _next = (_next + 1) % _RingSize;
+  if (readback.state != _ReadbackState::Resolved) {
+    // Timed passes without a resolve, the frame has no sample
+    readback.state = _ReadbackState::Free;
+    return;
+  }
+
+  readback.state = _ReadbackState::Mapping;
+  size_t size = 2 * readback.passCount * sizeof(uint64_t);
+  readback.mapCallback = readback.buffer.mapAsync(
+      MapMode::Read, 0, size,
+      [this, &readback, size](BufferMapAsyncStatus status) {
+        readback.state = _ReadbackState::Free;
+        if (status != BufferMapAsyncStatus::Success) {
+          return;
+        }
+        const uint64_t *pTimestamps = static_cast<const uint64_t *>(
+            readback.buffer.getConstMappedRange(0, size));
+        // In nanoseconds. Some GPUs reset their counter between passes,
+        // such pairs are left out.
+        uint64_t elapsed = 0;
+        for (uint32_t pass = 0; pass < readback.passCount; ++pass) {
+          uint64_t begin = pTimestamps[2 * pass];
+          uint64_t end = pTimestamps[2 * pass + 1];
+          elapsed += end > begin ? end - begin : 0;
+        }
+        readback.buffer.unmap();
+        addSample(elapsed / 1e6);
+      });
+}
+
+ZTask<> ZQualityGovernor::_timeFrame(_Clock::time_point submitted) {
+  ++_timedFrames;
+  QueueWorkDoneStatus status =
+      co_await ZGpuTasks::onSubmittedWorkDone(_rExecutor, _rQueue);
+  --_timedFrames;
+  if (status != QueueWorkDoneStatus::Success) {
+    co_return;
+  }
+  // Frames run one after the other on the GPU
+  _Clock::time_point now = _Clock::now();
+  _Clock::time_point start = std::max(submitted, _lastDone);
+  _lastDone = now;
+  addSample(std::chrono::duration<double, std::milli>(now - start).count());
+}
+
+void ZQualityGovernor::setEnabled(bool enabled) {
+  if (enabled == _enabled) {
+    return;
+  }
+  _enabled = enabled;
+  _quality.resolutionScale = _settings.maxScale;
+  _overFrames = 0;
+  _underFrames = 0;
+  _setLevel(0);
+}
+
+void ZQualityGovernor::addSample(double frameMs) {
+  _stats.frameMs = frameMs;
+  if (_samples++ == 0) {
+    _stats.averageMs = frameMs;
+  } else {
+    _stats.averageMs += _settings.smoothing * (frameMs - _stats.averageMs);
+  }
+  if (!_enabled || _stats.averageMs <= 0.0) {
+    return;
+  }
+
+  double ratio = _settings.targetMs / _stats.averageMs;
+  float &rScale = _quality.resolutionScale;
+  float correction =
+      1.0f + _settings.gain * ((float)std::sqrt(ratio) - 1.0f);
+  if (ratio < 1.0 - _settings.tolerance) {
+    // Over budget: lower the resolution, then the quality
+    _underFrames = 0;
+    if (rScale > _settings.minScale) {
+      rScale = std::max(_settings.minScale, rScale * correction);
+      _overFrames = 0;
+    } else if (++_overFrames >= _settings.stepFrames &&
+               _stats.level + 1 < _stats.levelCount) {
+      _setLevel(_stats.level + 1);
+      _overFrames = 0;
+    }
+  } else if (ratio > 1.0 + _settings.tolerance) {
+    // Under budget: restore the quality, then the resolution
+    _overFrames = 0;
+    if (_stats.level > 0) {
+      if (++_underFrames >= _settings.stepFrames) {
+        _setLevel(_stats.level - 1);
+        _underFrames = 0;
+      }
+    } else {
+      rScale = std::min(_settings.maxScale, rScale * correction);
+    }
+  } else {
+    _overFrames = 0;
+    _underFrames = 0;
+  }
+}
+
+void ZQualityGovernor::_setLevel(uint32_t level) {
+  uint32_t biasLevels =
+      _settings.lodBiasStep > 0.0f
+          ? (uint32_t)std::ceil(_settings.maxLodBias / _settings.lodBiasStep)
+          : 0;
+  uint32_t lightLevels =
+      _settings.maxLights - std::min(_settings.minLights, _settings.maxLights);
+  _stats.levelCount = 1 + biasLevels + lightLevels;
+  level = std::min(level, _stats.levelCount - 1);
+  if (level != _stats.level) {
+    ++_stats.steps;
+  }
+  _stats.level = level;
+
+  // LOD bias first, it costs the least to look at
+  _quality.lodBias = std::min(_settings.maxLodBias,
+                              _settings.lodBiasStep *
+                                  (float)std::min(level, biasLevels));
+  _quality.lightCount =
+      _settings.maxLights - (level > biasLevels ? level - biasLevels : 0);
+}
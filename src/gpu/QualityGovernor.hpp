@@ -0,0 +1,157 @@
+#pragma once
+
+#include "Task.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Holds a GPU frame-time budget by trading image quality.
+ *
+ * The GPU time of each frame is the time its scene passes took, measured
+ * with timestamp queries: each timed pass writes a timestamp at its start
+ * and end, the frame resolves them into a ring of readback buffers and the
+ * sample arrives once the buffer is mapped, a few frames later.
+ *
+ * Without the TimestampQuery feature, the time of a frame is measured on
+ * the CPU instead, from its submit, or from the end of the previous frame
+ * if the GPU was still busy with it, to the moment a task awaiting its
+ * work resumes on the executor. This includes all the passes of the frame
+ * and the latency of the callbacks and of the polls.
+ *
+ * The samples are smoothed with an exponential moving
+ * average, which drives the resolution scale of the scene: the pixel count
+ * goes with the square of the scale, so the scale moves towards the square
+ * root of the budget ratio, by `gain` of the way each frame. Nothing moves
+ * while the average is within `tolerance` of the budget, so that the scale
+ * settles instead of oscillating.
+ *
+ * Once the scale is down to `minScale` and frames stay over budget for
+ * `stepFrames` frames, the quality drops one level: the texture LOD bias
+ * rises by steps up to `maxLodBias`, then lights are dropped down to
+ * `minLights`. Levels come back in reverse order once frames stay under
+ * budget, before the scale goes up again.
+ */
+class ZQualityGovernor {
+public:
+  struct Settings {
+    double targetMs = 16.0;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    // Fraction of the budget within which nothing changes
+    double tolerance = 0.1;
+    // Weight of the newest sample in the average
+    double smoothing = 0.1;
+    // Fraction of the scale correction applied per frame, the measures lag
+    // behind by the frames in flight
+    float gain = 0.25f;
+    uint32_t stepFrames = 30;
+    float lodBiasStep = 1.0f;
+    float maxLodBias = 2.0f;
+    uint32_t maxLights = 2;
+    uint32_t minLights = 1;
+    // Passes timed per frame with timestamp queries
+    uint32_t maxTimedPasses = 8;
+  };
+
+  struct Quality {
+    float resolutionScale = 1.0f;
+    float lodBias = 0.0f;
+    uint32_t lightCount = 0;
+  };
+
+  struct Stats {
+    double frameMs = 0.0;
+    double averageMs = 0.0;
+    // 0 is the full quality
+    uint32_t level = 0;
+    uint32_t levelCount = 0;
+    // Quality level changes
+    uint64_t steps = 0;
+    // Whether the frame times come from timestamp queries
+    bool gpuTimestamps = false;
+    // Frames not timed because every readback buffer was in flight
+    uint64_t skippedFrames = 0;
+  };
+
+public:
+  ZQualityGovernor(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+                   ZTaskExecutor &rExecutor);
+  ZQualityGovernor(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+                   ZTaskExecutor &rExecutor, const Settings &settings);
+  ZQualityGovernor(const ZQualityGovernor &) = delete;
+  ZQualityGovernor &operator=(const ZQualityGovernor &) = delete;
+  ~ZQualityGovernor();
+
+  // Timestamp writes timing a pass of the frame being encoded. Returns false
+  // without the TimestampQuery feature, once the frame has maxTimedPasses
+  // passes, or when no readback buffer is free.
+  bool getTimestampWrites(wgpu::RenderPassTimestampWrites &rWrites);
+  // Copy the timestamps of the frame to its readback buffer. To be called
+  // after the last timed pass, before the command buffer is finished.
+  void resolveTimestamps(wgpu::CommandEncoder &rEncoder);
+
+  // Measure the frame just submitted. To be called right after the submit.
+  void onSubmitted();
+
+  // While disabled, frame times are still measured, at full quality
+  void setEnabled(bool enabled);
+  bool isEnabled() const { return _enabled; }
+
+  // Feed a frame time, also called by the measures of `onSubmitted`
+  void addSample(double frameMs);
+
+  const Quality &getQuality() const { return _quality; }
+  Settings &getSettings() { return _settings; }
+  const Stats &getStats() const { return _stats; }
+
+private:
+  using _Clock = std::chrono::steady_clock;
+
+  enum class _ReadbackState { Free, Encoding, Resolved, Mapping };
+
+  // Timestamps of one frame, two per timed pass
+  struct _Readback {
+    wgpu::Buffer buffer = nullptr;
+    _ReadbackState state = _ReadbackState::Free;
+    uint32_t passCount = 0;
+    std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+  };
+
+  static constexpr uint32_t _RingSize = 4;
+  static constexpr uint32_t _NoReadback = _RingSize;
+  // Alignment of the offsets of resolveQuerySet
+  static constexpr uint64_t _ResolveAlignment = 256;
+
+  void _initTimestamps();
+  void _onSubmittedTimestamps();
+  // Frame timed on the CPU, without timestamp queries
+  ZTask<> _timeFrame(_Clock::time_point submitted);
+  void _setLevel(uint32_t level);
+
+private:
+  wgpu::Device &_rDevice;
+  wgpu::Queue &_rQueue;
+  ZTaskExecutor &_rExecutor;
+  Settings _settings;
+  bool _enabled = false;
+  Quality _quality;
+  // Timestamp queries, null without the feature
+  wgpu::QuerySet _querySet = nullptr;
+  wgpu::Buffer _resolveBuffer = nullptr;
+  uint64_t _resolveStride = 0;
+  std::array<_Readback, _RingSize> _readbacks;
+  // Readback of the frame being encoded, and the next one to use
+  uint32_t _current = _NoReadback;
+  uint32_t _next = 0;
+  // Frames in flight timed by _timeFrame
+  uint32_t _timedFrames = 0;
+  _Clock::time_point _lastDone;
+  uint32_t _overFrames = 0;
+  uint32_t _underFrames = 0;
+  uint64_t _samples = 0;
+  Stats _stats;
+};
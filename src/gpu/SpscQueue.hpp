@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * Bounded lock-free queue between one producer thread and one consumer
+ * thread.
+ *
+ * Each side only writes its own index, so a push or a pop is a couple of
+ * atomic loads and one release store. The blocking `push` and `pop` wait on
+ * the other side's index with std::atomic::wait rather than spinning, which
+ * bounds how far the producer can run ahead to `Capacity` items.
+ */
+template <typename T, size_t Capacity> class ZSpscQueue {
+  static_assert(Capacity > 0);
+
+public:
+  // Returns false, leaving `item` untouched, when the queue is full
+  bool tryPush(T &&item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    _slots[tail % Capacity] = std::move(item);
+    _tail.store(tail + 1, std::memory_order_release);
+    _tail.notify_one();
+    return true;
+  }
+
+  // Returns false when the queue is empty
+  bool tryPop(T &rItem) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    rItem = std::move(_slots[head % Capacity]);
+    _head.store(head + 1, std::memory_order_release);
+    _head.notify_one();
+    return true;
+  }
+
+  // Wait for a free slot
+  void push(T &&item) {
+    while (!tryPush(std::move(item))) {
+      size_t head = _head.load(std::memory_order_acquire);
+      if (_tail.load(std::memory_order_relaxed) - head == Capacity) {
+        _head.wait(head, std::memory_order_acquire);
+      }
+    }
+  }
+
+  // Wait for an item
+  void pop(T &rItem) {
+    while (!tryPop(rItem)) {
+      size_t tail = _tail.load(std::memory_order_acquire);
+      if (tail == _head.load(std::memory_order_relaxed)) {
+        _tail.wait(tail, std::memory_order_acquire);
+      }
+    }
+  }
+
+private:
+  std::array<T, Capacity> _slots;
+  // On separate cache lines, each is written by one side only
+  alignas(64) std::atomic<size_t> _head = 0;
+  alignas(64) std::atomic<size_t> _tail = 0;
+};
@@ -0,0 +1,131 @@
+#include "StagingRing.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+using namespace wgpu;
+
+ZStagingRing::ZStagingRing(Device &rDevice, Queue &rQueue, uint32_t frameCount,
+                           uint64_t capacity)
+    : _rDevice(rDevice), _rQueue(rQueue), _capacity(capacity),
+      _stagings(std::max(frameCount, 1u)) {
+  _stats.capacity = capacity;
+  _stats.bufferCount = (uint32_t)_stagings.size();
+}
+
+ZStagingRing::~ZStagingRing() {
+  // Map callbacks reference the stagings, let the pending ones complete
+  for (_Staging &staging : _stagings) {
+    while (staging.state == _State::Mapping) {
+      _rDevice.tick();
+    }
+    if (staging.buffer) {
+      staging.buffer.destroy();
+      staging.buffer.release();
+    }
+  }
+}
+
+int ZStagingRing::init() {
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = _capacity;
+  bufferDesc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+  bufferDesc.mappedAtCreation = true;
+  for (_Staging &staging : _stagings) {
+    staging.buffer = _rDevice.createBuffer(bufferDesc);
+    if (!staging.buffer) {
+      return 1;
+    }
+    staging.pMapped =
+        static_cast<uint8_t *>(staging.buffer.getMappedRange(0, _capacity));
+    staging.state = _State::Mapped;
+  }
+  return 0;
+}
+
+void ZStagingRing::beginFrame() {
+  if (_inFrame) {
+    // The previous frame was dropped before its submit, keep its buffer
+    return;
+  }
+  _Staging &staging = _stagings[_current];
+  if (staging.state == _State::Unmapped) {
+    // Its last mapping failed
+    _map(staging);
+  }
+  if (staging.state != _State::Mapped) {
+    // Every buffer is in flight, wait for the GPU to release the oldest
+    auto start = std::chrono::steady_clock::now();
+    while (staging.state == _State::Mapping) {
+      _rDevice.tick();
+    }
+    ++_stats.stalls;
+    _stats.stallMs += std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  }
+  staging.used = 0;
+  _stats.frameBytes = 0;
+  _inFrame = true;
+}
+
+void ZStagingRing::write(CommandEncoder &rEncoder, Buffer buffer,
+                         uint64_t offset, const void *pData, uint64_t size) {
+  assert(offset % 4 == 0 && size % 4 == 0);
+  _Staging &staging = _stagings[_current];
+  if (!_inFrame || staging.state != _State::Mapped ||
+      staging.used + size > _capacity) {
+    ++_stats.overflows;
+    _rQueue.writeBuffer(buffer, offset, pData, size);
+    return;
+  }
+
+  memcpy(staging.pMapped + staging.used, pData, size);
+  rEncoder.copyBufferToBuffer(staging.buffer, staging.used, buffer, offset,
+                              size);
+  staging.used += size;
+  _stats.frameBytes = staging.used;
+  _stats.peakFrameBytes = std::max(_stats.peakFrameBytes, staging.used);
+}
+
+void ZStagingRing::endFrame() {
+  _Staging &staging = _stagings[_current];
+  if (!_inFrame || staging.used == 0) {
+    // Nothing was staged, the buffer stays mapped for the next frame
+    _inFrame = false;
+    return;
+  }
+  staging.buffer.unmap();
+  staging.pMapped = nullptr;
+  staging.state = _State::Unmapped;
+  _inFrame = false;
+}
+
+void ZStagingRing::onSubmitted() {
+  _Staging &staging = _stagings[_current];
+  if (staging.state != _State::Unmapped) {
+    return;
+  }
+  _map(staging);
+  _current = (_current + 1) % _stagings.size();
+}
+
+void ZStagingRing::_map(_Staging &staging) {
+  // The mapping completes once the GPU is done with the submitted copies
+  staging.state = _State::Mapping;
+  staging.mapCallback = staging.buffer.mapAsync(
+      MapMode::Write, 0, _capacity,
+      [this, &staging](BufferMapAsyncStatus status) {
+        if (status == BufferMapAsyncStatus::Success) {
+          staging.pMapped = static_cast<uint8_t *>(
+              staging.buffer.getMappedRange(0, _capacity));
+          staging.state = _State::Mapped;
+        } else {
+          staging.state = _State::Unmapped;
+        }
+        --_stats.buffersInFlight;
+      });
+  ++_stats.buffersInFlight;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Ring of mapped staging buffers for the dynamic data of each frame.
+ *
+ * Every frame writes into one staging buffer, which is mapped for writing,
+ * and records copyBufferToBuffer commands from it to their destination in
+ * the frame's command encoder. The buffer is unmapped before the submit and
+ * mapped again asynchronously, which only completes once the GPU is done
+ * with the frame; it is then reused by a later frame. With `frameCount`
+ * buffers, that many frames can be in flight before `beginFrame` stalls.
+ *
+ * Data that does not fit in the buffer of the frame falls back to
+ * queue.writeBuffer.
+ */
+class ZStagingRing {
+public:
+  struct Stats {
+    // Bytes staged by the current frame, and the most ever staged by a frame
+    uint64_t frameBytes = 0;
+    uint64_t peakFrameBytes = 0;
+    uint64_t capacity = 0;
+    // Staging buffers submitted and not yet mapped again
+    uint32_t buffersInFlight = 0;
+    uint32_t bufferCount = 0;
+    // Frames that had to wait for a staging buffer, and for how long overall
+    uint64_t stalls = 0;
+    double stallMs = 0.0;
+    // Writes that did not fit and went through queue.writeBuffer
+    uint64_t overflows = 0;
+  };
+
+public:
+  ZStagingRing(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+               uint32_t frameCount = 3, uint64_t capacity = 256 * 1024);
+  ~ZStagingRing();
+
+  int init();
+
+  // Pick the staging buffer of this frame, waiting for it if the GPU is
+  // still using it. To be called once per frame before any write.
+  void beginFrame();
+
+  // Record a copy of `size` bytes of `pData` to `buffer` at `offset`. Offset
+  // and size must be multiples of 4.
+  void write(wgpu::CommandEncoder &rEncoder, wgpu::Buffer buffer,
+             uint64_t offset, const void *pData, uint64_t size);
+
+  // Unmap the buffer of this frame. To be called after the last write and
+  // before the submit.
+  void endFrame();
+
+  // Recycle the buffer of this frame once the GPU is done with it. To be
+  // called right after the submit.
+  void onSubmitted();
+
+  const Stats &getStats() const { return _stats; }
+
+private:
+  enum class _State { Mapped, Unmapped, Mapping };
+
+  struct _Staging {
+    wgpu::Buffer buffer = nullptr;
+    _State state = _State::Mapped;
+    std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    uint8_t *pMapped = nullptr;
+    uint64_t used = 0;
+  };
+
+  void _map(_Staging &staging);
+
+private:
+  wgpu::Device &_rDevice;
+  wgpu::Queue &_rQueue;
+  uint64_t _capacity;
+  std::vector<_Staging> _stagings;
+  // Buffer of the current frame
+  size_t _current = 0;
+  bool _inFrame = false;
+  Stats _stats;
+};
@@ -0,0 +1,185 @@
+#include "Tlsf.hpp"
+
+#include <algorithm>
+#include <bit>
+
+ZTlsf::ZTlsf(uint64_t capacity, uint64_t granularity)
+    : _capacity(capacity / granularity * granularity),
+      _granularity(granularity) {
+  _freeHeads.fill(InvalidBlock);
+  uint32_t block = _newBlock();
+  _blocks[block].size = _capacity;
+  _insertFree(block);
+}
+
+uint32_t ZTlsf::allocate(uint64_t size, uint64_t alignment) {
+  size = std::max<uint64_t>(
+      (size + _granularity - 1) / _granularity * _granularity, _granularity);
+  alignment = std::max(alignment, _granularity);
+
+  // Any block of size + alignment - granularity has an aligned start
+  uint64_t searchSize = size + alignment - _granularity;
+  uint32_t block = _findFree(searchSize);
+  if (block == InvalidBlock) {
+    return InvalidBlock;
+  }
+  _removeFree(block);
+
+  // Give the padding before the aligned start back to the free lists. The
+  // physical predecessor of a free block is never free, no merge needed.
+  uint64_t offset = _blocks[block].offset;
+  uint64_t padding = (offset + alignment - 1) / alignment * alignment - offset;
+  if (padding > 0) {
+    uint32_t aligned = _split(block, padding);
+    _insertFree(block);
+    block = aligned;
+  }
+
+  // Same for the tail, whose successor was the successor of a free block
+  if (_blocks[block].size > size) {
+    _insertFree(_split(block, size));
+  }
+
+  _blocks[block].free = false;
+  _used += size;
+  return block;
+}
+
+void ZTlsf::free(uint32_t block) {
+  _used -= _blocks[block].size;
+  _blocks[block].free = true;
+
+  uint32_t next = _blocks[block].nextPhysical;
+  if (next != InvalidBlock && _blocks[next].free) {
+    _removeFree(next);
+    _merge(block, next);
+  }
+  uint32_t prev = _blocks[block].prevPhysical;
+  if (prev != InvalidBlock && _blocks[prev].free) {
+    _removeFree(prev);
+    _merge(prev, block);
+    block = prev;
+  }
+  _insertFree(block);
+}
+
+void ZTlsf::_mapping(uint64_t size, uint32_t &fl, uint32_t &sl) const {
+  uint64_t units = size / _granularity;
+  if (units < _SlCount) {
+    // Small sizes are all in the first level, one list per size
+    fl = 0;
+    sl = (uint32_t)units;
+    return;
+  }
+  uint32_t msb = std::bit_width(units) - 1;
+  fl = msb - _SlLog2 + 1;
+  sl = (uint32_t)(units >> (msb - _SlLog2)) - _SlCount;
+}
+
+uint32_t ZTlsf::_findFree(uint64_t size) const {
+  // Round up to the next list so that any block of the list found is large
+  // enough
+  uint64_t units = size / _granularity;
+  if (units >= _SlCount) {
+    uint32_t msb = std::bit_width(units) - 1;
+    units += (1ull << (msb - _SlLog2)) - 1;
+  }
+  uint32_t fl, sl;
+  _mapping(units * _granularity, fl, sl);
+  if (fl >= _FlCount) {
+    return InvalidBlock;
+  }
+
+  uint32_t slMap = _slBitmaps[fl] & (~0u << sl);
+  if (slMap == 0) {
+    uint32_t flMap = fl + 1 < _FlCount ? _flBitmap & (~0u << (fl + 1)) : 0;
+    if (flMap == 0) {
+      return InvalidBlock;
+    }
+    fl = std::countr_zero(flMap);
+    slMap = _slBitmaps[fl];
+  }
+  sl = std::countr_zero(slMap);
+  return _freeHeads[fl * _SlCount + sl];
+}
+
+void ZTlsf::_insertFree(uint32_t block) {
+  uint32_t fl, sl;
+  _mapping(_blocks[block].size, fl, sl);
+  uint32_t &head = _freeHeads[fl * _SlCount + sl];
+
+  _blocks[block].free = true;
+  _blocks[block].prevFree = InvalidBlock;
+  _blocks[block].nextFree = head;
+  if (head != InvalidBlock) {
+    _blocks[head].prevFree = block;
+  }
+  head = block;
+  _flBitmap |= 1u << fl;
+  _slBitmaps[fl] |= 1u << sl;
+}
+
+void ZTlsf::_removeFree(uint32_t block) {
+  uint32_t fl, sl;
+  _mapping(_blocks[block].size, fl, sl);
+  uint32_t &head = _freeHeads[fl * _SlCount + sl];
+
+  _Block &b = _blocks[block];
+  if (b.prevFree != InvalidBlock) {
+    _blocks[b.prevFree].nextFree = b.nextFree;
+  } else {
+    head = b.nextFree;
+  }
+  if (b.nextFree != InvalidBlock) {
+    _blocks[b.nextFree].prevFree = b.prevFree;
+  }
+  b.prevFree = InvalidBlock;
+  b.nextFree = InvalidBlock;
+  b.free = false;
+
+  if (head == InvalidBlock) {
+    _slBitmaps[fl] &= ~(1u << sl);
+    if (_slBitmaps[fl] == 0) {
+      _flBitmap &= ~(1u << fl);
+    }
+  }
+}
+
+uint32_t ZTlsf::_split(uint32_t block, uint64_t size) {
+  uint32_t rest = _newBlock();
+  // _newBlock may reallocate _blocks, references are taken after it
+  _Block &b = _blocks[block];
+  _Block &r = _blocks[rest];
+  r.offset = b.offset + size;
+  r.size = b.size - size;
+  r.prevPhysical = block;
+  r.nextPhysical = b.nextPhysical;
+  if (b.nextPhysical != InvalidBlock) {
+    _blocks[b.nextPhysical].prevPhysical = rest;
+  }
+  b.size = size;
+  b.nextPhysical = rest;
+  return rest;
+}
+
+void ZTlsf::_merge(uint32_t block, uint32_t next) {
+  _Block &b = _blocks[block];
+  _Block &n = _blocks[next];
+  b.size += n.size;
+  b.nextPhysical = n.nextPhysical;
+  if (n.nextPhysical != InvalidBlock) {
+    _blocks[n.nextPhysical].prevPhysical = block;
+  }
+  n = {};
+  _unusedBlocks.push_back(next);
+}
+
+uint32_t ZTlsf::_newBlock() {
+  if (!_unusedBlocks.empty()) {
+    uint32_t block = _unusedBlocks.back();
+    _unusedBlocks.pop_back();
+    return block;
+  }
+  _blocks.emplace_back();
+  return (uint32_t)_blocks.size() - 1;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Two-level segregated fit allocator over a range of offsets.
+ *
+ * Free blocks are kept in lists segregated by size: the first level splits
+ * sizes by power of two, the second level splits each power of two in
+ * `_SlCount` linear steps. Two bitmaps track the non-empty lists, so both
+ * allocation and free are O(1): finding a large enough free block is a
+ * couple of bit scans, and a freed block is merged with its free physical
+ * neighbours right away.
+ *
+ * Only offsets are managed, the memory itself lives elsewhere (e.g. in a GPU
+ * buffer).
+ */
+class ZTlsf {
+public:
+  static constexpr uint32_t InvalidBlock = 0xFFFFFFFF;
+
+public:
+  // Manage `capacity` bytes, every block being a multiple of `granularity`
+  // (a power of two)
+  explicit ZTlsf(uint64_t capacity, uint64_t granularity = 16);
+
+  // Returns the block of the allocation, or InvalidBlock when no free block
+  // is large enough. `alignment` must be a power of two.
+  uint32_t allocate(uint64_t size, uint64_t alignment = 0);
+  void free(uint32_t block);
+
+  uint64_t getOffset(uint32_t block) const { return _blocks[block].offset; }
+  uint64_t getSize(uint32_t block) const { return _blocks[block].size; }
+  uint64_t getCapacity() const { return _capacity; }
+  // Bytes in allocated blocks, including their rounding to the granularity
+  uint64_t getUsed() const { return _used; }
+
+private:
+  static constexpr uint32_t _SlLog2 = 4;
+  static constexpr uint32_t _SlCount = 1 << _SlLog2;
+  static constexpr uint32_t _FlCount = 32;
+
+  struct _Block {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    // Neighbours in address order
+    uint32_t prevPhysical = InvalidBlock;
+    uint32_t nextPhysical = InvalidBlock;
+    // Neighbours in the free list, for free blocks
+    uint32_t prevFree = InvalidBlock;
+    uint32_t nextFree = InvalidBlock;
+    bool free = false;
+  };
+
+  void _mapping(uint64_t size, uint32_t &fl, uint32_t &sl) const;
+  uint32_t _findFree(uint64_t size) const;
+  void _insertFree(uint32_t block);
+  void _removeFree(uint32_t block);
+  // Cut `block` after its first `size` bytes, returns the second part
+  uint32_t _split(uint32_t block, uint64_t size);
+  // Merge `next` into its physical predecessor `block`
+  void _merge(uint32_t block, uint32_t next);
+  uint32_t _newBlock();
+
+private:
+  uint64_t _capacity;
+  uint64_t _granularity;
+  uint64_t _used = 0;
+
+  uint32_t _flBitmap = 0;
+  std::array<uint32_t, _FlCount> _slBitmaps{};
+  std::array<uint32_t, _FlCount * _SlCount> _freeHeads;
+
+  std::vector<_Block> _blocks;
+  // Records of _blocks that are not part of the range anymore
+  std::vector<uint32_t> _unusedBlocks;
+};
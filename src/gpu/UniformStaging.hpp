@@ -0,0 +1,91 @@
+#pragma once
+
+#include "BufferAllocator.hpp"
+#include "StagingRing.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Coalesces the updates of a uniform buffer mirrored by a CPU struct.
+ *
+ * Changes to the struct are recorded as dirty byte ranges with `markDirty`,
+ * which can be called any number of times per frame (e.g. on every input
+ * event). Overlapping and adjacent ranges are merged, and `flush` uploads
+ * what is left with one copy per range through the staging ring, once per
+ * frame before the passes that read the buffer.
+ */
+template <typename T> class ZUniformStaging {
+public:
+  struct Stats {
+    // markDirty calls
+    uint64_t marks = 0;
+    // Copies actually recorded by flush
+    uint64_t writes = 0;
+
+    uint64_t savedWrites() const { return marks - writes; }
+  };
+
+public:
+  // `rBinding` and `rData` are read at flush time, the binding may be
+  // (re)allocated after this object
+  ZUniformStaging(const ZBufferAllocator::Binding &rBinding, const T &rData)
+      : _rBinding(rBinding), _rData(rData) {}
+
+  // Record that `size` bytes at `offset` of the struct changed
+  void markDirty(size_t offset, size_t size) {
+    ++_stats.marks;
+    // Buffer copies must be 4 byte aligned
+    size_t start = offset & ~size_t(3);
+    size_t end = std::min((offset + size + 3) & ~size_t(3), sizeof(T));
+
+    // Ranges are kept sorted and disjoint, there are only a handful of them
+    auto it = std::lower_bound(
+        _ranges.begin(), _ranges.end(), start,
+        [](const _Range &range, size_t value) { return range.end < value; });
+    while (it != _ranges.end() && it->start <= end) {
+      start = std::min(start, it->start);
+      end = std::max(end, it->end);
+      it = _ranges.erase(it);
+    }
+    _ranges.insert(it, {start, end});
+  }
+
+  // Record that a member of the struct changed
+  template <typename M> void markDirty(const M &member) {
+    markDirty(reinterpret_cast<const std::byte *>(&member) -
+                  reinterpret_cast<const std::byte *>(&_rData),
+              sizeof(M));
+  }
+
+  void markAllDirty() { markDirty(0, sizeof(T)); }
+
+  // Record the upload of the dirty ranges in `rEncoder`. To be called once
+  // per frame, between the beginFrame and endFrame of the ring.
+  void flush(wgpu::CommandEncoder &rEncoder, ZStagingRing &rRing) {
+    const std::byte *pData = reinterpret_cast<const std::byte *>(&_rData);
+    for (const _Range &range : _ranges) {
+      rRing.write(rEncoder, _rBinding.buffer, _rBinding.offset + range.start,
+                  pData + range.start, range.end - range.start);
+    }
+    _stats.writes += _ranges.size();
+    _ranges.clear();
+  }
+
+  bool isDirty() const { return !_ranges.empty(); }
+  const Stats &getStats() const { return _stats; }
+
+private:
+  struct _Range {
+    size_t start;
+    size_t end;
+  };
+
+  const ZBufferAllocator::Binding &_rBinding;
+  const T &_rData;
+  std::vector<_Range> _ranges;
+  Stats _stats;
+};
@@ -0,0 +1,158 @@
+#include "UploadScheduler.hpp"
+#include "TextureUploader.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using namespace wgpu;
+
+ZUploadScheduler::ZUploadScheduler(Queue &rQueue,
+                                   ZTextureUploader &rTextureUploader)
+    : ZUploadScheduler(rQueue, rTextureUploader, Settings{}) {}
+
+ZUploadScheduler::ZUploadScheduler(Queue &rQueue,
+                                   ZTextureUploader &rTextureUploader,
+                                   const Settings &settings)
+    : _rQueue(rQueue), _rTextureUploader(rTextureUploader),
+      _settings(settings), _frameStart(_Clock::now()) {}
+
+void ZUploadScheduler::enqueueBuffer(Buffer buffer, uint64_t offset,
+                                     const void *pData, uint64_t size,
+                                     int priority,
+                                     std::function<void()> onDone) {
+  _Upload upload;
+  upload.resolveBuffer = [buffer, offset]() {
+    return std::pair{buffer, offset};
+  };
+  upload.pData = static_cast<const uint8_t *>(pData);
+  upload.size = size;
+  upload.onDone = std::move(onDone);
+  _enqueue(priority, std::move(upload));
+}
+
+void ZUploadScheduler::enqueueBuffer(ZBufferAllocator &rAllocator,
+                                     ZBufferAllocator::Handle handle,
+                                     const void *pData, uint64_t size,
+                                     int priority,
+                                     std::function<void()> onDone) {
+  _Upload upload;
+  upload.resolveBuffer = [&rAllocator, handle]() {
+    ZBufferAllocator::Binding binding = rAllocator.get(handle);
+    return std::pair{binding.buffer, binding.offset};
+  };
+  upload.pData = static_cast<const uint8_t *>(pData);
+  upload.size = size;
+  upload.onDone = std::move(onDone);
+  _enqueue(priority, std::move(upload));
+}
+
+void ZUploadScheduler::enqueueTexture(Texture texture, uint32_t layer,
+                                      uint32_t width, uint32_t height,
+                                      uint32_t mipLevelCount,
+                                      const unsigned char *pPixels,
+                                      int priority,
+                                      std::function<void()> onDone) {
+  _Upload upload;
+  upload.texture = texture;
+  upload.layer = layer;
+  upload.width = width;
+  upload.height = height;
+  upload.mipLevelCount = mipLevelCount;
+  upload.pData = pPixels;
+  // Level 0 and roughly a third more for the mips generated from it
+  uint64_t levelSize = (uint64_t)width * height *
+                       ZTextureUploader::bytesPerTexel(texture.getFormat());
+  upload.size = mipLevelCount > 1 ? levelSize * 4 / 3 : levelSize;
+  upload.onDone = std::move(onDone);
+  _enqueue(priority, std::move(upload));
+}
+
+void ZUploadScheduler::beginFrame() { _frameStart = _Clock::now(); }
+
+void ZUploadScheduler::update() {
+  auto overTime = [this]() {
+    return _settings.timeBudgetMs > 0.0 &&
+           std::chrono::duration<double, std::milli>(_Clock::now() -
+                                                     _frameStart)
+                   .count() >= _settings.timeBudgetMs;
+  };
+
+  uint64_t budget = _settings.byteBudget;
+  bool first = true;
+  _stats.frameBytes = 0;
+  std::vector<std::pair<_Key, _Upload>> texturesDone;
+  while (!_queue.empty() && (first || (budget > 0 && !overTime()))) {
+    auto it = _queue.begin();
+    _Upload &upload = it->second;
+
+    if (upload.texture) {
+      if (!first && upload.size > budget) {
+        // Texture layers are not split, wait for the next frame
+        break;
+      }
+      _rTextureUploader.add(upload.texture, upload.layer, upload.width,
+                            upload.height, upload.mipLevelCount, upload.pData);
+      budget -= std::min(budget, upload.size);
+      _stats.frameBytes += upload.size;
+      _stats.queuedBytes -= upload.size;
+      texturesDone.emplace_back(it->first, std::move(upload));
+      _queue.erase(it);
+    } else {
+      // Chunks are multiples of 4 bytes, as required by writeBuffer
+      uint64_t remaining = upload.size - upload.written;
+      uint64_t chunk = std::min(remaining, std::max<uint64_t>(budget, 4));
+      if (chunk < remaining) {
+        chunk &= ~uint64_t(3);
+      }
+      auto [buffer, offset] = upload.resolveBuffer();
+      _rQueue.writeBuffer(buffer, offset + upload.written,
+                          upload.pData + upload.written, chunk);
+      upload.written += chunk;
+      budget -= std::min(budget, chunk);
+      _stats.frameBytes += chunk;
+      _stats.queuedBytes -= chunk;
+      if (upload.written == upload.size) {
+        _complete(upload);
+        _queue.erase(it);
+      }
+    }
+    first = false;
+  }
+
+  // All the texture layers of the frame share one staging buffer
+  if (!texturesDone.empty()) {
+    bool flushed = _rTextureUploader.flush() == 0;
+    for (auto &[key, upload] : texturesDone) {
+      if (flushed) {
+        _complete(upload);
+      } else {
+        // Nothing was submitted, retry from the same place in the queue
+        _stats.frameBytes -= upload.size;
+        _stats.queuedBytes += upload.size;
+        _queue.emplace(key, std::move(upload));
+      }
+    }
+  }
+  _stats.queueDepth = (uint32_t)_queue.size();
+}
+
+void ZUploadScheduler::_enqueue(int priority, _Upload &&upload) {
+  upload.enqueueTime = _Clock::now();
+  _stats.queuedBytes += upload.size;
+  _queue.emplace(_Key{-priority, _sequence++}, std::move(upload));
+  _stats.queueDepth = (uint32_t)_queue.size();
+}
+
+void ZUploadScheduler::_complete(const _Upload &upload) {
+  double latencyMs = std::chrono::duration<double, std::milli>(
+                         _Clock::now() - upload.enqueueTime)
+                         .count();
+  ++_stats.completed;
+  _stats.lastLatencyMs = latencyMs;
+  _stats.maxLatencyMs = std::max(_stats.maxLatencyMs, latencyMs);
+  _stats.averageLatencyMs +=
+      (latencyMs - _stats.averageLatencyMs) / _stats.completed;
+  if (upload.onDone) {
+    upload.onDone();
+  }
+}
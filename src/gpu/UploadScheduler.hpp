@@ -0,0 +1,112 @@
+#pragma once
+
+#include "BufferAllocator.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <webgpu/webgpu.hpp>
+
+class ZTextureUploader;
+
+/**
+ * Spreads buffer and texture uploads over several frames.
+ *
+ * Uploads are queued with a priority and drained highest priority first
+ * (then oldest first) by `update`, at most `byteBudget` bytes per frame and,
+ * when `timeBudgetMs` is set, until that much time elapsed since
+ * `beginFrame`. At least one upload (or buffer chunk) goes through each
+ * frame so that large ones still progress. Buffer uploads are cut into
+ * chunks, texture layers go through the texture uploader as a whole.
+ *
+ * The source data must stay valid until the upload's `onDone` is called.
+ */
+class ZUploadScheduler {
+public:
+  struct Settings {
+    uint64_t byteBudget = 8 * 1024 * 1024;
+    // 0 disables the time budget
+    double timeBudgetMs = 0.0;
+  };
+
+  struct Stats {
+    uint32_t queueDepth = 0;
+    uint64_t queuedBytes = 0;
+    // Bytes uploaded by the last update
+    uint64_t frameBytes = 0;
+    // Time from enqueue to completion
+    double lastLatencyMs = 0.0;
+    double averageLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+    uint64_t completed = 0;
+  };
+
+public:
+  ZUploadScheduler(wgpu::Queue &rQueue, ZTextureUploader &rTextureUploader);
+  ZUploadScheduler(wgpu::Queue &rQueue, ZTextureUploader &rTextureUploader,
+                   const Settings &settings);
+
+  void enqueueBuffer(wgpu::Buffer buffer, uint64_t offset, const void *pData,
+                     uint64_t size, int priority,
+                     std::function<void()> onDone = {});
+  // The destination is resolved at write time, as the allocation may move
+  void enqueueBuffer(ZBufferAllocator &rAllocator,
+                     ZBufferAllocator::Handle handle, const void *pData,
+                     uint64_t size, int priority,
+                     std::function<void()> onDone = {});
+  // Same parameters as ZTextureUploader::add
+  void enqueueTexture(wgpu::Texture texture, uint32_t layer, uint32_t width,
+                      uint32_t height, uint32_t mipLevelCount,
+                      const unsigned char *pPixels, int priority,
+                      std::function<void()> onDone = {});
+
+  // Start the time budget of this frame
+  void beginFrame();
+
+  // Upload what fits in the budgets. To be called once per frame, before the
+  // buffer allocator compacts, so that writes land before allocations move.
+  void update();
+
+  bool hasPending() const { return !_queue.empty(); }
+  Settings &getSettings() { return _settings; }
+  const Stats &getStats() const { return _stats; }
+
+private:
+  using _Clock = std::chrono::steady_clock;
+
+  struct _Upload {
+    // Buffer uploads
+    std::function<std::pair<wgpu::Buffer, uint64_t>()> resolveBuffer;
+    const uint8_t *pData = nullptr;
+    uint64_t size = 0;
+    // Bytes already written, buffer uploads go in chunks
+    uint64_t written = 0;
+
+    // Texture uploads
+    wgpu::Texture texture = nullptr;
+    uint32_t layer = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevelCount = 0;
+
+    std::function<void()> onDone;
+    _Clock::time_point enqueueTime;
+  };
+
+  // Highest priority first, then in order of arrival
+  using _Key = std::pair<int, uint64_t>;
+
+  void _enqueue(int priority, _Upload &&upload);
+  void _complete(const _Upload &upload);
+
+private:
+  wgpu::Queue &_rQueue;
+  ZTextureUploader &_rTextureUploader;
+  Settings _settings;
+  std::map<_Key, _Upload> _queue;
+  uint64_t _sequence = 0;
+  _Clock::time_point _frameStart;
+  Stats _stats;
+};
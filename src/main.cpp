@@ -26,15 +26,122 @@
 
 #include "Application.hpp"
 
-int main(int, char **) {
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static void printUsage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " [options]\n"
+      << "  --headless           Render offscreen to PNG files, no window\n"
+      << "  --software           Use the software (fallback) adapter\n"
+      << "  --backend <name>     vulkan, d3d12, d3d11, metal, opengl, "
+         "opengles or null\n"
+      << "  --size <W>x<H>       Size of the headless target (640x480)\n"
+      << "  --scene <file.obj>   Scene to load, may be repeated\n"
+      << "  --pose <yaw>,<pitch>,<zoom>\n"
+      << "                       Camera pose in headless mode, may be "
+         "repeated\n"
+      << "  --output <dir>       Directory of the headless images (.)\n"
+      << "  --windows <N>        Windows to open on the same device (1)\n"
+      << "  --viewports <N>      Side by side cameras per window (1)\n";
+}
+
+static bool parseBackend(const char *name, wgpu::BackendType &rBackend) {
+  static const struct {
+    const char *name;
+    wgpu::BackendType backend;
+  } backends[] = {
+      {"vulkan", wgpu::BackendType::Vulkan},
+      {"d3d12", wgpu::BackendType::D3D12},
+      {"d3d11", wgpu::BackendType::D3D11},
+      {"metal", wgpu::BackendType::Metal},
+      {"opengl", wgpu::BackendType::OpenGL},
+      {"opengles", wgpu::BackendType::OpenGLES},
+      {"null", wgpu::BackendType::Null},
+  };
+  for (const auto &entry : backends) {
+    if (std::strcmp(name, entry.name) == 0) {
+      rBackend = entry.backend;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns false on invalid arguments, or when only the usage was asked for
+static bool parseOptions(int argc, char **argv,
+                         Application::Options &rOptions) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    // The value of the options that take one
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool valid = true;
+    if (std::strcmp(arg, "--headless") == 0) {
+      rOptions.headless = true;
+      continue;
+    } else if (std::strcmp(arg, "--software") == 0) {
+      rOptions.forceFallbackAdapter = true;
+      continue;
+    } else if (std::strcmp(arg, "--help") == 0) {
+      printUsage(argv[0]);
+      return false;
+    } else if (!value) {
+      valid = false;
+    } else if (std::strcmp(arg, "--backend") == 0) {
+      valid = parseBackend(value, rOptions.backendType);
+    } else if (std::strcmp(arg, "--size") == 0) {
+      valid = std::sscanf(value, "%ux%u", &rOptions.width,
+                          &rOptions.height) == 2 &&
+              rOptions.width > 0 && rOptions.height > 0;
+    } else if (std::strcmp(arg, "--scene") == 0) {
+      rOptions.scenes.push_back(value);
+    } else if (std::strcmp(arg, "--pose") == 0) {
+      Application::CameraPose pose;
+      valid = std::sscanf(value, "%f,%f,%f", &pose.yaw, &pose.pitch,
+                          &pose.zoom) == 3;
+      rOptions.poses.push_back(pose);
+    } else if (std::strcmp(arg, "--output") == 0) {
+      rOptions.outputDirectory = value;
+    } else if (std::strcmp(arg, "--windows") == 0) {
+      valid = std::sscanf(value, "%u", &rOptions.windowCount) == 1 &&
+              rOptions.windowCount > 0;
+    } else if (std::strcmp(arg, "--viewports") == 0) {
+      valid = std::sscanf(value, "%u", &rOptions.viewportCount) == 1 &&
+              rOptions.viewportCount > 0;
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      std::cerr << "Invalid argument: " << arg << std::endl;
+      printUsage(argv[0]);
+      return false;
+    }
+    ++i;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Application::Options options;
+  if (!parseOptions(argc, argv, options))
+    return 1;
+
   Application app;
-  if (!app.onInit())
+  if (!app.onInit(options))
     return 1;
 
+  if (options.headless) {
+    int result = app.runHeadless();
+    app.onFinish();
+    return result;
+  }
+
+  // In event-driven mode, onFrame blocks while nothing changes
   while (app.isRunning()) {
     app.onFrame();
   }
 
   app.onFinish();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,77 @@
+#include "ImageWriter.hpp"
+
+#include "lib/glfw/deps/stb_image_write.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Copy a row to `pDestination` as RGBA
+static void copyRow(unsigned char *pDestination, const unsigned char *pSource,
+                    uint32_t width, bool bgra) {
+  for (uint32_t x = 0; x < width; ++x) {
+    const unsigned char *pTexel = pSource + 4 * x;
+    pDestination[4 * x + 0] = pTexel[bgra ? 2 : 0];
+    pDestination[4 * x + 1] = pTexel[1];
+    pDestination[4 * x + 2] = pTexel[bgra ? 0 : 2];
+    pDestination[4 * x + 3] = pTexel[3];
+  }
+}
+
+static int writeFile(const std::filesystem::path &path,
+                     const std::vector<unsigned char> &bytes) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "Could not open " << path << " for writing" << std::endl;
+    return 1;
+  }
+  file.write(reinterpret_cast<const char *>(bytes.data()),
+             (std::streamsize)bytes.size());
+  return file ? 0 : 1;
+}
+
+int ZImageWriter::write(const std::filesystem::path &path, Format format,
+                        const unsigned char *pPixels, uint32_t width,
+                        uint32_t height, uint32_t stride, bool bgra) {
+  switch (format) {
+  case Format::Png:
+    return writePng(path, pPixels, width, height, stride, bgra);
+  case Format::Raw:
+    return writeRaw(path, pPixels, width, height, stride, bgra);
+  }
+  return 1;
+}
+
+int ZImageWriter::writePng(const std::filesystem::path &path,
+                           const unsigned char *pPixels, uint32_t width,
+                           uint32_t height, uint32_t stride, bool bgra) {
+  // stb_image_write takes RGBA rows, BGRA ones are swizzled into a packed
+  // copy first
+  std::vector<unsigned char> swizzled;
+  if (bgra) {
+    swizzled.resize((size_t)4 * width * height);
+    for (uint32_t y = 0; y < height; ++y) {
+      copyRow(swizzled.data() + (size_t)4 * width * y,
+              pPixels + (size_t)stride * y, width, true);
+    }
+    pPixels = swizzled.data();
+    stride = 4 * width;
+  }
+  if (!stbi_write_png(path.string().c_str(), (int)width, (int)height, 4,
+                      pPixels, (int)stride)) {
+    std::cerr << "Could not write " << path << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int ZImageWriter::writeRaw(const std::filesystem::path &path,
+                           const unsigned char *pPixels, uint32_t width,
+                           uint32_t height, uint32_t stride, bool bgra) {
+  std::vector<unsigned char> bytes((size_t)4 * width * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    copyRow(bytes.data() + (size_t)4 * width * y,
+            pPixels + (size_t)stride * y, width, bgra);
+  }
+  return writeFile(path, bytes);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * Writes 8-bit RGBA or BGRA images to disk.
+ *
+ * PNG files are compressed by stb_image_write. Raw files are the rows as
+ * they are, without header, and cost little more than a copy to write.
+ */
+class ZImageWriter {
+public:
+  enum class Format {
+    Png,
+    Raw,
+  };
+
+  // `stride` is the distance in bytes between rows of `pPixels`, which
+  // holds 4 bytes per texel. With `bgra`, red and blue are swapped on the
+  // way. Returns 0 on success.
+  static int write(const std::filesystem::path &path, Format format,
+                   const unsigned char *pPixels, uint32_t width,
+                   uint32_t height, uint32_t stride, bool bgra = false);
+
+  static int writePng(const std::filesystem::path &path,
+                      const unsigned char *pPixels, uint32_t width,
+                      uint32_t height, uint32_t stride, bool bgra = false);
+  static int writeRaw(const std::filesystem::path &path,
+                      const unsigned char *pPixels, uint32_t width,
+                      uint32_t height, uint32_t stride, bool bgra = false);
+};
@@ -0,0 +1,137 @@
+#include "PageContainer.hpp"
+#include "TextureUploader.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+static uint32_t pageCount(uint32_t size, uint32_t mip, uint32_t pageSize) {
+  uint32_t levelSize = std::max(size >> mip, 1u);
+  return (levelSize + pageSize - 1) / pageSize;
+}
+
+int ZPageContainer::cook(const std::filesystem::path &imagePath,
+                         const std::filesystem::path &containerPath,
+                         uint32_t pageSize, uint32_t border,
+                         TextureFormat format) {
+  int width, height, channels;
+  unsigned char *pixelData = stbi_load(imagePath.string().c_str(), &width,
+                                       &height, &channels, 4);
+  if (nullptr == pixelData) {
+    std::cerr << "Could not load " << imagePath << std::endl;
+    return 1;
+  }
+
+  Header header;
+  memcpy(header.magic, "ZVTP", 4);
+  header.version = _Version;
+  header.width = (uint32_t)width;
+  header.height = (uint32_t)height;
+  header.pageSize = pageSize;
+  header.border = border;
+  header.mipCount = 1;
+  while (std::max(header.width >> (header.mipCount - 1),
+                  header.height >> (header.mipCount - 1)) > pageSize) {
+    ++header.mipCount;
+  }
+
+  std::ofstream file(containerPath, std::ios::binary);
+  if (!file.is_open()) {
+    stbi_image_free(pixelData);
+    return 1;
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+
+  uint32_t paddedSize = pageSize + 2 * border;
+  std::vector<unsigned char> page(4 * paddedSize * paddedSize);
+  std::vector<unsigned char> level(pixelData, pixelData + 4 * width * height);
+  stbi_image_free(pixelData);
+  uint32_t levelWidth = header.width;
+  uint32_t levelHeight = header.height;
+
+  for (uint32_t mip = 0; mip < header.mipCount; ++mip) {
+    if (mip > 0) {
+      uint32_t nextWidth = std::max(levelWidth / 2, 1u);
+      uint32_t nextHeight = std::max(levelHeight / 2, 1u);
+      std::vector<unsigned char> next(4 * nextWidth * nextHeight);
+      ZTextureUploader::downsample(format, level.data(),
+                                   levelWidth, levelHeight, 4 * levelWidth,
+                                   next.data(), nextWidth, nextHeight,
+                                   4 * nextWidth);
+      level = std::move(next);
+      levelWidth = nextWidth;
+      levelHeight = nextHeight;
+    }
+
+    uint32_t countX = pageCount(header.width, mip, pageSize);
+    uint32_t countY = pageCount(header.height, mip, pageSize);
+    for (uint32_t py = 0; py < countY; ++py) {
+      for (uint32_t px = 0; px < countX; ++px) {
+        // Texels outside of the level (borders and the overhang of the last
+        // row/column of pages) are clamped to its edge
+        for (uint32_t j = 0; j < paddedSize; ++j) {
+          int64_t srcJ = (int64_t)(py * pageSize + j) - border;
+          srcJ = std::clamp<int64_t>(srcJ, 0, levelHeight - 1);
+          for (uint32_t i = 0; i < paddedSize; ++i) {
+            int64_t srcI = (int64_t)(px * pageSize + i) - border;
+            srcI = std::clamp<int64_t>(srcI, 0, levelWidth - 1);
+            memcpy(&page[4 * (j * paddedSize + i)],
+                   &level[4 * (srcJ * levelWidth + srcI)], 4);
+          }
+        }
+        file.write(reinterpret_cast<const char *>(page.data()), page.size());
+      }
+    }
+  }
+
+  return file.good() ? 0 : 1;
+}
+
+int ZPageContainer::open(const std::filesystem::path &containerPath) {
+  _file.open(containerPath, std::ios::binary);
+  if (!_file.is_open()) {
+    return 1;
+  }
+  _file.read(reinterpret_cast<char *>(&_header), sizeof(Header));
+  if (!_file.good() || memcmp(_header.magic, "ZVTP", 4) != 0 ||
+      _header.version != _Version) {
+    std::cerr << containerPath << " is not a page container" << std::endl;
+    _file.close();
+    return 1;
+  }
+
+  _mipOffsets.resize(_header.mipCount);
+  uint64_t offset = sizeof(Header);
+  for (uint32_t mip = 0; mip < _header.mipCount; ++mip) {
+    _mipOffsets[mip] = offset;
+    offset += (uint64_t)getPageCountX(mip) * getPageCountY(mip) *
+              getPageBytes();
+  }
+  return 0;
+}
+
+int ZPageContainer::readPage(uint32_t mip, uint32_t x, uint32_t y,
+                             unsigned char *pDst) {
+  if (mip >= _header.mipCount || x >= getPageCountX(mip) ||
+      y >= getPageCountY(mip)) {
+    return 1;
+  }
+  uint64_t index = (uint64_t)y * getPageCountX(mip) + x;
+  // A failed read does not fail the next ones
+  _file.clear();
+  _file.seekg(_mipOffsets[mip] + index * getPageBytes());
+  _file.read(reinterpret_cast<char *>(pDst), getPageBytes());
+  return _file.good() ? 0 : 1;
+}
+
+uint32_t ZPageContainer::getPageCountX(uint32_t mip) const {
+  return pageCount(_header.width, mip, _header.pageSize);
+}
+
+uint32_t ZPageContainer::getPageCountY(uint32_t mip) const {
+  return pageCount(_header.height, mip, _header.pageSize);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Cooked container of the pages of a virtual texture.
+ *
+ * Every mip level of the source image is cut into square pages of
+ * `pageSize` texels, each surrounded by a `border` of texels copied from its
+ * neighbours so that bilinear filtering in the physical page cache does not
+ * need the adjacent page. Pages are stored as RGBA8, mip by mip and row by
+ * row, all with the same size so that any page can be read with one seek.
+ */
+class ZPageContainer {
+public:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pageSize;
+    uint32_t border;
+    uint32_t mipCount;
+  };
+
+public:
+  // Cook an image file into a page container. The mip chain stops at the
+  // first level that fits in a single page. `format` is RGBA8Unorm or
+  // RGBA8UnormSrgb, the one the pages are sampled as: the mips of sRGB
+  // pages are averaged in linear space.
+  static int
+  cook(const std::filesystem::path &imagePath,
+       const std::filesystem::path &containerPath, uint32_t pageSize = 128,
+       uint32_t border = 4,
+       wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm);
+
+  int open(const std::filesystem::path &containerPath);
+
+  // Read the RGBA8 texels of a page, including its border, into `pDst`
+  // which must hold `getPageBytes()` bytes
+  int readPage(uint32_t mip, uint32_t x, uint32_t y, unsigned char *pDst);
+
+  const Header &getHeader() const { return _header; }
+  uint32_t getPaddedPageSize() const {
+    return _header.pageSize + 2 * _header.border;
+  }
+  uint32_t getPageBytes() const {
+    return 4 * getPaddedPageSize() * getPaddedPageSize();
+  }
+  uint32_t getPageCountX(uint32_t mip) const;
+  uint32_t getPageCountY(uint32_t mip) const;
+
+private:
+  static constexpr uint32_t _Version = 1;
+
+  std::ifstream _file;
+  Header _header{};
+  // Offset of the first page of each mip level in the file
+  std::vector<uint64_t> _mipOffsets;
+};
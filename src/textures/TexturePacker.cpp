@@ -0,0 +1,329 @@
+#include "TexturePacker.hpp"
+#include "JobSystem.hpp"
+#include "TextureUploader.hpp"
+#include "UploadScheduler.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+ZTexturePacker::ZTexturePacker(Device &rDevice, Queue &rQueue,
+                               TextureFormat format, uint32_t maxLayerSize,
+                               uint32_t padding)
+    : _rDevice(rDevice), _rQueue(rQueue), _format(format),
+      _texelSize(ZTextureUploader::bytesPerTexel(format)),
+      _maxLayerSize(maxLayerSize), _padding(padding) {
+  std::vector<unsigned char> white(
+      _texelSize * DefaultBlockSize * DefaultBlockSize, 255);
+  add(white.data(), DefaultBlockSize, DefaultBlockSize);
+}
+
+ZTexturePacker::~ZTexturePacker() {
+  if (_textureView) {
+    _textureView.release();
+  }
+  if (_texture) {
+    _texture.destroy();
+    _texture.release();
+  }
+  if (_materialBuffer) {
+    _materialBuffer.destroy();
+    _materialBuffer.release();
+  }
+}
+
+uint32_t ZTexturePacker::add(const unsigned char *pPixels, uint32_t width,
+                             uint32_t height) {
+  return _register(_prepare(pPixels, width, height));
+}
+
+int ZTexturePacker::add(const std::filesystem::path &path) {
+  _Pending texture;
+  if (!_load(path, texture)) {
+    return -1;
+  }
+  return (int)_register(std::move(texture));
+}
+
+std::vector<int>
+ZTexturePacker::add(const std::vector<std::filesystem::path> &paths,
+                    ZJobSystem &rJobs) {
+  std::vector<_Pending> textures(paths.size());
+  std::vector<char> loaded(paths.size(), 0);
+  rJobs.parallelFor((uint32_t)paths.size(), 1,
+                    [&](uint32_t begin, uint32_t end) {
+                      for (uint32_t i = begin; i < end; ++i) {
+                        loaded[i] = _load(paths[i], textures[i]);
+                      }
+                    });
+
+  // Registered in order, so that material IDs do not depend on timing
+  std::vector<int> materialIds;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    materialIds.push_back(loaded[i] ? (int)_register(std::move(textures[i]))
+                                    : -1);
+  }
+  return materialIds;
+}
+
+ZTexturePacker::_Pending
+ZTexturePacker::_prepare(const unsigned char *pPixels, uint32_t width,
+                         uint32_t height) const {
+  _Pending texture;
+  texture.pixels.assign(pPixels, pPixels + _texelSize * width * height);
+  texture.width = width;
+  texture.height = height;
+
+  // Textures that cannot fit in a layer are halved until they do
+  while (std::max(texture.width, texture.height) > _maxLayerSize) {
+    uint32_t halfWidth = std::max(texture.width / 2, 1u);
+    uint32_t halfHeight = std::max(texture.height / 2, 1u);
+    std::vector<unsigned char> half(_texelSize * halfWidth * halfHeight);
+    ZTextureUploader::downsample(_format, texture.pixels.data(), texture.width,
+                                 texture.height, _texelSize * texture.width,
+                                 half.data(), halfWidth, halfHeight,
+                                 _texelSize * halfWidth);
+    texture.pixels = std::move(half);
+    texture.width = halfWidth;
+    texture.height = halfHeight;
+  }
+
+  texture.sizeClass = std::bit_ceil(std::max(texture.width, texture.height));
+  return texture;
+}
+
+bool ZTexturePacker::_load(const std::filesystem::path &path,
+                           _Pending &rTexture) const {
+  int width, height, channels;
+  unsigned char *pixelData = stbi_load(path.string().c_str(), &width, &height,
+                                       &channels, _texelSize);
+  if (nullptr == pixelData) {
+    std::cerr << "Could not load texture " << path << std::endl;
+    return false;
+  }
+
+  rTexture = _prepare(pixelData, width, height);
+  stbi_image_free(pixelData);
+  return true;
+}
+
+uint32_t ZTexturePacker::addVirtual(uint32_t virtualTexture) {
+  MaterialEntry entry{};
+  entry.layer = NoLayer;
+  entry.virtualTexture = virtualTexture;
+  _materials.push_back(entry);
+  return (uint32_t)_materials.size() - 1;
+}
+
+uint32_t ZTexturePacker::_register(_Pending &&texture) {
+  texture.materialId = (uint32_t)_materials.size();
+  MaterialEntry entry{};
+  entry.virtualTexture = NoVirtualTexture;
+  _materials.push_back(entry);
+  _pending.push_back(std::move(texture));
+  return _pending.back().materialId;
+}
+
+int ZTexturePacker::build(ZUploadScheduler &rScheduler, int priority,
+                          ZJobSystem *pJobs) {
+  if (_texture) {
+    std::cerr << "Texture packer has already been built" << std::endl;
+    return 1;
+  }
+
+  // The layer size is the smallest power of two that holds the largest
+  // class with its gutter, so small scenes do not pay for 2K layers.
+  _layerSize = 1;
+  for (const _Pending &texture : _pending) {
+    _layerSize = std::max(_layerSize, texture.sizeClass + 2 * _padding);
+  }
+  _layerSize = std::min(std::bit_ceil(_layerSize), _maxLayerSize);
+
+  // Largest classes first, so that each class fills its atlas layers
+  // contiguously
+  std::stable_sort(_pending.begin(), _pending.end(),
+                   [](const _Pending &a, const _Pending &b) {
+                     return a.sizeClass > b.sizeClass;
+                   });
+
+  // The layout is decided first, the copies to the layers, which write
+  // disjoint cells, come after
+  std::vector<_Blit> blits;
+  const _Pending *pDefault = nullptr;
+
+  std::vector<_OpenAtlas> openAtlases;
+  for (const _Pending &texture : _pending) {
+    if (texture.materialId == DefaultMaterial) {
+      pDefault = &texture;
+      continue;
+    }
+    MaterialEntry &entry = _materials[texture.materialId];
+    uint32_t cellSize = texture.sizeClass + 2 * _padding;
+
+    if (cellSize > _layerSize) {
+      // No room for a gutter: the texture gets a layer of its own
+      entry.layer = _newLayer();
+      blits.push_back({&texture, entry.layer, 0, 0, 0});
+      entry.uvRect = {0.0f, 0.0f, texture.width / (float)_layerSize,
+                      texture.height / (float)_layerSize};
+      continue;
+    }
+
+    uint32_t cellsPerRow = _layerSize / cellSize;
+    auto it = std::find_if(
+        openAtlases.begin(), openAtlases.end(),
+        [&](const _OpenAtlas &a) { return a.sizeClass == texture.sizeClass; });
+    if (it == openAtlases.end() || it->nextCell == cellsPerRow * cellsPerRow) {
+      if (it != openAtlases.end()) {
+        openAtlases.erase(it);
+      }
+      openAtlases.push_back({texture.sizeClass, _newLayer(), 0});
+      it = openAtlases.end() - 1;
+    }
+
+    uint32_t x = (it->nextCell % cellsPerRow) * cellSize;
+    uint32_t y = (it->nextCell / cellsPerRow) * cellSize;
+    ++it->nextCell;
+
+    entry.layer = it->layer;
+    blits.push_back({&texture, entry.layer, x, y, _padding});
+    entry.uvRect = {(x + _padding) / (float)_layerSize,
+                    (y + _padding) / (float)_layerSize,
+                    texture.width / (float)_layerSize,
+                    texture.height / (float)_layerSize};
+  }
+  _placeDefault(*pDefault, blits);
+
+  SupportedLimits supportedLimits;
+  _rDevice.getLimits(&supportedLimits);
+  if (_layers.size() > supportedLimits.limits.maxTextureArrayLayers) {
+    std::cerr << "Cannot pack the textures into "
+              << supportedLimits.limits.maxTextureArrayLayers
+              << " layers, they need " << _layers.size() << std::endl;
+    _pending.clear();
+    _layers.clear();
+    return 1;
+  }
+
+  auto blitRange = [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      const _Blit &blit = blits[i];
+      _blit(*blit.pTexture, blit.layer, blit.x, blit.y, blit.padding);
+    }
+  };
+  if (pJobs) {
+    pJobs->parallelFor((uint32_t)blits.size(), 1, blitRange);
+  } else {
+    blitRange(0, (uint32_t)blits.size());
+  }
+  _pending.clear();
+
+  return _upload(rScheduler, priority);
+}
+
+uint32_t ZTexturePacker::_newLayer() {
+  _layers.emplace_back(_texelSize * _layerSize * _layerSize, 0);
+  return (uint32_t)_layers.size() - 1;
+}
+
+void ZTexturePacker::_placeDefault(const _Pending &texture,
+                                   std::vector<_Blit> &rBlits) {
+  MaterialEntry &entry = _materials[texture.materialId];
+  if (_layers.empty()) {
+    _newLayer();
+  }
+
+  // The bottom right corner is the last to be filled, in atlas layers as
+  // in layers holding a single texture smaller than the layer
+  uint32_t corner = _layerSize - DefaultBlockSize;
+  for (uint32_t layer = 0; layer < (uint32_t)_layers.size(); ++layer) {
+    bool isFree =
+        std::none_of(rBlits.begin(), rBlits.end(), [&](const _Blit &blit) {
+          return blit.layer == layer &&
+                 blit.x + blit.pTexture->width + 2 * blit.padding > corner &&
+                 blit.y + blit.pTexture->height + 2 * blit.padding > corner;
+        });
+    if (isFree) {
+      entry.layer = layer;
+      rBlits.push_back({&texture, layer, corner, corner, 0});
+      // The rectangle is empty, every sample lands in the middle of the block
+      float center = (corner + DefaultBlockSize / 2) / (float)_layerSize;
+      entry.uvRect = {center, center, 0.0f, 0.0f};
+      return;
+    }
+  }
+
+  // The layers are full, e.g. with a single texture as large as the layer
+  entry.layer = NoLayer;
+  entry.uvRect = {0.0f, 0.0f, 0.0f, 0.0f};
+}
+
+void ZTexturePacker::_blit(const _Pending &texture, uint32_t layer, uint32_t x,
+                           uint32_t y, uint32_t padding) {
+  unsigned char *pLayer = _layers[layer].data();
+  int w = (int)texture.width;
+  int h = (int)texture.height;
+  int p = (int)padding;
+
+  // Copy the texture and extend its border pixels into the gutter
+  for (int j = -p; j < h + p; ++j) {
+    int srcJ = std::clamp(j, 0, h - 1);
+    for (int i = -p; i < w + p; ++i) {
+      int srcI = std::clamp(i, 0, w - 1);
+      uint32_t dstI = x + p + i;
+      uint32_t dstJ = y + p + j;
+      memcpy(&pLayer[_texelSize * (dstJ * _layerSize + dstI)],
+             &texture.pixels[_texelSize * (srcJ * w + srcI)], _texelSize);
+    }
+  }
+}
+
+int ZTexturePacker::_upload(ZUploadScheduler &rScheduler, int priority) {
+  uint32_t layerCount = (uint32_t)_layers.size();
+  uint32_t mipLevelCount = std::bit_width(_layerSize);
+
+  TextureDescriptor textureDesc;
+  textureDesc.dimension = TextureDimension::_2D;
+  textureDesc.format = _format;
+  textureDesc.size = {_layerSize, _layerSize, layerCount};
+  textureDesc.mipLevelCount = mipLevelCount;
+  textureDesc.sampleCount = 1;
+  textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  _texture = _rDevice.createTexture(textureDesc);
+  if (!_texture) {
+    return 1;
+  }
+
+  // The CPU copy of each layer is dropped once it reached the staging buffer
+  for (uint32_t layer = 0; layer < layerCount; ++layer) {
+    rScheduler.enqueueTexture(_texture, layer, _layerSize, _layerSize,
+                              mipLevelCount, _layers[layer].data(), priority,
+                              [this, layer]() { _layers[layer] = {}; });
+  }
+
+  TextureViewDescriptor textureViewDesc;
+  textureViewDesc.aspect = TextureAspect::All;
+  textureViewDesc.baseArrayLayer = 0;
+  textureViewDesc.arrayLayerCount = layerCount;
+  textureViewDesc.baseMipLevel = 0;
+  textureViewDesc.mipLevelCount = mipLevelCount;
+  textureViewDesc.dimension = TextureViewDimension::_2DArray;
+  textureViewDesc.format = textureDesc.format;
+  _textureView = _texture.createView(textureViewDesc);
+
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = _materials.size() * sizeof(MaterialEntry);
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+  bufferDesc.mappedAtCreation = false;
+  _materialBuffer = _rDevice.createBuffer(bufferDesc);
+  _rQueue.writeBuffer(_materialBuffer, 0, _materials.data(), bufferDesc.size);
+
+  return _textureView && _materialBuffer ? 0 : 1;
+}
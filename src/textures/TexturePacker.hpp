@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <glm/glm.hpp>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class ZJobSystem;
+class ZUploadScheduler;
+
+/**
+ * Packs the textures of a scene into the layers of one 2D texture array so
+ * that every material can be sampled through a single bind group. All the
+ * textures of a packer share its format, one of those of ZTextureUploader.
+ *
+ * Textures are grouped by size class (the next power of two of their largest
+ * side). A class too large to leave room for padding gets one layer per
+ * texture, smaller classes share atlas layers laid out as a grid of cells
+ * surrounded by an edge-clamped gutter that limits filtering bleed.
+ *
+ * The layer and UV rectangle of each material are stored in a storage buffer
+ * that the shader indexes by material ID.
+ */
+class ZTexturePacker {
+public:
+  /**
+   * One record of the material buffer, replicated in the shader
+   */
+  struct MaterialEntry {
+    // xy is the offset of the texture in its layer and zw its size, in UVs
+    glm::vec4 uvRect;
+    uint32_t layer;
+    // ID in the virtual texture sampled instead of the layer, if any
+    uint32_t virtualTexture;
+    uint32_t _pad[2];
+  };
+  static_assert(sizeof(MaterialEntry) % 16 == 0);
+
+  // Material registered by every packer, plain white. It takes a corner
+  // left free by the other textures, and never a layer of its own unless
+  // there is no other texture.
+  static constexpr uint32_t DefaultMaterial = 0;
+  // Layer of a material drawn white without sampling, when no layer had a
+  // free corner for the default material
+  static constexpr uint32_t NoLayer = 0xFFFFFFFF;
+  // Side of the white block of the default material, aligned so that it
+  // stays white down to mip 4
+  static constexpr uint32_t DefaultBlockSize = 16;
+  // Virtual texture of the materials that sample the layers
+  static constexpr uint32_t NoVirtualTexture = 0xFFFFFFFF;
+
+public:
+  ZTexturePacker(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+                 wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm,
+                 uint32_t maxLayerSize = 2048, uint32_t padding = 4);
+  ~ZTexturePacker();
+
+  // Queue pixels in the packer's format and return their material ID
+  uint32_t add(const unsigned char *pPixels, uint32_t width, uint32_t height);
+  // Queue an image file for packing, converted to the channel count of the
+  // packer's format. Returns -1 if it cannot be loaded.
+  int add(const std::filesystem::path &path);
+  // Same for several files, decoded and downsampled in parallel. Material
+  // IDs follow the order of `paths`.
+  std::vector<int> add(const std::vector<std::filesystem::path> &paths,
+                       ZJobSystem &rJobs);
+  // Register a material whose texels are streamed by a virtual texture,
+  // given the ID it has there
+  uint32_t addVirtual(uint32_t virtualTexture);
+
+  // Lay out all queued textures, schedule the upload of each layer with
+  // `priority` and upload the material buffer. Must be called once, after
+  // the last `add`, and the scheduler must be drained before the packer is
+  // destroyed. With `pJobs`, the textures are copied to their layers in
+  // parallel. Fails if the textures need more layers than the device
+  // supports.
+  int build(ZUploadScheduler &rScheduler, int priority = 0,
+            ZJobSystem *pJobs = nullptr);
+
+  wgpu::TextureView getTextureView() const { return _textureView; }
+  wgpu::Buffer getMaterialBuffer() const { return _materialBuffer; }
+  uint32_t getMaterialCount() const { return (uint32_t)_materials.size(); }
+  uint32_t getLayerCount() const { return (uint32_t)_layers.size(); }
+
+private:
+  struct _Pending {
+    std::vector<unsigned char> pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t sizeClass;
+    uint32_t materialId;
+  };
+
+  // Copy of a texture to its place in a layer
+  struct _Blit {
+    const _Pending *pTexture;
+    uint32_t layer;
+    uint32_t x;
+    uint32_t y;
+    uint32_t padding;
+  };
+
+  // Atlas layer currently being filled for one size class
+  struct _OpenAtlas {
+    uint32_t sizeClass;
+    uint32_t layer;
+    uint32_t nextCell;
+  };
+
+  // Copy the pixels and halve them until they fit in a layer
+  _Pending _prepare(const unsigned char *pPixels, uint32_t width,
+                    uint32_t height) const;
+  bool _load(const std::filesystem::path &path, _Pending &rTexture) const;
+  uint32_t _register(_Pending &&texture);
+  uint32_t _newLayer();
+  void _placeDefault(const _Pending &texture, std::vector<_Blit> &rBlits);
+  void _blit(const _Pending &texture, uint32_t layer, uint32_t x, uint32_t y,
+             uint32_t padding);
+  int _upload(ZUploadScheduler &rScheduler, int priority);
+
+private:
+  wgpu::Device &_rDevice;
+  wgpu::Queue &_rQueue;
+  wgpu::TextureFormat _format;
+  uint32_t _texelSize;
+  uint32_t _maxLayerSize;
+  uint32_t _padding;
+  uint32_t _layerSize = 0;
+
+  std::vector<_Pending> _pending;
+  std::vector<MaterialEntry> _materials;
+  // CPU copy of the mip level 0 of each layer, dropped once uploaded
+  std::vector<std::vector<unsigned char>> _layers;
+
+  wgpu::Texture _texture = nullptr;
+  wgpu::TextureView _textureView = nullptr;
+  wgpu::Buffer _materialBuffer = nullptr;
+};
@@ -0,0 +1,251 @@
+#include "TextureUploader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+// Row pitch alignment required by copyBufferToTexture
+constexpr uint32_t CopyBytesPerRowAlignment = 256;
+
+static uint32_t alignedBytesPerRow(uint32_t width, uint32_t bytesPerTexel) {
+  return (bytesPerTexel * width + CopyBytesPerRowAlignment - 1) &
+         ~(CopyBytesPerRowAlignment - 1);
+}
+
+// sRGB encoded byte to linear intensity
+static const std::array<float, 256> &srgbToLinearTable() {
+  static const std::array<float, 256> table = []() {
+    std::array<float, 256> t;
+    for (int i = 0; i < 256; ++i) {
+      float c = i / 255.0f;
+      t[i] = c <= 0.04045f ? c / 12.92f
+                           : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return t;
+  }();
+  return table;
+}
+
+static unsigned char linearToSrgb(float linear) {
+  float c = linear <= 0.0031308f
+                ? linear * 12.92f
+                : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+  return (unsigned char)std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+ZTextureUploader::ZTextureUploader(Device &rDevice, Queue &rQueue)
+    : _rDevice(rDevice), _rQueue(rQueue) {
+  SupportedLimits supportedLimits;
+  _rDevice.getLimits(&supportedLimits);
+  _maxStagingSize = supportedLimits.limits.maxBufferSize;
+}
+
+ZTextureUploader::~ZTextureUploader() {
+  if (!_pending.empty()) {
+    flush();
+  }
+}
+
+void ZTextureUploader::add(Texture texture, uint32_t layer, uint32_t width,
+                           uint32_t height, uint32_t mipLevelCount,
+                           const unsigned char *pPixels,
+                           std::function<void()> onCopied) {
+  TextureFormat format = texture.getFormat();
+  assert(bytesPerTexel(format) != 0);
+  _pending.push_back({texture, layer, width, height, mipLevelCount, format,
+                      pPixels, std::move(onCopied)});
+}
+
+int ZTextureUploader::flush() {
+  if (_pending.empty()) {
+    return 0;
+  }
+
+  CommandEncoderDescriptor commandEncoderDesc;
+  commandEncoderDesc.label = "Texture upload encoder";
+  CommandEncoder encoder = _rDevice.createCommandEncoder(commandEncoderDesc);
+
+  int result = 0;
+  size_t first = 0;
+  while (first < _pending.size()) {
+    // Gather as many uploads as fit in one staging buffer. This is a single
+    // buffer unless the batch exceeds the device's maxBufferSize.
+    uint64_t stagingSize = _stagingSize(_pending[first]);
+    size_t last = first + 1;
+    while (last < _pending.size() &&
+           stagingSize + _stagingSize(_pending[last]) <= _maxStagingSize) {
+      stagingSize += _stagingSize(_pending[last]);
+      ++last;
+    }
+
+    BufferDescriptor bufferDesc;
+    bufferDesc.label = "Texture staging buffer";
+    bufferDesc.size = stagingSize;
+    bufferDesc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+    bufferDesc.mappedAtCreation = true;
+    Buffer staging = _rDevice.createBuffer(bufferDesc);
+    unsigned char *pStaging =
+        staging ? static_cast<unsigned char *>(
+                      staging.getMappedRange(0, stagingSize))
+                : nullptr;
+    if (nullptr == pStaging) {
+      std::cerr << "Could not map a " << stagingSize
+                << " bytes texture staging buffer" << std::endl;
+      if (staging) {
+        staging.release();
+      }
+      result = 1;
+      break;
+    }
+
+    uint64_t offset = 0;
+    for (size_t i = first; i < last; ++i) {
+      _writeStaging(_pending[i], pStaging, staging, offset, encoder);
+      offset += _stagingSize(_pending[i]);
+    }
+
+    staging.unmap();
+    // The queue keeps the buffer alive until the copies are executed
+    staging.release();
+    first = last;
+  }
+
+  // A failed batch submits nothing, so that the caller can add all of its
+  // uploads again
+  if (result == 0) {
+    CommandBufferDescriptor cmdBufferDescriptor{};
+    cmdBufferDescriptor.label = "Texture upload commands";
+    CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+    _rQueue.submit(command);
+    command.release();
+  }
+  encoder.release();
+
+  // Every upload hands its pixels back, copied or not
+  for (_Pending &upload : _pending) {
+    if (upload.onCopied) {
+      upload.onCopied();
+    }
+  }
+  _pending.clear();
+
+  return result;
+}
+
+uint32_t ZTextureUploader::bytesPerTexel(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::R8Unorm:
+    return 1;
+  case TextureFormat::RG8Unorm:
+    return 2;
+  case TextureFormat::RGBA8Unorm:
+  case TextureFormat::RGBA8UnormSrgb:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+void ZTextureUploader::downsample(TextureFormat format,
+                                  const unsigned char *pSrc, uint32_t srcWidth,
+                                  uint32_t srcHeight, uint32_t srcBytesPerRow,
+                                  unsigned char *pDst, uint32_t dstWidth,
+                                  uint32_t dstHeight,
+                                  uint32_t dstBytesPerRow) {
+  uint32_t texelSize = bytesPerTexel(format);
+  // The alpha channel of sRGB textures is linear
+  uint32_t srgbChannels = format == TextureFormat::RGBA8UnormSrgb ? 3 : 0;
+  const std::array<float, 256> &toLinear = srgbToLinearTable();
+
+  for (uint32_t j = 0; j < dstHeight; ++j) {
+    const unsigned char *pRow0 =
+        &pSrc[std::min(2 * j, srcHeight - 1) * srcBytesPerRow];
+    const unsigned char *pRow1 =
+        &pSrc[std::min(2 * j + 1, srcHeight - 1) * srcBytesPerRow];
+    unsigned char *pDstRow = &pDst[j * dstBytesPerRow];
+    for (uint32_t i = 0; i < dstWidth; ++i) {
+      uint32_t i0 = texelSize * std::min(2 * i, srcWidth - 1);
+      uint32_t i1 = texelSize * std::min(2 * i + 1, srcWidth - 1);
+      for (uint32_t c = 0; c < texelSize; ++c) {
+        unsigned char *p = &pDstRow[texelSize * i + c];
+        if (c < srgbChannels) {
+          float linear = toLinear[pRow0[i0 + c]] + toLinear[pRow0[i1 + c]] +
+                         toLinear[pRow1[i0 + c]] + toLinear[pRow1[i1 + c]];
+          *p = linearToSrgb(linear / 4);
+        } else {
+          *p = (pRow0[i0 + c] + pRow0[i1 + c] + pRow1[i0 + c] +
+                pRow1[i1 + c]) /
+               4;
+        }
+      }
+    }
+  }
+}
+
+uint64_t ZTextureUploader::_stagingSize(const _Pending &upload) {
+  uint32_t texelSize = bytesPerTexel(upload.format);
+  uint64_t size = 0;
+  uint32_t width = upload.width;
+  uint32_t height = upload.height;
+  for (uint32_t level = 0; level < upload.mipLevelCount; ++level) {
+    size += (uint64_t)alignedBytesPerRow(width, texelSize) * height;
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+  }
+  return size;
+}
+
+void ZTextureUploader::_writeStaging(const _Pending &upload,
+                                     unsigned char *pStaging, Buffer staging,
+                                     uint64_t offset,
+                                     CommandEncoder &rEncoder) {
+  ImageCopyBuffer source;
+  source.buffer = staging;
+
+  ImageCopyTexture destination;
+  destination.texture = upload.texture;
+  destination.origin = {0, 0, upload.layer};
+  destination.aspect = TextureAspect::All;
+
+  uint32_t texelSize = bytesPerTexel(upload.format);
+  uint32_t width = upload.width;
+  uint32_t height = upload.height;
+  uint32_t bytesPerRow = alignedBytesPerRow(width, texelSize);
+  const unsigned char *pPrevious = nullptr;
+  uint32_t previousWidth = 0, previousHeight = 0, previousBytesPerRow = 0;
+
+  for (uint32_t level = 0; level < upload.mipLevelCount; ++level) {
+    unsigned char *pLevel = pStaging + offset;
+    if (level == 0) {
+      // The only CPU copy of the pixels: from the caller's tightly packed
+      // rows to the aligned rows of the staging buffer
+      for (uint32_t j = 0; j < height; ++j) {
+        memcpy(pLevel + j * bytesPerRow,
+               upload.pPixels + j * texelSize * width, texelSize * width);
+      }
+    } else {
+      downsample(upload.format, pPrevious, previousWidth, previousHeight,
+                 previousBytesPerRow, pLevel, width, height, bytesPerRow);
+    }
+
+    source.layout.offset = offset;
+    source.layout.bytesPerRow = bytesPerRow;
+    source.layout.rowsPerImage = height;
+    destination.mipLevel = level;
+    rEncoder.copyBufferToTexture(source, destination, {width, height, 1});
+
+    pPrevious = pLevel;
+    previousWidth = width;
+    previousHeight = height;
+    previousBytesPerRow = bytesPerRow;
+    offset += (uint64_t)bytesPerRow * height;
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+    bytesPerRow = alignedBytesPerRow(width, texelSize);
+  }
+}
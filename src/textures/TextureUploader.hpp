@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Batches texture uploads through a single mapped staging buffer.
+ *
+ * Supported formats are the 8 bits per channel R8Unorm, RG8Unorm, RGBA8Unorm
+ * and RGBA8UnormSrgb. The mips of sRGB textures are averaged in linear space.
+ *
+ * The level 0 pixels of every pending texture are copied once into the
+ * staging buffer, using the 256 bytes row alignment required by
+ * `copyBufferToTexture`, and the lower mip levels are generated in place from
+ * there. All levels of all textures are then recorded as copy commands in one
+ * command buffer, instead of one `queue.writeTexture` (and one driver side
+ * copy) per level.
+ */
+class ZTextureUploader {
+public:
+  ZTextureUploader(wgpu::Device &rDevice, wgpu::Queue &rQueue);
+  ~ZTextureUploader();
+
+  // Queue the level 0 of one layer of `texture`, tightly packed in the
+  // texture's format. The other levels are generated from it. `pPixels` must
+  // stay valid until the upload is flushed, after which `onCopied` is called
+  // so that the caller can release it, whether the flush succeeded or not.
+  void add(wgpu::Texture texture, uint32_t layer, uint32_t width,
+           uint32_t height, uint32_t mipLevelCount,
+           const unsigned char *pPixels, std::function<void()> onCopied = {});
+
+  // Write all pending uploads into the staging buffer and submit their copy
+  // commands. Returns non zero if a staging buffer could not be created, in
+  // which case none of the uploads is submitted.
+  int flush();
+
+  bool hasPending() const { return !_pending.empty(); }
+
+  // Size of a texel of one of the supported formats, or 0 if unsupported
+  static uint32_t bytesPerTexel(wgpu::TextureFormat format);
+
+  // Box filter one level into the next one. Odd sizes clamp the source
+  // coordinates so that the last row/column is not lost.
+  static void downsample(wgpu::TextureFormat format, const unsigned char *pSrc,
+                         uint32_t srcWidth, uint32_t srcHeight,
+                         uint32_t srcBytesPerRow, unsigned char *pDst,
+                         uint32_t dstWidth, uint32_t dstHeight,
+                         uint32_t dstBytesPerRow);
+
+private:
+  struct _Pending {
+    wgpu::Texture texture;
+    uint32_t layer;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevelCount;
+    wgpu::TextureFormat format;
+    const unsigned char *pPixels;
+    std::function<void()> onCopied;
+  };
+
+  // Size taken by all the levels of an upload in the staging buffer
+  static uint64_t _stagingSize(const _Pending &upload);
+
+  void _writeStaging(const _Pending &upload, unsigned char *pStaging,
+                     wgpu::Buffer staging, uint64_t offset,
+                     wgpu::CommandEncoder &rEncoder);
+
+private:
+  wgpu::Device &_rDevice;
+  wgpu::Queue &_rQueue;
+  uint64_t _maxStagingSize;
+  std::vector<_Pending> _pending;
+};
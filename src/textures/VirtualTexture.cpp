@@ -0,0 +1,783 @@
+#include "VirtualTexture.hpp"
+#include "../ResourceManager.hpp"
+#include "Mesh.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+using Clock = std::chrono::steady_clock;
+
+// Feedback buffers in flight, the readback of a frame is usually mapped two
+// frames later
+static constexpr size_t ReadbackCount = 3;
+
+static uint32_t pageTexture(uint32_t pageId) { return pageId >> 26; }
+static uint32_t pageMip(uint32_t pageId) { return (pageId >> 22) & 0xF; }
+static uint32_t pageY(uint32_t pageId) { return (pageId >> 11) & 0x7FF; }
+static uint32_t pageX(uint32_t pageId) { return pageId & 0x7FF; }
+
+ZVirtualTexture::ZVirtualTexture(Device &rDevice, Queue &rQueue)
+    : ZVirtualTexture(rDevice, rQueue, Settings{}) {}
+
+ZVirtualTexture::ZVirtualTexture(Device &rDevice, Queue &rQueue,
+                                 const Settings &settings)
+    : _rDevice(rDevice), _rQueue(rQueue), _settings(settings),
+      _paddedPageSize(settings.pageSize + 2 * settings.border),
+      _physicalSize(settings.physicalPagesPerSide * _paddedPageSize) {
+  uint32_t slotCount =
+      _settings.physicalPagesPerSide * _settings.physicalPagesPerSide;
+  _slots.resize(slotCount);
+  // Slots are handed out from the back
+  for (uint32_t slot = slotCount; slot > 0; --slot) {
+    _freeSlots.push_back(slot - 1);
+  }
+  _pageData.resize(4 * _paddedPageSize * _paddedPageSize);
+  _readbacks.resize(ReadbackCount);
+}
+
+ZVirtualTexture::~ZVirtualTexture() {
+  // Map callbacks reference the readbacks, let the pending ones complete
+  for (_Readback &readback : _readbacks) {
+    while (readback.state == _ReadbackState::Mapping) {
+      _rDevice.tick();
+    }
+    if (readback.state == _ReadbackState::Mapped) {
+      readback.buffer.unmap();
+    }
+  }
+  _terminateFeedbackTargets();
+  for (_Readback &readback : _readbacks) {
+    if (readback.buffer) {
+      readback.buffer.destroy();
+      readback.buffer.release();
+    }
+  }
+
+  if (_feedbackPipeline) {
+    _feedbackPipeline.release();
+  }
+  if (_feedbackShader) {
+    _feedbackShader.release();
+  }
+  if (_bindGroup) {
+    _bindGroup.release();
+  }
+  if (_bindGroupLayout) {
+    _bindGroupLayout.release();
+  }
+  if (_paramsBuffer) {
+    _paramsBuffer.destroy();
+    _paramsBuffer.release();
+  }
+  if (_sampler) {
+    _sampler.release();
+  }
+  for (auto [texture, view] : {std::pair{_indirectionTexture, _indirectionView},
+                               std::pair{_physicalTexture, _physicalView}}) {
+    if (view) {
+      view.release();
+    }
+    if (texture) {
+      texture.destroy();
+      texture.release();
+    }
+  }
+}
+
+int ZVirtualTexture::addTexture(const std::filesystem::path &containerPath) {
+  auto container = std::make_unique<ZPageContainer>();
+  if (container->open(containerPath) != 0) {
+    std::cerr << "Could not open page container " << containerPath
+              << std::endl;
+    return -1;
+  }
+
+  // The pages must fit in the physical cache and their IDs in the bits of
+  // packPageId
+  const ZPageContainer::Header &header = container->getHeader();
+  if (header.pageSize != _settings.pageSize ||
+      header.border != _settings.border) {
+    std::cerr << containerPath << " does not match the page size of the "
+              << "virtual textures" << std::endl;
+    return -1;
+  }
+  if (_textures.size() >= 64 || header.mipCount > 16 ||
+      container->getPageCountX(0) > 2048 ||
+      container->getPageCountY(0) > 2048) {
+    std::cerr << containerPath << " exceeds the virtual texture limits"
+              << std::endl;
+    return -1;
+  }
+
+  _textures.push_back({std::move(container), {}, true});
+  return (int)_textures.size() - 1;
+}
+
+int ZVirtualTexture::init(BindGroupLayout sceneLayout,
+                          uint32_t framebufferWidth,
+                          uint32_t framebufferHeight) {
+  if (_textures.empty()) {
+    return 1;
+  }
+
+  // Square indirection whose mip m holds the pages of mip m of every texture
+  uint32_t pageCount = 1;
+  _indirectionMips = 1;
+  for (const _Texture &texture : _textures) {
+    pageCount = std::max({pageCount, texture.container->getPageCountX(0),
+                          texture.container->getPageCountY(0)});
+    _indirectionMips =
+        std::max(_indirectionMips, texture.container->getHeader().mipCount);
+  }
+  uint32_t indirectionSize =
+      std::max(std::bit_ceil(pageCount), 1u << (_indirectionMips - 1));
+  _indirectionMips = std::bit_width(indirectionSize);
+  _indirectionSize[0] = indirectionSize;
+  _indirectionSize[1] = indirectionSize;
+  for (_Texture &texture : _textures) {
+    texture.indirection.resize(_indirectionMips);
+    for (uint32_t mip = 0; mip < _indirectionMips; ++mip) {
+      uint32_t size = std::max(indirectionSize >> mip, 1u);
+      texture.indirection[mip].assign(4 * size * size, 0);
+    }
+  }
+
+  TextureDescriptor textureDesc;
+  textureDesc.dimension = TextureDimension::_2D;
+  textureDesc.format = TextureFormat::RGBA8Uint;
+  textureDesc.size = {indirectionSize, indirectionSize,
+                      (uint32_t)_textures.size()};
+  textureDesc.mipLevelCount = _indirectionMips;
+  textureDesc.sampleCount = 1;
+  textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  _indirectionTexture = _rDevice.createTexture(textureDesc);
+
+  TextureViewDescriptor textureViewDesc;
+  textureViewDesc.aspect = TextureAspect::All;
+  textureViewDesc.baseArrayLayer = 0;
+  textureViewDesc.arrayLayerCount = (uint32_t)_textures.size();
+  textureViewDesc.baseMipLevel = 0;
+  textureViewDesc.mipLevelCount = _indirectionMips;
+  textureViewDesc.dimension = TextureViewDimension::_2DArray;
+  textureViewDesc.format = textureDesc.format;
+  _indirectionView = _indirectionTexture.createView(textureViewDesc);
+
+  textureDesc.format = _settings.format;
+  textureDesc.size = {_physicalSize, _physicalSize, 1};
+  textureDesc.mipLevelCount = 1;
+  _physicalTexture = _rDevice.createTexture(textureDesc);
+
+  textureViewDesc.arrayLayerCount = 1;
+  textureViewDesc.mipLevelCount = 1;
+  textureViewDesc.dimension = TextureViewDimension::_2D;
+  textureViewDesc.format = textureDesc.format;
+  _physicalView = _physicalTexture.createView(textureViewDesc);
+
+  // Page borders make linear filtering safe, the physical cache has no mips
+  SamplerDescriptor samplerDesc;
+  samplerDesc.addressModeU = AddressMode::ClampToEdge;
+  samplerDesc.addressModeV = AddressMode::ClampToEdge;
+  samplerDesc.addressModeW = AddressMode::ClampToEdge;
+  samplerDesc.magFilter = FilterMode::Linear;
+  samplerDesc.minFilter = FilterMode::Linear;
+  samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+  samplerDesc.lodMinClamp = 0.0f;
+  samplerDesc.lodMaxClamp = 1.0f;
+  samplerDesc.compare = CompareFunction::Undefined;
+  samplerDesc.maxAnisotropy = 1;
+  _sampler = _rDevice.createSampler(samplerDesc);
+
+  // One block of parameters per texture, selected with a dynamic offset
+  SupportedLimits supportedLimits;
+  _rDevice.getLimits(&supportedLimits);
+  uint32_t alignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
+  _paramsStride = (sizeof(Params) + alignment - 1) / alignment * alignment;
+
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = _textures.size() * _paramsStride;
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+  bufferDesc.mappedAtCreation = false;
+  _paramsBuffer = _rDevice.createBuffer(bufferDesc);
+  for (uint32_t id = 0; id < _textures.size(); ++id) {
+    const ZPageContainer::Header &header = _textures[id].container->getHeader();
+    Params params{};
+    params.virtualSize[0] = header.width;
+    params.virtualSize[1] = header.height;
+    params.pageSize = header.pageSize;
+    params.paddedPageSize = _paddedPageSize;
+    params.border = header.border;
+    params.mipCount = header.mipCount;
+    params.textureId = id;
+    params.physicalSize = _physicalSize;
+    params.feedbackScale = 1.0f / _settings.feedbackDivisor;
+    params.mipBias = _settings.mipBias;
+    _rQueue.writeBuffer(_paramsBuffer, getParamsOffset(id), &params,
+                        sizeof(Params));
+  }
+
+  std::vector<BindGroupLayoutEntry> bindingLayouts(4, Default);
+  bindingLayouts[0].binding = 0;
+  bindingLayouts[0].visibility = ShaderStage::Fragment;
+  bindingLayouts[0].buffer.type = BufferBindingType::Uniform;
+  bindingLayouts[0].buffer.hasDynamicOffset = true;
+  bindingLayouts[0].buffer.minBindingSize = sizeof(Params);
+
+  bindingLayouts[1].binding = 1;
+  bindingLayouts[1].visibility = ShaderStage::Fragment;
+  bindingLayouts[1].texture.sampleType = TextureSampleType::Uint;
+  bindingLayouts[1].texture.viewDimension = TextureViewDimension::_2DArray;
+
+  bindingLayouts[2].binding = 2;
+  bindingLayouts[2].visibility = ShaderStage::Fragment;
+  bindingLayouts[2].texture.sampleType = TextureSampleType::Float;
+  bindingLayouts[2].texture.viewDimension = TextureViewDimension::_2D;
+
+  bindingLayouts[3].binding = 3;
+  bindingLayouts[3].visibility = ShaderStage::Fragment;
+  bindingLayouts[3].sampler.type = SamplerBindingType::Filtering;
+
+  BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayouts.size();
+  bindGroupLayoutDesc.entries = bindingLayouts.data();
+  _bindGroupLayout = _rDevice.createBindGroupLayout(bindGroupLayoutDesc);
+
+  std::vector<BindGroupEntry> bindings(4);
+  bindings[0].binding = 0;
+  bindings[0].buffer = _paramsBuffer;
+  bindings[0].offset = 0;
+  bindings[0].size = sizeof(Params);
+
+  bindings[1].binding = 1;
+  bindings[1].textureView = _indirectionView;
+
+  bindings[2].binding = 2;
+  bindings[2].textureView = _physicalView;
+
+  bindings[3].binding = 3;
+  bindings[3].sampler = _sampler;
+
+  BindGroupDescriptor bindGroupDesc;
+  bindGroupDesc.layout = _bindGroupLayout;
+  bindGroupDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupDesc.entries = bindings.data();
+  _bindGroup = _rDevice.createBindGroup(bindGroupDesc);
+
+  if (_initPipeline(sceneLayout) != 0) {
+    return 1;
+  }
+  _initFeedbackTargets(framebufferWidth, framebufferHeight);
+
+  // The coarsest page of each texture is always resident so that every
+  // lookup has a fallback
+  for (uint32_t id = 0; id < _textures.size(); ++id) {
+    uint32_t coarsestMip = _textures[id].container->getHeader().mipCount - 1;
+    if (_loadPage(packPageId(id, coarsestMip, 0, 0), true) !=
+        _LoadResult::Loaded) {
+      return 1;
+    }
+    _updateIndirection(id);
+  }
+
+  return _bindGroup && _feedbackPipeline ? 0 : 1;
+}
+
+void ZVirtualTexture::onResize(uint32_t framebufferWidth,
+                               uint32_t framebufferHeight) {
+  _terminateFeedbackTargets();
+  _initFeedbackTargets(framebufferWidth, framebufferHeight);
+}
+
+void ZVirtualTexture::recordFeedback(
+    CommandEncoder &rEncoder, BindGroup sceneBindGroup,
+    const std::vector<FeedbackDraw> &draws) {
+  // Buffers still in use by an earlier frame keep their size until they
+  // are free again
+  _Readback *pReadback = nullptr;
+  for (_Readback &readback : _readbacks) {
+    if (readback.state == _ReadbackState::Free) {
+      pReadback = &readback;
+      break;
+    }
+  }
+  if (nullptr == pReadback) {
+    // The CPU is behind, skipping the pass is cheaper than queuing it
+    ++_stats.droppedFeedbacks;
+    return;
+  }
+
+  uint32_t bytesPerRow = (4 * _feedbackSize[0] + 255) / 256 * 256;
+  if (!pReadback->buffer || pReadback->width != _feedbackSize[0] ||
+      pReadback->height != _feedbackSize[1]) {
+    if (pReadback->buffer) {
+      pReadback->buffer.destroy();
+      pReadback->buffer.release();
+    }
+    BufferDescriptor bufferDesc;
+    bufferDesc.size = (uint64_t)bytesPerRow * _feedbackSize[1];
+    bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+    bufferDesc.mappedAtCreation = false;
+    pReadback->buffer = _rDevice.createBuffer(bufferDesc);
+    pReadback->width = _feedbackSize[0];
+    pReadback->height = _feedbackSize[1];
+    pReadback->bytesPerRow = bytesPerRow;
+  }
+
+  RenderPassColorAttachment colorAttachment;
+  colorAttachment.view = _feedbackView;
+  colorAttachment.resolveTarget = nullptr;
+  colorAttachment.loadOp = LoadOp::Clear;
+  colorAttachment.storeOp = StoreOp::Store;
+  colorAttachment.clearValue = Color{(double)NoPage, 0.0, 0.0, 0.0};
+#ifndef WEBGPU_BACKEND_WGPU
+  colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif
+
+  RenderPassDepthStencilAttachment depthStencilAttachment;
+  depthStencilAttachment.view = _feedbackDepthView;
+  depthStencilAttachment.depthClearValue = 1.0f;
+  depthStencilAttachment.depthLoadOp = LoadOp::Clear;
+  depthStencilAttachment.depthStoreOp = StoreOp::Discard;
+  depthStencilAttachment.depthReadOnly = false;
+  depthStencilAttachment.stencilClearValue = 0;
+  depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+  depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+  depthStencilAttachment.stencilReadOnly = true;
+
+  RenderPassDescriptor renderPassDesc{};
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+  renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+  renderPassDesc.timestampWrites = nullptr;
+
+  RenderPassEncoder renderPass = rEncoder.beginRenderPass(renderPassDesc);
+  renderPass.setPipeline(_feedbackPipeline);
+  renderPass.setBindGroup(0, sceneBindGroup, 0, nullptr);
+  for (const FeedbackDraw &draw : draws) {
+    uint32_t offset = getParamsOffset(draw.textureId);
+    renderPass.setBindGroup(1, _bindGroup, 1, &offset);
+    draw.pMesh->render(renderPass, draw.objectIndex);
+  }
+  renderPass.end();
+  renderPass.release();
+
+  ImageCopyTexture source;
+  source.texture = _feedbackTexture;
+  source.mipLevel = 0;
+  source.origin = {0, 0, 0};
+  source.aspect = TextureAspect::All;
+
+  ImageCopyBuffer destination;
+  destination.buffer = pReadback->buffer;
+  destination.layout.offset = 0;
+  destination.layout.bytesPerRow = bytesPerRow;
+  destination.layout.rowsPerImage = _feedbackSize[1];
+
+  rEncoder.copyTextureToBuffer(source, destination,
+                               {_feedbackSize[0], _feedbackSize[1], 1});
+  pReadback->state = _ReadbackState::Copied;
+  pReadback->frame = _frame;
+  _pCopiedReadback = pReadback;
+}
+
+void ZVirtualTexture::onSubmitted() {
+  if (nullptr == _pCopiedReadback) {
+    return;
+  }
+  // Readbacks never move, _readbacks is sized once
+  _Readback &readback = *_pCopiedReadback;
+  _pCopiedReadback = nullptr;
+  readback.state = _ReadbackState::Mapping;
+  readback.mapCallback = readback.buffer.mapAsync(
+      MapMode::Read, 0, (size_t)readback.bytesPerRow * readback.height,
+      [&readback](BufferMapAsyncStatus status) {
+        readback.state = status == BufferMapAsyncStatus::Success
+                             ? _ReadbackState::Mapped
+                             : _ReadbackState::Free;
+      });
+}
+
+void ZVirtualTexture::update() {
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double, std::milli>(
+                      _settings.analysisBudgetMs));
+  ++_frame;
+
+  // Carry on with a partially analysed feedback, or start on the newest one
+  // and drop the older ones which are stale
+  _Readback *pReadback = nullptr;
+  for (_Readback &readback : _readbacks) {
+    if (readback.state == _ReadbackState::Mapped && readback.cursor > 0) {
+      pReadback = &readback;
+    }
+  }
+  if (nullptr == pReadback) {
+    auto drop = [this](_Readback &readback) {
+      readback.buffer.unmap();
+      readback.state = _ReadbackState::Free;
+      ++_stats.droppedFeedbacks;
+    };
+    for (_Readback &readback : _readbacks) {
+      if (readback.state != _ReadbackState::Mapped) {
+        continue;
+      }
+      if (pReadback && pReadback->frame > readback.frame) {
+        drop(readback);
+        continue;
+      }
+      if (pReadback) {
+        drop(*pReadback);
+      }
+      pReadback = &readback;
+    }
+    if (pReadback) {
+      _requests.clear();
+    }
+  }
+
+  if (pReadback && _analyse(*pReadback, deadline)) {
+    // Missing pages are loaded coarsest first, from the back of the list, so
+    // that a blurry version of every surface shows up as soon as possible
+    _pendingPages.clear();
+    for (uint32_t pageId : _requests) {
+      if (!_residentPages.contains(pageId) &&
+          !_failedPages.contains(pageId)) {
+        _pendingPages.push_back(pageId);
+      }
+    }
+    std::sort(_pendingPages.begin(), _pendingPages.end(),
+              [](uint32_t a, uint32_t b) { return pageMip(a) < pageMip(b); });
+    _stats.requestedPages = (uint32_t)_requests.size();
+  }
+
+  _streamPages(deadline);
+
+  _stats.residentPages = (uint32_t)_residentPages.size();
+  _stats.pendingPages = (uint32_t)_pendingPages.size();
+  _stats.lastUpdateMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int ZVirtualTexture::_initPipeline(BindGroupLayout sceneLayout) {
+  std::vector<ResourceManager::path> shaderPaths = {
+      RESOURCE_DIR "/virtual_texture.wgsl", RESOURCE_DIR "/vt_feedback.wgsl"};
+  _feedbackShader = ResourceManager::loadShaderModule(shaderPaths, _rDevice);
+  if (!_feedbackShader) {
+    std::cerr << "Could not load the virtual texture feedback shader"
+              << std::endl;
+    return 1;
+  }
+
+  RenderPipelineDescriptor pipelineDesc;
+
+  // Vertex fetch, only the position and UV are needed
+  std::vector<VertexAttribute> vertexAttribs(2);
+  vertexAttribs[0].shaderLocation = 0;
+  vertexAttribs[0].format = VertexFormat::Float32x3;
+  vertexAttribs[0].offset = offsetof(ZMesh::VertexAttributes, position);
+
+  vertexAttribs[1].shaderLocation = 3;
+  vertexAttribs[1].format = VertexFormat::Float32x2;
+  vertexAttribs[1].offset = offsetof(ZMesh::VertexAttributes, uv);
+
+  VertexBufferLayout vertexBufferLayout;
+  vertexBufferLayout.attributeCount = (uint32_t)vertexAttribs.size();
+  vertexBufferLayout.attributes = vertexAttribs.data();
+  vertexBufferLayout.arrayStride = sizeof(ZMesh::VertexAttributes);
+  vertexBufferLayout.stepMode = VertexStepMode::Vertex;
+
+  pipelineDesc.vertex.bufferCount = 1;
+  pipelineDesc.vertex.buffers = &vertexBufferLayout;
+  pipelineDesc.vertex.module = _feedbackShader;
+  pipelineDesc.vertex.entryPoint = "vs_main";
+  pipelineDesc.vertex.constantCount = 0;
+  pipelineDesc.vertex.constants = nullptr;
+
+  pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+  pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+  pipelineDesc.primitive.frontFace = FrontFace::CCW;
+  pipelineDesc.primitive.cullMode = CullMode::None;
+
+  FragmentState fragmentState;
+  pipelineDesc.fragment = &fragmentState;
+  fragmentState.module = _feedbackShader;
+  fragmentState.entryPoint = "fs_main";
+  fragmentState.constantCount = 0;
+  fragmentState.constants = nullptr;
+
+  // Page IDs are written as is, integer targets cannot blend
+  ColorTargetState colorTarget;
+  colorTarget.format = TextureFormat::R32Uint;
+  colorTarget.blend = nullptr;
+  colorTarget.writeMask = ColorWriteMask::All;
+
+  fragmentState.targetCount = 1;
+  fragmentState.targets = &colorTarget;
+
+  DepthStencilState depthStencilState = Default;
+  depthStencilState.depthCompare = CompareFunction::Less;
+  depthStencilState.depthWriteEnabled = true;
+  depthStencilState.format = TextureFormat::Depth24Plus;
+  depthStencilState.stencilReadMask = 0;
+  depthStencilState.stencilWriteMask = 0;
+  pipelineDesc.depthStencil = &depthStencilState;
+
+  pipelineDesc.multisample.count = 1;
+  pipelineDesc.multisample.mask = ~0u;
+  pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+  WGPUBindGroupLayout bindGroupLayouts[2] = {sceneLayout, _bindGroupLayout};
+  PipelineLayoutDescriptor layoutDesc{};
+  layoutDesc.bindGroupLayoutCount = 2;
+  layoutDesc.bindGroupLayouts = bindGroupLayouts;
+  PipelineLayout layout = _rDevice.createPipelineLayout(layoutDesc);
+  pipelineDesc.layout = layout;
+
+  _feedbackPipeline = _rDevice.createRenderPipeline(pipelineDesc);
+  layout.release();
+  return _feedbackPipeline ? 0 : 1;
+}
+
+void ZVirtualTexture::_initFeedbackTargets(uint32_t framebufferWidth,
+                                           uint32_t framebufferHeight) {
+  _feedbackSize[0] = std::max(framebufferWidth / _settings.feedbackDivisor, 1u);
+  _feedbackSize[1] =
+      std::max(framebufferHeight / _settings.feedbackDivisor, 1u);
+
+  TextureDescriptor textureDesc;
+  textureDesc.dimension = TextureDimension::_2D;
+  textureDesc.format = TextureFormat::R32Uint;
+  textureDesc.size = {_feedbackSize[0], _feedbackSize[1], 1};
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  _feedbackTexture = _rDevice.createTexture(textureDesc);
+  _feedbackView = _feedbackTexture.createView();
+
+  textureDesc.format = TextureFormat::Depth24Plus;
+  textureDesc.usage = TextureUsage::RenderAttachment;
+  _feedbackDepth = _rDevice.createTexture(textureDesc);
+  _feedbackDepthView = _feedbackDepth.createView();
+}
+
+void ZVirtualTexture::_terminateFeedbackTargets() {
+  for (auto [texture, view] : {std::pair{_feedbackTexture, _feedbackView},
+                               std::pair{_feedbackDepth, _feedbackDepthView}}) {
+    if (view) {
+      view.release();
+    }
+    if (texture) {
+      texture.destroy();
+      texture.release();
+    }
+  }
+  _feedbackTexture = nullptr;
+  _feedbackView = nullptr;
+  _feedbackDepth = nullptr;
+  _feedbackDepthView = nullptr;
+}
+
+bool ZVirtualTexture::_analyse(_Readback &readback,
+                               Clock::time_point deadline) {
+  const uint8_t *pData = static_cast<const uint8_t *>(
+      readback.buffer.getConstMappedRange(
+          0, (size_t)readback.bytesPerRow * readback.height));
+  size_t pixelCount = (size_t)readback.width * readback.height;
+
+  // The clock is only read every few rows of pixels
+  constexpr size_t CheckInterval = 1024;
+  while (readback.cursor < pixelCount) {
+    size_t end = std::min(readback.cursor + CheckInterval, pixelCount);
+    for (size_t i = readback.cursor; i < end; ++i) {
+      size_t x = i % readback.width;
+      size_t y = i / readback.width;
+      uint32_t pageId;
+      memcpy(&pageId, pData + y * readback.bytesPerRow + 4 * x, 4);
+      if (pageId == NoPage || !_requests.insert(pageId).second) {
+        continue;
+      }
+      auto it = _residentPages.find(pageId);
+      if (it != _residentPages.end()) {
+        _slots[it->second].lastUsedFrame = _frame;
+      }
+    }
+    readback.cursor = end;
+    if (Clock::now() >= deadline) {
+      break;
+    }
+  }
+
+  if (readback.cursor < pixelCount) {
+    return false;
+  }
+  readback.buffer.unmap();
+  readback.state = _ReadbackState::Free;
+  readback.cursor = 0;
+  return true;
+}
+
+void ZVirtualTexture::_streamPages(Clock::time_point deadline) {
+  uint32_t loads = 0;
+  while (!_pendingPages.empty() && loads < _settings.maxPageLoadsPerFrame &&
+         Clock::now() < deadline) {
+    uint32_t pageId = _pendingPages.back();
+    _pendingPages.pop_back();
+    if (_residentPages.contains(pageId)) {
+      continue;
+    }
+    _LoadResult result = _loadPage(pageId, false);
+    if (result == _LoadResult::CacheFull) {
+      // The cache is full of pages used this frame, retry later
+      _pendingPages.push_back(pageId);
+      break;
+    }
+    if (result == _LoadResult::Failed) {
+      // Dropped for good, the page keeps showing its resident parent
+      _failedPages.insert(pageId);
+      ++_stats.failedLoads;
+      continue;
+    }
+    ++loads;
+  }
+
+  for (uint32_t id = 0; id < _textures.size(); ++id) {
+    if (_textures[id].indirectionDirty) {
+      _updateIndirection(id);
+    }
+  }
+}
+
+ZVirtualTexture::_LoadResult ZVirtualTexture::_loadPage(uint32_t pageId,
+                                                        bool pinned) {
+  uint32_t textureId = pageTexture(pageId);
+  uint32_t mip = pageMip(pageId);
+  uint32_t x = pageX(pageId);
+  uint32_t y = pageY(pageId);
+  if (textureId >= _textures.size()) {
+    std::cerr << "Invalid virtual page " << pageId << std::endl;
+    return _LoadResult::Failed;
+  }
+  ZPageContainer &container = *_textures[textureId].container;
+  if (mip >= container.getHeader().mipCount ||
+      x >= container.getPageCountX(mip) || y >= container.getPageCountY(mip)) {
+    std::cerr << "Invalid virtual page " << pageId << std::endl;
+    return _LoadResult::Failed;
+  }
+
+  uint32_t slot = _allocateSlot();
+  if (slot == NoPage) {
+    return _LoadResult::CacheFull;
+  }
+  if (container.readPage(mip, x, y, _pageData.data()) != 0) {
+    std::cerr << "Could not read page " << x << ", " << y << " of mip "
+              << mip << " of virtual texture " << textureId << std::endl;
+    _freeSlots.push_back(slot);
+    return _LoadResult::Failed;
+  }
+
+  ImageCopyTexture destination;
+  destination.texture = _physicalTexture;
+  destination.mipLevel = 0;
+  destination.origin = {
+      (slot % _settings.physicalPagesPerSide) * _paddedPageSize,
+      (slot / _settings.physicalPagesPerSide) * _paddedPageSize, 0};
+  destination.aspect = TextureAspect::All;
+
+  TextureDataLayout source;
+  source.offset = 0;
+  source.bytesPerRow = 4 * _paddedPageSize;
+  source.rowsPerImage = _paddedPageSize;
+
+  _rQueue.writeTexture(destination, _pageData.data(), _pageData.size(), source,
+                       {_paddedPageSize, _paddedPageSize, 1});
+
+  _slots[slot] = {pageId, _frame, pinned};
+  _residentPages[pageId] = slot;
+  _textures[textureId].indirectionDirty = true;
+  ++_stats.pageLoads;
+  return _LoadResult::Loaded;
+}
+
+uint32_t ZVirtualTexture::_allocateSlot() {
+  if (!_freeSlots.empty()) {
+    uint32_t slot = _freeSlots.back();
+    _freeSlots.pop_back();
+    return slot;
+  }
+
+  // Evict the least recently used page. A linear scan is fine for the few
+  // hundred slots of the cache; pages used this frame are kept.
+  uint32_t victim = NoPage;
+  for (uint32_t slot = 0; slot < _slots.size(); ++slot) {
+    const _Slot &candidate = _slots[slot];
+    if (candidate.pinned || candidate.lastUsedFrame >= _frame) {
+      continue;
+    }
+    if (victim == NoPage ||
+        candidate.lastUsedFrame < _slots[victim].lastUsedFrame) {
+      victim = slot;
+    }
+  }
+  if (victim == NoPage) {
+    return NoPage;
+  }
+
+  uint32_t evictedPage = _slots[victim].pageId;
+  _residentPages.erase(evictedPage);
+  _textures[pageTexture(evictedPage)].indirectionDirty = true;
+  _slots[victim] = {};
+  ++_stats.evictions;
+  return victim;
+}
+
+void ZVirtualTexture::_updateIndirection(uint32_t textureId) {
+  _Texture &texture = _textures[textureId];
+  const ZPageContainer &container = *texture.container;
+  uint32_t mipCount = container.getHeader().mipCount;
+
+  // From the coarsest mip to the finest, so that pages that are not
+  // resident can inherit the entry of their parent
+  for (uint32_t mip = mipCount; mip-- > 0;) {
+    uint32_t size = std::max(_indirectionSize[0] >> mip, 1u);
+    uint32_t parentSize = std::max(_indirectionSize[0] >> (mip + 1), 1u);
+    std::vector<uint8_t> &entries = texture.indirection[mip];
+    for (uint32_t y = 0; y < container.getPageCountY(mip); ++y) {
+      for (uint32_t x = 0; x < container.getPageCountX(mip); ++x) {
+        uint8_t *pEntry = &entries[4 * (y * size + x)];
+        auto it = _residentPages.find(packPageId(textureId, mip, x, y));
+        if (it != _residentPages.end()) {
+          pEntry[0] = (uint8_t)(it->second % _settings.physicalPagesPerSide);
+          pEntry[1] = (uint8_t)(it->second / _settings.physicalPagesPerSide);
+          pEntry[2] = (uint8_t)mip;
+          pEntry[3] = 255;
+        } else if (mip + 1 < mipCount) {
+          const std::vector<uint8_t> &parents = texture.indirection[mip + 1];
+          memcpy(pEntry, &parents[4 * ((y / 2) * parentSize + x / 2)], 4);
+        }
+      }
+    }
+
+    ImageCopyTexture destination;
+    destination.texture = _indirectionTexture;
+    destination.mipLevel = mip;
+    destination.origin = {0, 0, textureId};
+    destination.aspect = TextureAspect::All;
+
+    TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = 4 * size;
+    source.rowsPerImage = size;
+
+    _rQueue.writeTexture(destination, entries.data(), entries.size(), source,
+                         {size, size, 1});
+  }
+  texture.indirectionDirty = false;
+}
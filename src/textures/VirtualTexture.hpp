@@ -0,0 +1,238 @@
+#pragma once
+
+#include "PageContainer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class ZMesh;
+
+/**
+ * Sparse virtual texturing over cooked page containers.
+ *
+ * Only the pages that are actually visible are resident, in a physical page
+ * cache texture. An indirection texture (one array layer per virtual texture,
+ * one mip per virtual mip) maps each virtual page to its physical page, or
+ * to the closest resident coarser page while it streams in.
+ *
+ * Each frame, a low resolution feedback pass writes the ID of the
+ * (texture, mip, page) needed by each pixel. The feedback is read back a few
+ * frames later; the CPU deduplicates the requested pages, refreshes the LRU
+ * state of the resident ones and loads missing ones from their container,
+ * all within a fixed time budget.
+ *
+ * Material shaders sample through `sampleVirtual` or `sampleVirtualGrad` of
+ * resources/virtual_texture.wgsl, with the bind group of this class at
+ * group 1 and the dynamic offset of the sampled texture.
+ */
+class ZVirtualTexture {
+public:
+  struct Settings {
+    // Pages of the cooked containers, which must all match
+    uint32_t pageSize = 128;
+    uint32_t border = 4;
+    // Format of the physical cache, RGBA8UnormSrgb for color pages
+    wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm;
+    // The physical cache holds physicalPagesPerSide^2 pages, at most 256
+    // per side as indirection entries are 8 bits
+    uint32_t physicalPagesPerSide = 15;
+    // The feedback pass renders at 1/feedbackDivisor of the framebuffer
+    uint32_t feedbackDivisor = 8;
+    // CPU time allowed to the feedback analysis and page loads per frame
+    double analysisBudgetMs = 1.0;
+    uint32_t maxPageLoadsPerFrame = 8;
+    // Added to the mip computed by the feedback pass
+    float mipBias = 0.0f;
+  };
+
+  struct Stats {
+    // Distinct pages requested by the last analysed feedback
+    uint32_t requestedPages = 0;
+    uint32_t residentPages = 0;
+    // Requested pages still waiting for a physical slot
+    uint32_t pendingPages = 0;
+    uint64_t pageLoads = 0;
+    // Pages dropped because they could not be read
+    uint64_t failedLoads = 0;
+    uint64_t evictions = 0;
+    // Feedback buffers that were dropped because none was free
+    uint64_t droppedFeedbacks = 0;
+    double lastUpdateMs = 0.0;
+  };
+
+  /**
+   * Per virtual texture parameters, replicated in the shaders as `VtParams`
+   */
+  struct Params {
+    uint32_t virtualSize[2];
+    uint32_t pageSize;
+    uint32_t paddedPageSize;
+    uint32_t border;
+    uint32_t mipCount;
+    uint32_t textureId;
+    uint32_t physicalSize;
+    float feedbackScale;
+    float mipBias;
+    uint32_t _pad[2];
+  };
+  static_assert(sizeof(Params) % 16 == 0);
+
+  // Value of the feedback pixels where no virtual texture is visible
+  static constexpr uint32_t NoPage = 0xFFFFFFFF;
+
+  // An object of the scene sampling a virtual texture
+  struct FeedbackDraw {
+    uint32_t textureId;
+    ZMesh *pMesh;
+    // Record of the object in the scene's object buffer
+    uint32_t objectIndex;
+  };
+
+public:
+  ZVirtualTexture(wgpu::Device &rDevice, wgpu::Queue &rQueue);
+  ZVirtualTexture(wgpu::Device &rDevice, wgpu::Queue &rQueue,
+                  const Settings &settings);
+  ~ZVirtualTexture();
+
+  // Register a cooked container, returns its texture ID or -1 on failure.
+  // All textures must be added before `init`.
+  int addTexture(const std::filesystem::path &containerPath);
+
+  // Create the GPU resources and the feedback pipeline. `sceneLayout` is the
+  // bind group layout at group 0 of the scene, whose binding 0 holds the
+  // camera uniforms and binding 5 the object buffer.
+  int init(wgpu::BindGroupLayout sceneLayout, uint32_t framebufferWidth,
+           uint32_t framebufferHeight);
+
+  void onResize(uint32_t framebufferWidth, uint32_t framebufferHeight);
+
+  // Render the feedback of `draws` and queue its readback. To be called once
+  // per frame before the command buffer is finished.
+  void recordFeedback(wgpu::CommandEncoder &rEncoder,
+                      wgpu::BindGroup sceneBindGroup,
+                      const std::vector<FeedbackDraw> &draws);
+
+  // Start mapping the feedback recorded this frame. To be called right after
+  // the command buffer of `recordFeedback` was submitted.
+  void onSubmitted();
+
+  // Analyse the oldest mapped feedback and stream pages in, within the time
+  // budget of the settings. To be called once per frame.
+  void update();
+
+  wgpu::BindGroupLayout getBindGroupLayout() const { return _bindGroupLayout; }
+  wgpu::BindGroup getBindGroup() const { return _bindGroup; }
+  // Dynamic offset selecting the parameters of a texture in the bind group
+  uint32_t getParamsOffset(uint32_t textureId) const {
+    return textureId * _paramsStride;
+  }
+  const Stats &getStats() const { return _stats; }
+
+  static uint32_t packPageId(uint32_t textureId, uint32_t mip, uint32_t x,
+                             uint32_t y) {
+    return (textureId << 26) | (mip << 22) | (y << 11) | x;
+  }
+
+private:
+  struct _Texture {
+    std::unique_ptr<ZPageContainer> container;
+    // Indirection entries (physical x, physical y, mip, valid) of each mip
+    std::vector<std::vector<uint8_t>> indirection;
+    bool indirectionDirty = true;
+  };
+
+  struct _Slot {
+    uint32_t pageId = NoPage;
+    uint64_t lastUsedFrame = 0;
+    // The coarsest page of each texture is never evicted, it is the
+    // fallback of every other page
+    bool pinned = false;
+  };
+
+  enum class _ReadbackState { Free, Copied, Mapping, Mapped };
+
+  enum class _LoadResult {
+    Loaded,
+    // Every slot holds a page used this frame, the page can be retried later
+    CacheFull,
+    // Bad page ID or unreadable container, retrying would fail again
+    Failed,
+  };
+
+  struct _Readback {
+    wgpu::Buffer buffer = nullptr;
+    _ReadbackState state = _ReadbackState::Free;
+    std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bytesPerRow = 0;
+    // Frame whose feedback the buffer holds
+    uint64_t frame = 0;
+    // Next pixel to analyse, analysis can span several frames
+    size_t cursor = 0;
+  };
+
+  int _initPipeline(wgpu::BindGroupLayout sceneLayout);
+  void _initFeedbackTargets(uint32_t framebufferWidth,
+                            uint32_t framebufferHeight);
+  void _terminateFeedbackTargets();
+
+  bool _analyse(_Readback &readback,
+                std::chrono::steady_clock::time_point deadline);
+  void _streamPages(std::chrono::steady_clock::time_point deadline);
+  _LoadResult _loadPage(uint32_t pageId, bool pinned);
+  uint32_t _allocateSlot();
+  void _updateIndirection(uint32_t textureId);
+
+private:
+  wgpu::Device &_rDevice;
+  wgpu::Queue &_rQueue;
+  Settings _settings;
+  uint32_t _paddedPageSize;
+  uint32_t _physicalSize;
+  uint32_t _paramsStride = 256;
+  uint64_t _frame = 0;
+
+  std::vector<_Texture> _textures;
+  std::vector<_Slot> _slots;
+  std::vector<uint32_t> _freeSlots;
+  // Page ID to physical slot
+  std::unordered_map<uint32_t, uint32_t> _residentPages;
+  std::unordered_set<uint32_t> _requests;
+  std::vector<uint32_t> _pendingPages;
+  // Pages that could not be read, no longer requested
+  std::unordered_set<uint32_t> _failedPages;
+  std::vector<unsigned char> _pageData;
+
+  // Physical cache and indirection
+  wgpu::Texture _physicalTexture = nullptr;
+  wgpu::TextureView _physicalView = nullptr;
+  wgpu::Texture _indirectionTexture = nullptr;
+  wgpu::TextureView _indirectionView = nullptr;
+  uint32_t _indirectionSize[2] = {1, 1};
+  uint32_t _indirectionMips = 1;
+  wgpu::Sampler _sampler = nullptr;
+  wgpu::Buffer _paramsBuffer = nullptr;
+  wgpu::BindGroupLayout _bindGroupLayout = nullptr;
+  wgpu::BindGroup _bindGroup = nullptr;
+
+  // Feedback pass
+  wgpu::ShaderModule _feedbackShader = nullptr;
+  wgpu::RenderPipeline _feedbackPipeline = nullptr;
+  wgpu::Texture _feedbackTexture = nullptr;
+  wgpu::TextureView _feedbackView = nullptr;
+  wgpu::Texture _feedbackDepth = nullptr;
+  wgpu::TextureView _feedbackDepthView = nullptr;
+  uint32_t _feedbackSize[2] = {1, 1};
+  std::vector<_Readback> _readbacks;
+  _Readback *_pCopiedReadback = nullptr;
+
+  Stats _stats;
+};
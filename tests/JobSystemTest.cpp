@@ -0,0 +1,297 @@
+#include "JobSystem.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Stress test of ZJobSystem, and with --benchmark, the time of a fixed
+ * workload for each worker count.
+ */
+
+// Checks fail from any thread
+static std::atomic<int> failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #condition " failed"    \
+                << std::endl;                                                  \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (false)
+
+// Threads submitting and waiting at the same time as the workers
+constexpr uint32_t ExternalThreads = 4;
+constexpr uint32_t Rounds = 20;
+
+// Many jobs from several threads outside of the system, which go through
+// the injection queue
+static void testExternalSubmission(ZJobSystem &rJobs) {
+  constexpr uint32_t JobsPerThread = 10000;
+  std::atomic<uint64_t> sum = 0;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < ExternalThreads; ++t) {
+    threads.emplace_back([&rJobs, &sum]() {
+      ZJobSystem::Counter counter;
+      for (uint32_t i = 0; i < JobsPerThread; ++i) {
+        rJobs.run([&sum, i]() { sum.fetch_add(i); }, &counter);
+      }
+      rJobs.wait(counter);
+      CHECK(counter.isDone());
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  uint64_t expected = (uint64_t)JobsPerThread * (JobsPerThread - 1) / 2;
+  CHECK(sum.load() == ExternalThreads * expected);
+}
+
+// A tree of jobs spawned from the jobs themselves, pushed to and popped from
+// the deques of the workers and stolen by the others. The roots, run from
+// the thread that created the system, overflow its deque.
+static void spawnTree(ZJobSystem &rJobs, ZJobSystem::Counter &rCounter,
+                      std::atomic<uint32_t> &rLeaves, uint32_t depth) {
+  if (depth == 0) {
+    rLeaves.fetch_add(1);
+    return;
+  }
+  for (uint32_t i = 0; i < 4; ++i) {
+    rJobs.run(
+        [&rJobs, &rCounter, &rLeaves, depth]() {
+          spawnTree(rJobs, rCounter, rLeaves, depth - 1);
+        },
+        &rCounter);
+  }
+}
+
+static void testNestedSpawning(ZJobSystem &rJobs) {
+  constexpr uint32_t Roots = 5000;
+  constexpr uint32_t Depth = 2;
+  std::atomic<uint32_t> leaves = 0;
+  ZJobSystem::Counter counter;
+  for (uint32_t i = 0; i < Roots; ++i) {
+    rJobs.run([&]() { spawnTree(rJobs, counter, leaves, Depth); }, &counter);
+  }
+  rJobs.wait(counter);
+  CHECK(leaves.load() == Roots * 4 * 4);
+}
+
+// Chains of jobs, each depending on the counter of the previous one, built
+// while the previous jobs already run
+static void testContinuations(ZJobSystem &rJobs) {
+  constexpr uint32_t Chains = 64;
+  constexpr uint32_t Length = 32;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < ExternalThreads; ++t) {
+    threads.emplace_back([&rJobs]() {
+      for (uint32_t chain = 0; chain < Chains; ++chain) {
+        std::vector<ZJobSystem::Counter> counters(Length);
+        std::vector<uint32_t> steps(Length, 0);
+        std::atomic<bool> ordered = true;
+        for (uint32_t i = 0; i < Length; ++i) {
+          ZJobSystem::Counter *pDependency = i > 0 ? &counters[i - 1] : nullptr;
+          rJobs.run(
+              [&steps, &ordered, i]() {
+                // Written by the previous job only
+                if (i > 0 && steps[i - 1] != i) {
+                  ordered.store(false);
+                }
+                steps[i] = i + 1;
+              },
+              &counters[i], pDependency);
+        }
+        rJobs.wait(counters.back());
+        CHECK(ordered.load());
+        CHECK(steps.back() == Length);
+      }
+
+      // A dependency that is already done does not hold the job back
+      ZJobSystem::Counter done;
+      ZJobSystem::Counter counter;
+      std::atomic<bool> ran = false;
+      rJobs.run([&ran]() { ran.store(true); }, &counter, &done);
+      rJobs.wait(counter);
+      CHECK(ran.load());
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+// Concurrent and nested parallelFor, each index visited exactly once
+static void testParallelFor(ZJobSystem &rJobs) {
+  constexpr uint32_t Count = 100000;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < ExternalThreads; ++t) {
+    threads.emplace_back([&rJobs, t]() {
+      std::vector<std::atomic<uint32_t>> visits(Count);
+      rJobs.parallelFor(Count, 7 + t * 100, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          visits[i].fetch_add(1);
+        }
+      });
+      uint32_t wrong = 0;
+      for (const std::atomic<uint32_t> &visit : visits) {
+        wrong += visit.load() != 1;
+      }
+      CHECK(wrong == 0);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::atomic<uint32_t> inner = 0;
+  rJobs.parallelFor(64, 1, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      rJobs.parallelFor(64, 4, [&](uint32_t innerBegin, uint32_t innerEnd) {
+        inner.fetch_add(innerEnd - innerBegin);
+      });
+    }
+  });
+  CHECK(inner.load() == 64 * 64);
+
+  bool called = false;
+  rJobs.parallelFor(0, 16, [&](uint32_t, uint32_t) { called = true; });
+  CHECK(!called);
+}
+
+// A thread outside of the system waiting for its counter runs its own jobs,
+// but not the ones submitted before them with another counter
+static void testExternalWaitSkipsOtherJobs(ZJobSystem &rJobs) {
+  if (rJobs.getWorkerCount() == 0) {
+    // Waiting threads run every job, nothing else would
+    return;
+  }
+  std::thread([&rJobs]() {
+    // Keeps the workers busy, so that the other jobs stay queued
+    std::atomic<uint32_t> started = 0;
+    std::atomic<bool> released = false;
+    ZJobSystem::Counter blockers;
+    for (uint32_t i = 0; i < rJobs.getWorkerCount(); ++i) {
+      rJobs.run(
+          [&started, &released]() {
+            started.fetch_add(1);
+            while (!released.load()) {
+              std::this_thread::yield();
+            }
+          },
+          &blockers);
+    }
+    while (started.load() < rJobs.getWorkerCount()) {
+      std::this_thread::yield();
+    }
+
+    std::atomic<bool> otherRanHere = false;
+    std::thread::id waiter = std::this_thread::get_id();
+    ZJobSystem::Counter other;
+    rJobs.run(
+        [&otherRanHere, waiter]() {
+          otherRanHere.store(std::this_thread::get_id() == waiter);
+        },
+        &other);
+    ZJobSystem::Counter own;
+    std::atomic<uint32_t> ownJobs = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+      rJobs.run([&ownJobs]() { ownJobs.fetch_add(1); }, &own);
+    }
+    rJobs.wait(own);
+    CHECK(ownJobs.load() == 16);
+    CHECK(!other.isDone());
+
+    // Run by a freed worker, before the wait could help with it
+    released.store(true);
+    while (!other.isDone()) {
+      std::this_thread::yield();
+    }
+    rJobs.wait(other);
+    rJobs.wait(blockers);
+    CHECK(!otherRanHere.load());
+  }).join();
+}
+
+static void testStats(ZJobSystem &rJobs) {
+  ZJobSystem::Stats before = rJobs.getStats();
+  ZJobSystem::Counter counter;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    rJobs.run([]() {}, &counter);
+  }
+  rJobs.wait(counter);
+  ZJobSystem::Stats after = rJobs.getStats();
+  CHECK(after.jobs - before.jobs == 1000);
+  CHECK(after.steals >= before.steals);
+}
+
+static int runTests() {
+  uint32_t maxWorkers = std::max(std::thread::hardware_concurrency(), 2u);
+  // Without workers, with a few, and with more workers than cores
+  for (uint32_t workers : {0u, 1u, 3u, maxWorkers + 2}) {
+    for (uint32_t round = 0; round < Rounds; ++round) {
+      ZJobSystem jobs(workers);
+      testExternalSubmission(jobs);
+      testNestedSpawning(jobs);
+      testContinuations(jobs);
+      testParallelFor(jobs);
+      testExternalWaitSkipsOtherJobs(jobs);
+      testStats(jobs);
+      if (failures > 0) {
+        std::cerr << "Failed with " << workers << " workers" << std::endl;
+        return 1;
+      }
+    }
+  }
+  std::cout << "All job system tests passed" << std::endl;
+  return 0;
+}
+
+// Enough work per index that the scheduling overhead does not dominate
+static uint32_t work(uint32_t seed) {
+  uint32_t x = seed;
+  for (uint32_t i = 0; i < 20000; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+  }
+  return x;
+}
+
+static void runBenchmark() {
+  constexpr uint32_t Count = 16384;
+  constexpr uint32_t Grain = 16;
+  uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+  double baseMs = 0.0;
+  for (uint32_t workers = 0; workers < cores; ++workers) {
+    ZJobSystem jobs(workers);
+    std::vector<uint32_t> results(Count);
+    auto start = std::chrono::steady_clock::now();
+    jobs.parallelFor(Count, Grain, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        results[i] = work(i + 1);
+      }
+    });
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    if (workers == 0) {
+      baseMs = ms;
+    }
+    ZJobSystem::Stats stats = jobs.getStats();
+    std::cout << workers << " workers: " << ms << " ms, speedup "
+              << baseMs / ms << ", " << stats.steals << " steals" << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0) {
+    runBenchmark();
+    return 0;
+  }
+  return runTests();
+}
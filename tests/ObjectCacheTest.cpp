@@ -0,0 +1,148 @@
+#include "ObjectCache.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+
+/**
+ * Test of the reference counting and delayed release of ZObjectCache, with
+ * fake objects in place of wgpu handles so that no device is needed.
+ */
+
+static int failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #condition " failed"    \
+                << std::endl;                                                  \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (false)
+
+struct FakeObject {
+  uint32_t value;
+};
+
+// Released objects, to check that each is released once
+static uint32_t releasedCount = 0;
+
+// Mimics the wgpu handle classes: a wrapped pointer and `release`
+class FakeHandle {
+public:
+  typedef FakeObject *W;
+  FakeHandle() : _raw(nullptr) {}
+  FakeHandle(const W &w) : _raw(w) {}
+  operator const W &() const { return _raw; }
+  operator bool() const { return _raw != nullptr; }
+  bool operator==(const FakeHandle &other) const = default;
+  void release() {
+    delete _raw;
+    _raw = nullptr;
+    ++releasedCount;
+  }
+
+private:
+  W _raw;
+};
+
+struct FakeKey {
+  uint32_t value = 0;
+
+  bool operator==(const FakeKey &other) const = default;
+
+  struct Hash {
+    size_t operator()(const FakeKey &key) const {
+      return std::hash<uint32_t>()(key.value);
+    }
+  };
+};
+
+class FakeCache : public ZObjectCache<FakeKey, FakeHandle> {
+public:
+  FakeCache(wgpu::Device &rDevice, uint32_t releaseDelay)
+      : ZObjectCache(rDevice, releaseDelay) {}
+  ~FakeCache() override = default;
+
+  FakeHandle acquire(uint32_t value) { return _acquire(FakeKey{value}); }
+
+private:
+  FakeHandle _create(const FakeKey &key) override {
+    return new FakeObject{key.value};
+  }
+};
+
+constexpr uint32_t ReleaseDelay = 3;
+
+// An object acquired again returns the same handle, and is released
+// `ReleaseDelay` frames after its last reference is dropped
+static void testDelayedRelease(wgpu::Device &rDevice) {
+  releasedCount = 0;
+  FakeCache cache(rDevice, ReleaseDelay);
+  FakeHandle first = cache.acquire(1);
+  FakeHandle second = cache.acquire(1);
+  CHECK(first == second);
+  CHECK(cache.getStats().hits == 1);
+  CHECK(cache.getStats().misses == 1);
+
+  cache.release(first);
+  cache.endFrame();
+  CHECK(cache.getStats().unusedCount == 0);
+  cache.release(second);
+  for (uint32_t frame = 0; frame < ReleaseDelay; ++frame) {
+    cache.endFrame();
+    CHECK(cache.getStats().objectCount == 1);
+  }
+  cache.endFrame();
+  CHECK(cache.getStats().objectCount == 0);
+  CHECK(cache.getStats().unusedCount == 0);
+  CHECK(releasedCount == 1);
+
+  // Released by the destructor
+  cache.acquire(2);
+  cache.acquire(3);
+}
+
+// Objects acquired and released every frame, like the cached bundles and
+// bind groups, stay alive and are listed for release once each
+static void testAcquireReleaseEveryFrame(wgpu::Device &rDevice) {
+  releasedCount = 0;
+  constexpr uint32_t Objects = 8;
+  FakeCache cache(rDevice, ReleaseDelay);
+  for (uint32_t frame = 0; frame < 1000; ++frame) {
+    for (uint32_t i = 0; i < Objects; ++i) {
+      // Twice in some frames
+      for (uint32_t j = 0; j <= frame % 2; ++j) {
+        cache.release(cache.acquire(i));
+      }
+    }
+    CHECK(cache.getStats().unusedCount <= Objects);
+    cache.endFrame();
+    CHECK(cache.getStats().unusedCount <= Objects);
+  }
+  CHECK(cache.getStats().objectCount == Objects);
+  CHECK(cache.getStats().misses == Objects);
+  CHECK(releasedCount == 0);
+
+  // Held across endFrame, then released for good
+  FakeHandle held = cache.acquire(0);
+  cache.endFrame();
+  cache.release(held);
+  for (uint32_t frame = 0; frame <= ReleaseDelay; ++frame) {
+    cache.endFrame();
+  }
+  CHECK(cache.getStats().objectCount == 0);
+  CHECK(cache.getStats().unusedCount == 0);
+  CHECK(releasedCount == Objects);
+}
+
+int main() {
+  wgpu::Device device;
+  testDelayedRelease(device);
+  testAcquireReleaseEveryFrame(device);
+  if (failures > 0) {
+    return 1;
+  }
+  std::cout << "All object cache tests passed" << std::endl;
+  return 0;
+}